@@ -6,6 +6,8 @@
 
 /* --- tool functions for file handling ------------------------------------ */
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -13,11 +15,129 @@
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/avutil.h>
-#include <libavutil/opt.h>
 
 #include "imageprocess/blit.h"
 #include "unpaper.h"
 
+// Number of opened codec contexts kept for reuse once their file is done.
+#define CODEC_CONTEXTS_KEPT 8
+
+// An opened codec context, with the size and pixel format of the frames it
+// encodes or, for a decoder, of the frame it last decoded.
+typedef struct {
+  AVCodecContext *context;
+  bool encoder;
+  enum AVCodecID codec_id;
+  RectangleSize size;
+  int pixel_format;
+} CodecContextEntry;
+
+// Codec contexts not in use, oldest first, so that a batch of files of the
+// same kind opens a decoder and an encoder once rather than for each file.
+// Workers take them out while decoding or encoding, so that each is only
+// used by one thread at a time.
+static struct {
+  pthread_mutex_t mutex;
+  CodecContextEntry entries[CODEC_CONTEXTS_KEPT];
+  int count;
+} codec_contexts = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// Demuxer of all the input files, if declared up front.
+static const AVInputFormat *input_format = NULL;
+
+bool setInputFormat(const char *name) {
+  input_format = av_find_input_format(name);
+  if (input_format == NULL) {
+    // Image demuxers are mostly named after their codec.
+    char pipe_name[64];
+    snprintf(pipe_name, sizeof(pipe_name), "%s_pipe", name);
+    input_format = av_find_input_format(pipe_name);
+  }
+  return input_format != NULL;
+}
+
+/**
+ * Takes a context opened for the codec, size and pixel format out of the kept
+ * ones, or allocates a new one for the caller to open.
+ *
+ * Decoders are kept under the size and format of the frame they last decoded.
+ * Without probing (--input-format), the size and format of a file are only
+ * known once decoded, so a decoder is looked up with an empty size and
+ * AV_PIX_FMT_NONE instead, which takes the most recently kept one of the
+ * codec: image decoders are not tied to the size and format of a frame.
+ */
+static AVCodecContext *take_codec_context(bool encoder, const AVCodec *codec,
+                                          RectangleSize size,
+                                          int pixel_format) {
+  pthread_mutex_lock(&codec_contexts.mutex);
+  for (int i = codec_contexts.count - 1; i >= 0; i--) {
+    CodecContextEntry *entry = &codec_contexts.entries[i];
+    const bool any_frame = !encoder && size.width == 0 &&
+                           size.height == 0 && pixel_format == AV_PIX_FMT_NONE;
+    if (entry->encoder == encoder && entry->codec_id == codec->id &&
+        (any_frame || (compare_sizes(entry->size, size) == 0 &&
+                       entry->pixel_format == pixel_format))) {
+      AVCodecContext *context = entry->context;
+      codec_contexts.count--;
+      memmove(entry, entry + 1,
+              (codec_contexts.count - i) * sizeof(CodecContextEntry));
+      pthread_mutex_unlock(&codec_contexts.mutex);
+      return context;
+    }
+  }
+  pthread_mutex_unlock(&codec_contexts.mutex);
+
+  AVCodecContext *context = avcodec_alloc_context3(codec);
+  if (context == NULL) {
+    errReport("unable to allocate codec context.");
+  }
+  return context;
+}
+
+/**
+ * Keeps an opened context for the next file of the same codec, size and pixel
+ * format, making way for it by freeing the oldest one kept if needed.
+ */
+static void keep_codec_context(AVCodecContext **context, bool encoder,
+                               enum AVCodecID codec_id, RectangleSize size,
+                               int pixel_format) {
+  AVCodecContext *dropped = NULL;
+
+  if (!encoder) {
+    avcodec_flush_buffers(*context);
+  }
+
+  pthread_mutex_lock(&codec_contexts.mutex);
+  if (codec_contexts.count == CODEC_CONTEXTS_KEPT) {
+    dropped = codec_contexts.entries[0].context;
+    codec_contexts.count--;
+    memmove(&codec_contexts.entries[0], &codec_contexts.entries[1],
+            codec_contexts.count * sizeof(CodecContextEntry));
+  }
+  codec_contexts.entries[codec_contexts.count++] = (CodecContextEntry){
+      .context = *context,
+      .encoder = encoder,
+      .codec_id = codec_id,
+      .size = size,
+      .pixel_format = pixel_format,
+  };
+  pthread_mutex_unlock(&codec_contexts.mutex);
+
+  *context = NULL;
+  avcodec_free_context(&dropped);
+}
+
+void freeCodecContexts(void) {
+  pthread_mutex_lock(&codec_contexts.mutex);
+  for (int i = 0; i < codec_contexts.count; i++) {
+    avcodec_free_context(&codec_contexts.entries[i].context);
+  }
+  codec_contexts.count = 0;
+  pthread_mutex_unlock(&codec_contexts.mutex);
+}
+
 /**
  * Loads image data from a file in pnm format.
  *
@@ -35,13 +155,17 @@ void loadImage(const char *filename, Image *image, Pixel sheet_background,
   AVFrame *frame = av_frame_alloc();
   char errbuff[1024];
 
-  ret = avformat_open_input(&s, filename, NULL, NULL);
+  ret = avformat_open_input(&s, filename, input_format, NULL);
   if (ret < 0) {
     av_strerror(ret, errbuff, sizeof(errbuff));
     errOutput("unable to open file %s: %s", filename, errbuff);
   }
 
-  avformat_find_stream_info(s, NULL);
+  // Probing decodes the image once more, and is only needed to find out its
+  // format, unless declared.
+  if (input_format == NULL) {
+    avformat_find_stream_info(s, NULL);
+  }
 
   if (verbose >= VERBOSE_MORE)
     av_dump_format(s, 0, filename, 0);
@@ -53,20 +177,24 @@ void loadImage(const char *filename, Image *image, Pixel sheet_background,
   if (!codec)
     errOutput("unable to open file %s: unsupported format", filename);
 
-  avctx = avcodec_alloc_context3(codec);
+  const AVCodecParameters *codecpar = s->streams[0]->codecpar;
+  const RectangleSize coded_size = {codecpar->width, codecpar->height};
+  avctx = take_codec_context(false, codec, coded_size, codecpar->format);
   if (!avctx)
     errOutput("cannot allocate decoder context for %s", filename);
 
-  ret = avcodec_parameters_to_context(avctx, s->streams[0]->codecpar);
-  if (ret < 0) {
-    av_strerror(ret, errbuff, sizeof errbuff);
-    errOutput("unable to copy parameters to context: %s", errbuff);
-  }
+  if (!avcodec_is_open(avctx)) {
+    ret = avcodec_parameters_to_context(avctx, codecpar);
+    if (ret < 0) {
+      av_strerror(ret, errbuff, sizeof errbuff);
+      errOutput("unable to copy parameters to context: %s", errbuff);
+    }
 
-  ret = avcodec_open2(avctx, codec, NULL);
-  if (ret < 0) {
-    av_strerror(ret, errbuff, sizeof errbuff);
-    errOutput("unable to open file %s: %s", filename, errbuff);
+    ret = avcodec_open2(avctx, codec, NULL);
+    if (ret < 0) {
+      av_strerror(ret, errbuff, sizeof errbuff);
+      errOutput("unable to open file %s: %s", filename, errbuff);
+    }
   }
 
   ret = av_read_frame(s, &pkt);
@@ -89,6 +217,7 @@ void loadImage(const char *filename, Image *image, Pixel sheet_background,
     av_strerror(ret, errbuff, sizeof errbuff);
     errOutput("error while receiving frame from decoder: %s", errbuff);
   }
+  av_packet_unref(&pkt);
 
   Rectangle area = rectangle_from_size(
       POINT_ORIGIN,
@@ -99,12 +228,13 @@ void loadImage(const char *filename, Image *image, Pixel sheet_background,
   case AV_PIX_FMT_GRAY8:
   case AV_PIX_FMT_RGB24:
   case AV_PIX_FMT_MONOBLACK:
-  case AV_PIX_FMT_MONOWHITE:
-    *image = create_image(size_of_rectangle(area), frame->format, false,
-                          sheet_background, abs_black_threshold);
-    av_frame_free(&image->frame);
-    image->frame = av_frame_clone(frame);
-    break;
+  case AV_PIX_FMT_MONOWHITE: {
+    AVFrame *pixels = av_frame_clone(frame);
+    if (pixels == NULL) {
+      errOutput("unable to allocate image for %s", filename);
+    }
+    *image = image_from_frame(pixels, sheet_background, abs_black_threshold);
+  } break;
 
   case AV_PIX_FMT_PAL8: {
     *image = create_image(size_of_rectangle(area), AV_PIX_FMT_RGB24, false,
@@ -122,7 +252,10 @@ void loadImage(const char *filename, Image *image, Pixel sheet_background,
     errOutput("unable to open file %s: unsupported pixel format", filename);
   }
 
-  avcodec_free_context(&avctx);
+  keep_codec_context(&avctx, false, codec->id,
+                     (RectangleSize){frame->width, frame->height},
+                     frame->format);
+  av_frame_free(&frame);
   avformat_close_input(&s);
 }
 
@@ -134,27 +267,17 @@ void loadImage(const char *filename, Image *image, Pixel sheet_background,
  * @param type filetype of the image to save
  * @return true on success, false on failure
  */
-void saveImage(char *filename, Image input, int outputPixFmt) {
+bool saveImage(const char *filename, Image input, int outputPixFmt) {
   enum AVCodecID output_codec = -1;
   const AVCodec *codec;
-  AVFormatContext *out_ctx;
-  AVCodecContext *codec_ctx;
-  AVStream *video_st;
+  AVCodecContext *codec_ctx = NULL;
   Image output = input;
   AVPacket *pkt = NULL;
+  FILE *file = NULL;
+  bool saved = false;
   int ret;
   char errbuff[1024];
 
-  if (avformat_alloc_output_context2(&out_ctx, NULL, "image2", filename) < 0 ||
-      out_ctx == NULL) {
-    errOutput("unable to allocate output context.");
-  }
-
-  if ((ret = av_opt_set(out_ctx->priv_data, "update", "true", 0)) < 0) {
-    av_strerror(ret, errbuff, sizeof(errbuff));
-    errOutput("unable to configure update option: %s", errbuff);
-  }
-
   switch (outputPixFmt) {
   case AV_PIX_FMT_RGB24:
     output_codec = AV_CODEC_ID_PPM;
@@ -182,75 +305,84 @@ void saveImage(char *filename, Image input, int outputPixFmt) {
 
   codec = avcodec_find_encoder(output_codec);
   if (!codec) {
-    errOutput("output codec not found");
-  }
-
-  video_st = avformat_new_stream(out_ctx, codec);
-  if (!video_st) {
-    errOutput("could not alloc output stream");
+    errReport("output codec not found");
+    goto cleanup;
   }
 
-  codec_ctx = avcodec_alloc_context3(codec);
+  codec_ctx = take_codec_context(true, codec, size_of_image(output),
+                                 output.frame->format);
   if (!codec_ctx) {
-    errOutput("could not alloc codec context");
-  }
-
-  codec_ctx->width = output.frame->width;
-  codec_ctx->height = output.frame->height;
-  codec_ctx->pix_fmt = output.frame->format;
-  video_st->codecpar->width = output.frame->width;
-  video_st->codecpar->height = output.frame->height;
-  video_st->codecpar->format = output.frame->format;
-  video_st->time_base.den = codec_ctx->time_base.den = 1;
-  video_st->time_base.num = codec_ctx->time_base.num = 1;
-
-  ret = avcodec_open2(codec_ctx, codec, NULL);
-
-  if (ret < 0) {
-    av_strerror(ret, errbuff, sizeof(errbuff));
-    errOutput("unable to open codec: %s", errbuff);
-  }
-
-  if (verbose >= VERBOSE_MORE)
-    av_dump_format(out_ctx, 0, filename, 1);
-
-  if ((ret = avio_open(&out_ctx->pb, filename, AVIO_FLAG_WRITE)) < 0) {
-    av_strerror(ret, errbuff, sizeof(errbuff));
-    errOutput("cannot alloc I/O context for %s: %s", filename, errbuff);
+    goto cleanup;
   }
 
-  if ((ret = avformat_write_header(out_ctx, NULL)) < 0) {
-    av_strerror(ret, errbuff, sizeof(errbuff));
-    errOutput("error writing header to '%s': %s", filename, errbuff);
+  if (!avcodec_is_open(codec_ctx)) {
+    codec_ctx->width = output.frame->width;
+    codec_ctx->height = output.frame->height;
+    codec_ctx->pix_fmt = output.frame->format;
+    codec_ctx->time_base.den = 1;
+    codec_ctx->time_base.num = 1;
+
+    ret = avcodec_open2(codec_ctx, codec, NULL);
+    if (ret < 0) {
+      av_strerror(ret, errbuff, sizeof(errbuff));
+      errReport("unable to open codec: %s", errbuff);
+      goto cleanup;
+    }
   }
 
   pkt = av_packet_alloc();
   if (!pkt) {
-    errOutput("unable to allocate output packet");
+    errReport("unable to allocate output packet");
+    goto cleanup;
   }
 
   ret = avcodec_send_frame(codec_ctx, output.frame);
   if (ret < 0) {
     av_strerror(ret, errbuff, sizeof(errbuff));
-    errOutput("unable to send frame to encoder: %s", errbuff);
+    errReport("unable to send frame to encoder: %s", errbuff);
+    goto cleanup;
   }
 
   ret = avcodec_receive_packet(codec_ctx, pkt);
   if (ret < 0) {
     av_strerror(ret, errbuff, sizeof(errbuff));
-    errOutput("unable to receive packet from encoder: %s", errbuff);
+    errReport("unable to receive packet from encoder: %s", errbuff);
+    goto cleanup;
   }
 
-  av_write_frame(out_ctx, pkt);
+  // The packet of an image codec is the whole file, which is all the image2
+  // muxer would write out.
+  file = fopen(filename, "wb");
+  if (file == NULL) {
+    errReport("cannot open '%s' for writing: %s", filename, strerror(errno));
+    goto cleanup;
+  }
+
+  if (fwrite(pkt->data, 1, pkt->size, file) != (size_t)pkt->size) {
+    errReport("error writing to '%s': %s", filename, strerror(errno));
+    fclose(file);
+    goto cleanup;
+  }
+
+  if (fclose(file) != 0) {
+    errReport("error writing to '%s': %s", filename, strerror(errno));
+    goto cleanup;
+  }
 
-  av_write_trailer(out_ctx);
+  saved = true;
 
+cleanup:
   av_packet_free(&pkt);
+  if (saved) {
+    keep_codec_context(&codec_ctx, true, output_codec, size_of_image(output),
+                       output.frame->format);
+  }
   avcodec_free_context(&codec_ctx);
-  avformat_free_context(out_ctx);
 
   if (output.frame != input.frame)
-    av_frame_free(&output.frame);
+    free_image(&output);
+
+  return saved;
 }
 
 /**
@@ -260,6 +392,8 @@ void saveDebug(char *filenameTemplate, int index, Image image) {
   if (verbose >= VERBOSE_DEBUG_SAVE) {
     char debugFilename[100];
     sprintf(debugFilename, filenameTemplate, index);
-    saveImage(debugFilename, image, image.frame->format);
+    if (!saveImage(debugFilename, image, image.frame->format)) {
+      errOutput("unable to save debug file %s.", debugFilename);
+    }
   }
 }
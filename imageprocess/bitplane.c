@@ -0,0 +1,234 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <libavutil/pixfmt.h>
+
+#include "imageprocess/bitplane.h"
+#include "lib/math_util.h"
+
+bool is_bitplane_format(int pixel_format) {
+  return pixel_format == AV_PIX_FMT_MONOWHITE ||
+         pixel_format == AV_PIX_FMT_MONOBLACK;
+}
+
+// Mask selecting count bits of a byte, starting offset bits from the most
+// significant one.
+static inline uint8_t span_mask(int32_t offset, int32_t count) {
+  return (uint8_t)(0xFF >> offset) & (uint8_t)(0xFF << (8 - offset - count));
+}
+
+static inline void store_masked(uint8_t *byte, uint8_t mask, uint8_t bits) {
+  *byte = (*byte & ~mask) | (bits & mask);
+}
+
+// Returns count (up to 8) bits starting offset bits into p, aligned to the most
+// significant bit. The following byte is only read if the bits straddle it.
+static inline uint8_t load_bits(const uint8_t *p, int32_t offset,
+                                int32_t count) {
+  uint8_t bits = p[0] << offset;
+  if (offset + count > 8) {
+    bits |= p[1] >> (8 - offset);
+  }
+  return bits;
+}
+
+static inline uint64_t load_word(const uint8_t *p) {
+  uint64_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+static inline void store_word(uint8_t *p, uint64_t word) {
+  memcpy(p, &word, sizeof(word));
+}
+
+// Big-endian loads and stores keep pixel 0 in the most significant bit of the
+// word, so that the word can be shifted across byte boundaries.
+static inline uint64_t load_be_word(const uint8_t *p) {
+  uint64_t word = load_word(p);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  word = __builtin_bswap64(word);
+#endif
+  return word;
+}
+
+static inline void store_be_word(uint8_t *p, uint64_t word) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  word = __builtin_bswap64(word);
+#endif
+  store_word(p, word);
+}
+
+uint64_t bitplane_count(const uint8_t *row, int32_t x, int32_t count) {
+  uint64_t result = 0;
+
+  if (count <= 0) {
+    return 0;
+  }
+
+  row += x / 8;
+  const int32_t offset = x % 8;
+  if (offset != 0) {
+    const int32_t head = min(count, 8 - offset);
+    result += __builtin_popcount(*row & span_mask(offset, head));
+    row++;
+    count -= head;
+  }
+
+  for (; count >= 64; count -= 64, row += 8) {
+    result += __builtin_popcountll(load_word(row));
+  }
+  for (; count >= 8; count -= 8, row++) {
+    result += __builtin_popcount(*row);
+  }
+  if (count > 0) {
+    result += __builtin_popcount(*row & span_mask(0, count));
+  }
+
+  return result;
+}
+
+void bitplane_fill(uint8_t *row, int32_t x, int32_t count, bool value) {
+  const uint8_t bits = value ? 0xFF : 0x00;
+
+  if (count <= 0) {
+    return;
+  }
+
+  row += x / 8;
+  const int32_t offset = x % 8;
+  if (offset != 0) {
+    const int32_t head = min(count, 8 - offset);
+    store_masked(row, span_mask(offset, head), bits);
+    row++;
+    count -= head;
+  }
+
+  memset(row, bits, count / 8);
+  row += count / 8;
+  count %= 8;
+
+  if (count > 0) {
+    store_masked(row, span_mask(0, count), bits);
+  }
+}
+
+void bitplane_copy(uint8_t *target, int32_t target_x, const uint8_t *source,
+                   int32_t source_x, int32_t count, bool invert) {
+  const uint8_t flip = invert ? 0xFF : 0x00;
+  const uint64_t flip_word = invert ? UINT64_MAX : 0;
+
+  if (count <= 0) {
+    return;
+  }
+
+  target += target_x / 8;
+  target_x %= 8;
+  source += source_x / 8;
+  source_x %= 8;
+
+  // Bring the target to a byte boundary, so that the rest of the span can be
+  // written in whole bytes.
+  if (target_x != 0) {
+    const int32_t head = min(count, 8 - target_x);
+    const uint8_t bits = load_bits(source, source_x, head) >> target_x;
+    store_masked(target, span_mask(target_x, head), bits ^ flip);
+    target++;
+    count -= head;
+    source_x += head;
+    source += source_x / 8;
+    source_x %= 8;
+  }
+
+  for (; count >= 64; count -= 64, source += 8, target += 8) {
+    uint64_t word = load_be_word(source);
+    if (source_x != 0) {
+      word = (word << source_x) | (source[8] >> (8 - source_x));
+    }
+    store_be_word(target, word ^ flip_word);
+  }
+  for (; count >= 8; count -= 8, source++, target++) {
+    *target = load_bits(source, source_x, 8) ^ flip;
+  }
+  if (count > 0) {
+    store_masked(target, span_mask(0, count),
+                 load_bits(source, source_x, count) ^ flip);
+  }
+}
+
+static inline uint8_t reverse_byte(uint8_t byte) {
+  byte = (byte & 0xF0) >> 4 | (byte & 0x0F) << 4;
+  byte = (byte & 0xCC) >> 2 | (byte & 0x33) << 2;
+  byte = (byte & 0xAA) >> 1 | (byte & 0x55) << 1;
+  return byte;
+}
+
+void bitplane_reverse(uint8_t *target, const uint8_t *source, int32_t count) {
+  if (count <= 0) {
+    return;
+  }
+
+  // Reversing the whole bytes moves the padding of the last byte to the
+  // front, so each target byte is put together from two reversed source bytes
+  // shifted back into place.
+  const int32_t bytes = (count + 7) / 8;
+  const int32_t padding = bytes * 8 - count;
+  for (int32_t i = 0; i < bytes - 1; i++) {
+    uint8_t byte = reverse_byte(source[bytes - 1 - i]) << padding;
+    if (padding != 0) {
+      byte |= reverse_byte(source[bytes - 2 - i]) >> (8 - padding);
+    }
+    target[i] = byte;
+  }
+
+  store_masked(&target[bytes - 1], span_mask(0, 8 - padding),
+               reverse_byte(source[0]) << padding);
+}
+
+// Transposes an 8x8 bit matrix held one row per byte, first row in the most
+// significant byte (Hacker's Delight, 7-3).
+static inline uint64_t transpose_block(uint64_t block) {
+  uint64_t t;
+
+  t = (block ^ (block >> 7)) & 0x00AA00AA00AA00AAULL;
+  block ^= t ^ (t << 7);
+  t = (block ^ (block >> 14)) & 0x0000CCCC0000CCCCULL;
+  block ^= t ^ (t << 14);
+  t = (block ^ (block >> 28)) & 0x00000000F0F0F0F0ULL;
+  block ^= t ^ (t << 28);
+
+  return block;
+}
+
+void bitplane_transpose(uint8_t *target, ptrdiff_t target_linesize,
+                        const uint8_t *source, ptrdiff_t source_linesize,
+                        RectangleSize source_size) {
+  const int32_t columns = (source_size.width + 7) / 8;
+
+  for (int32_t y = 0; y < source_size.height; y += 8) {
+    const int32_t rows = min(8, source_size.height - y);
+
+    for (int32_t column = 0; column < columns; column++) {
+      uint64_t block = 0;
+      for (int32_t i = 0; i < 8; i++) {
+        block <<= 8;
+        if (i < rows) {
+          block |= source[(y + i) * source_linesize + column];
+        }
+      }
+
+      block = transpose_block(block);
+
+      const int32_t target_rows = min(8, source_size.width - column * 8);
+      for (int32_t i = 0; i < target_rows; i++) {
+        target[(column * 8 + i) * target_linesize + y / 8] =
+            block >> (56 - 8 * i);
+      }
+    }
+  }
+}
@@ -0,0 +1,42 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "imageprocess/primitives.h"
+
+// Word-level operations on packed 1-bit rows, as used by the MONOWHITE and
+// MONOBLACK pixel formats. Pixel 0 of a row is the most significant bit of its
+// first byte; the bits are processed 64 at a time wherever the span allows.
+//
+// These functions only deal with bits: whether a set bit is black or white
+// depends on the pixel format and is up to the caller.
+
+bool is_bitplane_format(int pixel_format);
+
+// Returns the number of set bits in the span.
+uint64_t bitplane_count(const uint8_t *row, int32_t x, int32_t count);
+
+// Sets all the bits in the span to the given value.
+void bitplane_fill(uint8_t *row, int32_t x, int32_t count, bool value);
+
+// Copies a span of bits, optionally inverting them. Source and target must not
+// overlap.
+void bitplane_copy(uint8_t *target, int32_t target_x, const uint8_t *source,
+                   int32_t source_x, int32_t count, bool invert);
+
+// Writes the first count bits of source into target in reverse order. Source
+// and target must not overlap.
+void bitplane_reverse(uint8_t *target, const uint8_t *source, int32_t count);
+
+// Transposes a whole bitplane, so that row y of target holds column y of
+// source. The target must be at least source_size.height bits wide and
+// source_size.width rows high.
+void bitplane_transpose(uint8_t *target, ptrdiff_t target_linesize,
+                        const uint8_t *source, ptrdiff_t source_linesize,
+                        RectangleSize source_size);
@@ -2,11 +2,22 @@
 //
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/frame.h>
+
+#include "imageprocess/bitplane.h"
 #include "imageprocess/blit.h"
+#include "imageprocess/integral.h"
 #include "imageprocess/interpolate.h"
 #include "imageprocess/pixel.h"
 #include "lib/logging.h"
 #include "lib/math_util.h"
+#include "lib/tiles.h"
+
+// Number of pixels copy_rectangle() converts between formats at a time.
+#define COPY_CHUNK_PIXELS 1024
 
 /**
  * Wipe a rectangular area of pixels with the defined color.
@@ -14,30 +25,136 @@
  */
 void wipe_rectangle(Image image, Rectangle input_area, Pixel color) {
   Rectangle area = clip_rectangle(image, input_area);
+  const int32_t width = area.vertex[1].x - area.vertex[0].x + 1;
+
+  if (width <= 0) {
+    return;
+  }
 
-  scan_rectangle(area) { set_pixel(image, (Point){x, y}, color); }
+  ImageRows rows = image_rows(image);
+  for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y; y++) {
+    rows.kernels->fill(image_row(rows, y), area.vertex[0].x, width, color,
+                       rows.abs_black_threshold);
+  }
+  mark_image_changed(image, area);
 }
 
 void copy_rectangle(Image source, Image target, Rectangle source_area,
                     Point target_coords) {
   Rectangle area = clip_rectangle(source, source_area);
+  RectangleSize target_size = size_of_image(target);
+
+  // Restrict the columns to those that land within the target image; the
+  // first source column maps to target_coords.x.
+  const int32_t skip = max(0, -target_coords.x);
+  const int32_t width =
+      min(area.vertex[1].x - area.vertex[0].x + 1,
+          target_size.width - target_coords.x) -
+      skip;
+
+  if (width <= 0) {
+    return;
+  }
+
+  ImageRows source_rows = image_rows(source);
+  ImageRows target_rows = image_rows(target);
+  const int source_format = source.frame->format;
+  const int target_format = target.frame->format;
+  // Rows converted between formats go through a buffer of fixed size, as
+  // images can be too wide for a whole row of pixels to fit the stack of the
+  // tile threads.
+  Pixel pixels[COPY_CHUNK_PIXELS];
 
-  // naive but generic implementation
   for (int32_t sY = area.vertex[0].y, tY = target_coords.y;
        sY <= area.vertex[1].y; sY++, tY++) {
-    for (int32_t sX = area.vertex[0].x, tX = target_coords.x;
-         sX <= area.vertex[1].x; sX++, tX++) {
-      set_pixel(target, (Point){tX, tY}, get_pixel(source, (Point){sX, sY}));
+    if (tY < 0 || tY >= target_size.height) {
+      continue;
+    }
+
+    const uint8_t *source_row = image_row(source_rows, sY);
+    uint8_t *target_row = image_row(target_rows, tY);
+    const int32_t source_x = area.vertex[0].x + skip;
+    const int32_t target_x = target_coords.x + skip;
+
+    if (source_format == target_format) {
+      target_rows.kernels->copy(target_row, target_x, source_row, source_x,
+                                width);
+    } else if (is_bitplane_format(source_format) &&
+               is_bitplane_format(target_format)) {
+      // MONOWHITE and MONOBLACK only differ in the meaning of the bits.
+      bitplane_copy(target_row, target_x, source_row, source_x, width, true);
+    } else {
+      for (int32_t done = 0; done < width; done += COPY_CHUNK_PIXELS) {
+        const int32_t count = min(width - done, COPY_CHUNK_PIXELS);
+        source_rows.kernels->read_pixels(source_row, source_x + done, count,
+                                         pixels);
+        target_rows.kernels->write_pixels(target_row, target_x + done, count,
+                                          pixels,
+                                          target_rows.abs_black_threshold);
+      }
+    }
+  }
+  mark_image_changed(
+      target,
+      rectangle_from_size(
+          (Point){target_coords.x + skip, target_coords.y},
+          (RectangleSize){width, area.vertex[1].y - area.vertex[0].y + 1}));
+}
+
+void move_rectangle(Image image, Rectangle source_area, Point target_coords) {
+  Rectangle area = clip_rectangle(image, source_area);
+  const RectangleSize size = size_of_rectangle(area);
+  const RectangleSize image_size = size_of_image(image);
+
+  if (size.width <= 0 || size.height <= 0) {
+    return;
+  }
+
+  // As with copy_rectangle(), only the columns landing within the image are
+  // written.
+  const int32_t skip = max(0, -target_coords.x);
+  const int32_t width =
+      min(size.width, image_size.width - target_coords.x) - skip;
+  const int32_t source_x = area.vertex[0].x + skip;
+  const int32_t target_x = target_coords.x + skip;
+
+  ImageRows rows = image_rows(image);
+  uint8_t *staging = malloc(rows.linesize);
+  if (staging == NULL) {
+    errOutput("unable to allocate rectangle row.");
+  }
+
+  // Each row is staged before being wiped, so that it can land on itself;
+  // going against the direction of the move, rows only land on rows already
+  // moved out.
+  const bool bottom_up = target_coords.y > area.vertex[0].y;
+  for (int32_t i = 0; i < size.height; i++) {
+    const int32_t offset = bottom_up ? size.height - 1 - i : i;
+    const int32_t sY = area.vertex[0].y + offset;
+    const int32_t tY = target_coords.y + offset;
+    uint8_t *source_row = image_row(rows, sY);
+
+    const bool lands = width > 0 && tY >= 0 && tY < image_size.height;
+    if (lands) {
+      rows.kernels->copy(staging, source_x, source_row, source_x, width);
+    }
+    rows.kernels->fill(source_row, area.vertex[0].x, size.width,
+                       image.background, rows.abs_black_threshold);
+    if (lands) {
+      rows.kernels->copy(image_row(rows, tY), target_x, staging, source_x,
+                         width);
     }
   }
+  free(staging);
+
+  mark_image_changed(image, area);
+  mark_image_changed(image, rectangle_from_size(target_coords, size));
 }
 
 /**
  * Returns the average brightness of a rectangular area.
  */
 uint8_t inverse_brightness_rect(Image image, Rectangle input_area) {
-  uint64_t grayscale = 0;
-
   Rectangle area = clip_rectangle(image, input_area);
   uint64_t count = count_pixels(area);
 
@@ -45,9 +162,7 @@ uint8_t inverse_brightness_rect(Image image, Rectangle input_area) {
     return 0;
   }
 
-  scan_rectangle(area) {
-    grayscale += get_pixel_grayscale(image, (Point){x, y});
-  }
+  uint64_t grayscale = integral_sum(image, area, INTEGRAL_GRAYSCALE, 0, 0);
 
   return 0xFF - (grayscale / count);
 }
@@ -56,8 +171,6 @@ uint8_t inverse_brightness_rect(Image image, Rectangle input_area) {
  * Returns the inverse average lightness of a rectangular area.
  */
 uint8_t inverse_lightness_rect(Image image, Rectangle input_area) {
-  uint64_t lightness = 0;
-
   Rectangle area = clip_rectangle(image, input_area);
   uint64_t count = count_pixels(area);
 
@@ -65,9 +178,7 @@ uint8_t inverse_lightness_rect(Image image, Rectangle input_area) {
     return 0;
   }
 
-  scan_rectangle(area) {
-    lightness += get_pixel_lightness(image, (Point){x, y});
-  }
+  uint64_t lightness = integral_sum(image, area, INTEGRAL_LIGHTNESS, 0, 0);
 
   return 0xFF - (lightness / count);
 }
@@ -76,8 +187,6 @@ uint8_t inverse_lightness_rect(Image image, Rectangle input_area) {
  * Returns the average darkness of a rectangular area.
  */
 uint8_t darkness_rect(Image image, Rectangle input_area) {
-  uint64_t darkness = 0;
-
   Rectangle area = clip_rectangle(image, input_area);
   uint64_t count = count_pixels(area);
 
@@ -85,30 +194,54 @@ uint8_t darkness_rect(Image image, Rectangle input_area) {
     return 0;
   }
 
-  scan_rectangle(area) {
-    darkness += get_pixel_darkness_inverse(image, (Point){x, y});
-  }
+  uint64_t darkness =
+      integral_sum(image, area, INTEGRAL_DARKNESS_INVERSE, 0, 0);
 
   return 0xFF - (darkness / count);
 }
 
+/**
+ * Counts the pixels in the area whose brightness is within the provided
+ * range, optionally clearing them to white. Pixels outside of the image are
+ * considered white.
+ */
 uint64_t count_pixels_within_brightness(Image image, Rectangle area,
                                         uint8_t min_brightness,
                                         uint8_t max_brightness, bool clear) {
+  if (area.vertex[0].x > area.vertex[1].x ||
+      area.vertex[0].y > area.vertex[1].y) {
+    return 0;
+  }
+
   uint64_t count = 0;
+  Rectangle inside = clip_rectangle(image, area);
+  const int32_t width = inside.vertex[1].x - inside.vertex[0].x + 1;
+  const int32_t height = inside.vertex[1].y - inside.vertex[0].y + 1;
+  const uint64_t inside_count =
+      (width > 0 && height > 0) ? (uint64_t)width * height : 0;
+
+  // Pixels outside of the image read as white.
+  if (max_brightness == UINT8_MAX) {
+    count += count_pixels(area) - inside_count;
+  }
 
-  scan_rectangle(area) {
-    Point p = {x, y};
-    uint8_t brightness = get_pixel_grayscale(image, p);
-    if (brightness < min_brightness || brightness > max_brightness) {
-      continue;
-    }
+  if (inside_count == 0) {
+    return count;
+  }
 
-    if (clear) {
-      set_pixel(image, p, PIXEL_WHITE);
-    }
-    count++;
+  if (!clear) {
+    return count + integral_sum(image, inside, INTEGRAL_GRAYSCALE_WITHIN,
+                                min_brightness, max_brightness);
+  }
+
+  ImageRows rows = image_rows(image);
+
+  for (int32_t y = inside.vertex[0].y; y <= inside.vertex[1].y; y++) {
+    count += rows.kernels->count_grayscale_within(
+        image_row(rows, y), inside.vertex[0].x, width, min_brightness,
+        max_brightness, true);
   }
+  mark_image_changed(image, inside);
 
   return count;
 }
@@ -148,25 +281,120 @@ void center_image(Image source, Image target, Point target_origin,
                  target_origin);
 }
 
+// How far the interpolation kernels reach beyond the source pixel a stretched
+// pixel is at.
+#define STRETCH_REACH 2
+
+typedef struct {
+  Image source;
+  Image target;
+  float vertical_ratio;
+  Interpolation interpolate_type;
+  // The taps of each target column, the same for all rows.
+  InterpolationTaps *column_taps;
+} StretchPass;
+
+// The taps of the pixel at position along a line of length source pixels.
+static InterpolationTaps stretch_taps(float position, int32_t length,
+                                      Interpolation interpolate_type) {
+  InterpolationTaps taps = interpolation_taps(position, interpolate_type);
+
+  // Linear interpolation does not blend the last pixel with what is beyond.
+  if (interpolate_type == INTERP_LINEAR && taps.first + 1 >= length) {
+    taps.count = 1;
+  }
+  return taps;
+}
+
+static void stretch_band(void *arg, Tile tile) {
+  const StretchPass *pass = arg;
+  ImageRows source_rows = image_rows(pass->source);
+  ImageRows rows = image_rows(pass->target);
+  const RectangleSize source_size = size_of_image(pass->source);
+  const int32_t width = size_of_rectangle(tile.area).width;
+
+  // The source rows are read into lines padded with the white that
+  // get_pixel() returns beyond the edges, so the kernels can be applied
+  // without any bounds checks.
+  const int32_t stride = source_size.width + 2 * STRETCH_REACH;
+  Pixel *lines = malloc(((size_t)stride * 5 + width) * sizeof(Pixel));
+  if (lines == NULL) {
+    errOutput("unable to allocate stretch buffer.");
+  }
+  Pixel *blended = lines + 4 * stride;
+  Pixel *out = blended + stride;
+
+  for (int32_t i = 0; i < stride; i++) {
+    blended[i] = PIXEL_WHITE;
+  }
+
+  for (int32_t y = tile.area.vertex[0].y; y <= tile.area.vertex[1].y; y++) {
+    const InterpolationTaps taps = stretch_taps(
+        y * pass->vertical_ratio, source_size.height, pass->interpolate_type);
+
+    for (int32_t i = 0; i < taps.count; i++) {
+      Pixel *line = lines + i * stride;
+      const int32_t source_y = taps.first + i;
+
+      if (source_y < 0 || source_y >= source_size.height) {
+        for (int32_t j = 0; j < stride; j++) {
+          line[j] = PIXEL_WHITE;
+        }
+        continue;
+      }
+      for (int32_t j = 0; j < STRETCH_REACH; j++) {
+        line[j] = PIXEL_WHITE;
+        line[stride - 1 - j] = PIXEL_WHITE;
+      }
+      source_rows.kernels->read_pixels(image_row(source_rows, source_y), 0,
+                                       source_size.width,
+                                       line + STRETCH_REACH);
+    }
+
+    for (int32_t i = STRETCH_REACH; i < stride - STRETCH_REACH; i++) {
+      blended[i] = apply_taps(taps, lines + i, stride);
+    }
+    for (int32_t x = 0; x < width; x++) {
+      const InterpolationTaps column =
+          pass->column_taps[tile.area.vertex[0].x + x];
+      out[x] = apply_taps(column, blended + STRETCH_REACH + column.first, 1);
+    }
+    rows.kernels->write_pixels(image_row(rows, y), tile.area.vertex[0].x,
+                               width, out, rows.abs_black_threshold);
+  }
+
+  free(lines);
+}
+
 static void stretch_frame(Image source, Image target,
                           Interpolation interpolate_type) {
   RectangleSize source_size = size_of_image(source),
                 target_size = size_of_image(target);
   const float horizontal_ratio =
       (float)source_size.width / (float)target_size.width;
-  const float vertical_ratio =
-      (float)source_size.height / (float)target_size.height;
+  StretchPass pass = {
+      .source = uncached_image(source),
+      .target = uncached_image(target),
+      .vertical_ratio = (float)source_size.height / (float)target_size.height,
+      .interpolate_type = interpolate_type,
+      .column_taps = malloc(target_size.width * sizeof(InterpolationTaps)),
+  };
+  if (pass.column_taps == NULL) {
+    errOutput("unable to allocate stretch buffer.");
+  }
 
   verboseLog(VERBOSE_MORE, "stretching %dx%d -> %dx%d\n", source_size.width,
              source_size.height, target_size.width, target_size.height);
 
-  Rectangle target_area = full_image(target);
-  scan_rectangle(target_area) {
-    const Point target_coords = {x, y};
-    const FloatPoint source_coords = {x * horizontal_ratio, y * vertical_ratio};
-    set_pixel(target, target_coords,
-              interpolate(source, source_coords, interpolate_type));
+  for (int32_t x = 0; x < target_size.width; x++) {
+    pass.column_taps[x] =
+        stretch_taps(x * horizontal_ratio, source_size.width, interpolate_type);
   }
+
+  run_tiles(row_bands(full_image(target)), stretch_band, &pass);
+  mark_image_changed(target, full_image(target));
+
+  free(pass.column_taps);
 }
 
 void stretch_and_replace(Image *pImage, RectangleSize size,
@@ -229,23 +457,90 @@ void flip_rotate_90(Image *pImage, RotationDirection direction) {
       (RectangleSize){.width = image_size.height, .height = image_size.width},
       false);
 
+  ImageRows source_rows = image_rows(*pImage);
+  ImageRows target_rows = image_rows(newimage);
+
+  if (is_bitplane_format(pImage->frame->format)) {
+    // Transposing maps (x, y) to (y, x); mirroring the result completes the
+    // rotation in either direction.
+    bitplane_transpose(target_rows.data, target_rows.linesize,
+                       source_rows.data, source_rows.linesize, image_size);
+    mirror(newimage,
+           direction > 0 ? DIRECTION_HORIZONTAL : DIRECTION_VERTICAL);
+    replace_image(pImage, &newimage);
+    return;
+  }
+
+  Pixel *pixels = malloc(image_size.width * sizeof(Pixel));
+  if (pixels == NULL) {
+    errOutput("unable to allocate image row.");
+  }
+
   for (int y = 0; y < image_size.height; y++) {
     const int xx =
         ((direction > 0) ? image_size.height - 1 : 0) - y * direction;
+
+    source_rows.kernels->read_pixels(image_row(source_rows, y), 0,
+                                     image_size.width, pixels);
     for (int x = 0; x < image_size.width; x++) {
       const int yy =
           ((direction < 0) ? image_size.width - 1 : 0) + x * direction;
 
-      Point point1 = {x, y};
-      Point point2 = {xx, yy};
-
-      set_pixel(newimage, point2, get_pixel(*pImage, point1));
+      target_rows.kernels->set(image_row(target_rows, yy), xx, pixels[x],
+                               target_rows.abs_black_threshold);
     }
   }
+  free(pixels);
   replace_image(pImage, &newimage);
 }
 
+static void mirror_bitplane(Image image, Direction direction) {
+  RectangleSize image_size = size_of_image(image);
+  ImageRows rows = image_rows(image);
+  const size_t row_bytes = (image_size.width + 7) / 8;
+  const int32_t last_row = direction.vertical ? (image_size.height - 1) / 2
+                                              : image_size.height - 1;
+
+  // Keep the padding bits of the reversed rows deterministic.
+  uint8_t *row1_copy = calloc(2, row_bytes);
+  if (row1_copy == NULL) {
+    errOutput("unable to allocate image rows.");
+  }
+  uint8_t *row2_copy = row1_copy + row_bytes;
+
+  for (int32_t y = 0; y <= last_row; y++) {
+    int32_t yy = direction.vertical ? image_size.height - y - 1 : y;
+    uint8_t *row1 = image_row(rows, y);
+    uint8_t *row2 = image_row(rows, yy);
+
+    if (direction.horizontal) {
+      bitplane_reverse(row1_copy, row1, image_size.width);
+      bitplane_reverse(row2_copy, row2, image_size.width);
+    } else {
+      memcpy(row1_copy, row1, row_bytes);
+      memcpy(row2_copy, row2, row_bytes);
+    }
+
+    // When y == yy, the second copy is the one that sticks.
+    memcpy(row2, row1_copy, row_bytes);
+    memcpy(row1, row2_copy, row_bytes);
+  }
+
+  free(row1_copy);
+}
+
 void mirror(Image image, Direction direction) {
+  if (!direction.horizontal && !direction.vertical) {
+    return;
+  }
+
+  mark_image_changed(image, full_image(image));
+
+  if (is_bitplane_format(image.frame->format)) {
+    mirror_bitplane(image, direction);
+    return;
+  }
+
   Rectangle source = {{POINT_ORIGIN, POINT_INFINITY}};
   RectangleSize image_size = size_of_image(image);
 
@@ -259,6 +554,9 @@ void mirror(Image image, Direction direction) {
 
   source = clip_rectangle(image, source);
 
+  ImageRows rows = image_rows(image);
+  const PixelRowKernels *kernels = rows.kernels;
+
   // Cannot use scan_rectangle() because of the midpoint turn.
   for (int32_t y = source.vertex[0].y; y <= source.vertex[1].y; y++) {
     int32_t yy = direction.vertical ? image_size.height - y - 1 : y;
@@ -268,25 +566,20 @@ void mirror(Image image, Direction direction) {
       source.vertex[1].x = (image_size.width - 1) / 2;
     }
 
+    uint8_t *row1 = image_row(rows, y);
+    uint8_t *row2 = image_row(rows, yy);
+
     for (int32_t x = 0; x <= source.vertex[1].x; x++) {
       int32_t xx = direction.horizontal ? image_size.width - x - 1 : x;
 
-      Point point1 = {x, y};
-      Point point2 = {xx, yy};
-      Pixel pixel1 = get_pixel(image, point1);
-      Pixel pixel2 = get_pixel(image, point2);
-      set_pixel(image, point1, pixel2);
-      set_pixel(image, point2, pixel1);
+      Pixel pixel1 = kernels->get(row1, x);
+      Pixel pixel2 = kernels->get(row2, xx);
+      kernels->set(row1, x, pixel2, rows.abs_black_threshold);
+      kernels->set(row2, xx, pixel1, rows.abs_black_threshold);
     }
   }
 }
 
 void shift_image(Image *pImage, Delta d) {
-  // allocate new buffer's memory
-  Image newimage =
-      create_compatible_image(*pImage, size_of_image(*pImage), true);
-
-  copy_rectangle(*pImage, newimage, full_image(*pImage),
-                 shift_point(POINT_ORIGIN, d));
-  replace_image(pImage, &newimage);
+  move_rectangle(*pImage, full_image(*pImage), shift_point(POINT_ORIGIN, d));
 }
@@ -13,6 +13,10 @@
 void wipe_rectangle(Image image, Rectangle input_area, Pixel color);
 void copy_rectangle(Image source, Image target, Rectangle source_area,
                     Point target_coords);
+// Moves the pixels of the area within the image so that its first pixel ends
+// up at the target coordinates, wiping what it leaves with the background.
+// The area and its target may overlap.
+void move_rectangle(Image image, Rectangle source_area, Point target_coords);
 uint8_t inverse_brightness_rect(Image image, Rectangle input_area);
 uint8_t inverse_lightness_rect(Image image, Rectangle input_area);
 uint8_t darkness_rect(Image image, Rectangle input_area);
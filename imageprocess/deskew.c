@@ -3,8 +3,10 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
 #include <math.h>
+#include <stdlib.h>
 
 #include <libavutil/mathematics.h> // for M_PI
+#include <libavutil/pixfmt.h>
 
 #include "constants.h"
 #include "imageprocess/blit.h"
@@ -13,17 +15,19 @@
 #include "imageprocess/pixel.h"
 #include "lib/logging.h"
 #include "lib/math_util.h"
+#include "lib/tiles.h"
 
 // maximum pixel count of virtual line to detect rotation with
 #define MAX_ROTATION_SCAN_SIZE 10000
 
 static inline float degreesToRadians(float d) { return d * M_PI / 180.0; }
 
-bool validate_deskew_parameters(DeskewParameters *params, float deskewScanRange,
-                                float deskewScanStep, float deskewScanDeviation,
-                                int deskewScanSize, float deskewScanDepth,
-                                Edges deskewScanEdges) {
+bool validate_deskew_parameters(DeskewParameters *params, DeskewMethod method,
+                                float deskewScanRange, float deskewScanStep,
+                                float deskewScanDeviation, int deskewScanSize,
+                                float deskewScanDepth, Edges deskewScanEdges) {
   *params = (DeskewParameters){
+      .method = method,
       .deskewScanRangeRad = degreesToRadians(deskewScanRange),
       .deskewScanStepRad = degreesToRadians(deskewScanStep),
       .deskewScanDeviationRad = degreesToRadians(deskewScanDeviation),
@@ -100,7 +104,12 @@ static int detect_edge_rotation_peak(Image image, const Rectangle mask,
     stepY = -m; // (line goes upwards for negative degrees)
   }
 
-  Point p[deskewScanSize];
+  // Up to MAX_ROTATION_SCAN_SIZE points, too many for the stack of the tile
+  // threads this runs on.
+  Point *p = malloc(deskewScanSize * sizeof(Point));
+  if (p == NULL) {
+    errOutput("unable to allocate rotation scan line.");
+  }
 
   // fill buffer with coordinates for rotated line in first unshifted position
   for (int lineStep = 0; lineStep < deskewScanSize; lineStep++) {
@@ -133,6 +142,7 @@ static int detect_edge_rotation_peak(Image image, const Rectangle mask,
     }
     accumulatedBlackness += blackness;
   }
+  free(p);
   if (dep < maxDepth) { // has not terminated only because middle was reached
     return maxDiff;
   } else {
@@ -140,79 +150,546 @@ static int detect_edge_rotation_peak(Image image, const Rectangle mask,
   }
 }
 
+// Largest stride, in scan steps, between the angles of the first coarse pass
+// of the search, and how many of the best angles found so far are refined
+// around on each of the following passes.
+#define DESKEW_COARSE_STRIDE 8
+#define DESKEW_REFINE_CANDIDATES 3
+
+typedef struct {
+  // Read from several threads at once, so without its derived data.
+  Image image;
+  Rectangle mask;
+  DeskewParameters params;
+  Delta shift;
+
+  // Number of scan steps of the magnitude of the angles at either side; the
+  // negative side reaches one step further, as the original exhaustive scan
+  // did.
+  int steps;
+  // Magnitudes of the angles, accumulated step by step as that scan did.
+  float *magnitudes;
+  // Peak of each angle evaluated so far, ANGLE_QUEUED for those about to be,
+  // ANGLE_UNKNOWN otherwise, indexed by the angle's step plus steps + 1.
+  int *peaks;
+  int evaluated;
+
+  // Angles to evaluate together in the next batch.
+  int *queue;
+  int queued;
+} AngleSearch;
+
+#define ANGLE_UNKNOWN -1
+#define ANGLE_QUEUED -2
+
+static inline float search_angle(const AngleSearch *search, int k) {
+  return k < 0 ? -search->magnitudes[-k] : search->magnitudes[k];
+}
+
+static inline int *search_peak(AngleSearch *search, int k) {
+  return &search->peaks[k + search->steps + 1];
+}
+
+// Position of the angle in the order the exhaustive scan visited them in:
+// 0, -1, +1, -2, +2, ...
+static inline int search_rank(int k) {
+  return k <= 0 ? -2 * k - (k < 0) : 2 * k;
+}
+
+// Whether the first angle beats the second: a higher peak, or the same peak
+// found earlier by the exhaustive scan.
+static inline bool better_angle(int peak, int k, int other_peak, int other_k) {
+  return peak > other_peak ||
+         (peak == other_peak && search_rank(k) < search_rank(other_k));
+}
+
+static void queue_angle(AngleSearch *search, int k) {
+  if (k < -search->steps - 1 || k > search->steps ||
+      *search_peak(search, k) != ANGLE_UNKNOWN) {
+    return;
+  }
+
+  *search_peak(search, k) = ANGLE_QUEUED;
+  search->queue[search->queued++] = k;
+}
+
+static void evaluate_angles_tile(void *arg, Tile tile) {
+  AngleSearch *search = arg;
+
+  for (int32_t i = tile.area.vertex[0].x; i <= tile.area.vertex[1].x; i++) {
+    const int k = search->queue[i];
+    const float m = tanf(search_angle(search, k));
+    *search_peak(search, k) = detect_edge_rotation_peak(
+        search->image, search->mask, search->params, search->shift, m);
+  }
+}
+
+/**
+ * Evaluates the queued angles, spread across the tile threads. Each angle only
+ * writes its own peak, so the result does not depend on the order they are
+ * evaluated in.
+ */
+static void evaluate_queued_angles(AngleSearch *search) {
+  run_tiles(
+      (TileGrid){
+          .area = {{POINT_ORIGIN, {search->queued - 1, 0}}},
+          .tile_size = {1, 1},
+      },
+      evaluate_angles_tile, search);
+
+  search->evaluated += search->queued;
+  search->queued = 0;
+}
+
 /**
  * Detects rotation at one edge of the area specified by left, top, right,
  * bottom. Which of the four edges to take depends on whether shiftX or shiftY
  * is non-zero, and what sign this shifting value has.
+ *
+ * Rather than evaluating every angle, the range is first scanned at a coarse
+ * stride, which is then halved around the best angles found until it reaches
+ * the scan step.
  */
 static float detect_edge_rotation(Image image, const Rectangle mask,
                                   const DeskewParameters params, Delta shift) {
   // either shiftX or shiftY is 0, the other value is -i|+i
   // depending on shiftX/shiftY the start edge for shifting is determined
+  int steps = 0;
+  if (params.deskewScanStepRad > 0.0) {
+    for (float rotation = params.deskewScanStepRad;
+         rotation <= params.deskewScanRangeRad;
+         rotation += params.deskewScanStepRad) {
+      steps++;
+    }
+  }
+
+  float magnitudes[steps + 2];
+  int peaks[2 * steps + 2];
+  int queue[2 * steps + 2];
+  AngleSearch search = {
+      .image = uncached_image(image),
+      .mask = mask,
+      .params = params,
+      .shift = shift,
+      .steps = steps,
+      .magnitudes = magnitudes,
+      .peaks = peaks,
+      .queue = queue,
+  };
+
+  magnitudes[0] = 0.0;
+  for (int i = 1; i <= steps + 1; i++) {
+    magnitudes[i] = magnitudes[i - 1] + params.deskewScanStepRad;
+  }
+  for (int i = 0; i < 2 * steps + 2; i++) {
+    peaks[i] = ANGLE_UNKNOWN;
+  }
+
+  int stride = 1;
+  while (stride < DESKEW_COARSE_STRIDE && stride * 8 <= steps) {
+    stride *= 2;
+  }
+
+  for (int k = -(steps + 1) / stride * stride; k <= steps; k += stride) {
+    queue_angle(&search, k);
+  }
+  evaluate_queued_angles(&search);
+
+  while (stride > 1) {
+    int candidates[DESKEW_REFINE_CANDIDATES];
+    int candidates_count = 0;
+
+    for (int k = -steps - 1; k <= steps; k++) {
+      const int peak = *search_peak(&search, k);
+      if (peak < 0) {
+        continue;
+      }
+
+      int i = candidates_count;
+      while (i > 0 && better_angle(peak, k,
+                                   *search_peak(&search, candidates[i - 1]),
+                                   candidates[i - 1])) {
+        i--;
+      }
+      if (i == DESKEW_REFINE_CANDIDATES) {
+        continue;
+      }
+      for (int j = min(candidates_count, DESKEW_REFINE_CANDIDATES - 1); j > i;
+           j--) {
+        candidates[j] = candidates[j - 1];
+      }
+      candidates[i] = k;
+      candidates_count = min(candidates_count + 1, DESKEW_REFINE_CANDIDATES);
+    }
+
+    stride /= 2;
+    for (int i = 0; i < candidates_count; i++) {
+      queue_angle(&search, candidates[i] - stride);
+      queue_angle(&search, candidates[i] + stride);
+    }
+    evaluate_queued_angles(&search);
+  }
+
   int max_peak = 0;
-  float detected_rotation = 0.0;
-
-  // iteratively increase test angle, alternating between +/- sign while
-  // increasing absolute value
-  for (float rotation = 0.0; rotation <= params.deskewScanRangeRad;
-       rotation = (rotation >= 0.0) ? -(rotation + params.deskewScanStepRad)
-                                    : -rotation) {
-    float m = tanf(rotation);
-    int peak = detect_edge_rotation_peak(image, mask, params, shift, m);
-    if (peak > max_peak) {
-      detected_rotation = rotation;
+  int detected = 0;
+  for (int k = -steps - 1; k <= steps; k++) {
+    const int peak = *search_peak(&search, k);
+    if (peak > 0 && better_angle(peak, k, max_peak, detected)) {
+      detected = k;
       max_peak = peak;
     }
   }
-  return detected_rotation;
+
+  verboseLog(VERBOSE_MORE, "evaluated %d of %d angles\n", search.evaluated,
+             2 * steps + 2);
+  return search_angle(&search, detected);
+}
+
+// Longest side, in cells, of the coarsest level of the projection pyramid,
+// which is swept over the whole range of angles.
+#define PROJECTION_SIZE 1024
+// Share of dark pixels that makes a cell of a downsampled level dark.
+#define PROJECTION_DARK_SHARE 8
+#define PROJECTION_MAX_LEVELS 24
+
+typedef struct {
+  RectangleSize size;
+  // One byte per cell, non-zero for dark ones.
+  uint8_t *dark;
+  // Number of dark pixels in each cell, for building the next level from;
+  // the full-resolution level only has the dark plane.
+  uint32_t *counts;
+  // Pixels of the area across each cell.
+  int32_t factor;
+  // Stride of the angles evaluated at this level, in scan steps.
+  int stride;
+} ProjectionLevel;
+
+static ProjectionLevel projection_level_alloc(RectangleSize size,
+                                              int32_t factor, float step) {
+  ProjectionLevel level = {
+      .size = size,
+      .dark = malloc((size_t)size.width * size.height),
+      .factor = factor,
+      // Angles closer than a cell across the width of the level make no
+      // difference to its rows.
+      .stride = max(1, (int)(atanf(1.0 / size.width) / step)),
+  };
+
+  if (level.dark == NULL) {
+    errOutput("unable to allocate projection level.");
+  }
+
+  return level;
+}
+
+/**
+ * Binarizes the area of the image at full resolution.
+ */
+static ProjectionLevel projection_base(Image image, Rectangle area,
+                                       float step) {
+  ProjectionLevel level =
+      projection_level_alloc(size_of_rectangle(area), 1, step);
+  ImageRows rows = image_rows(image);
+  uint8_t *grayscale = malloc(level.size.width);
+  if (grayscale == NULL) {
+    errOutput("unable to allocate projection level.");
+  }
+
+  for (int32_t y = 0; y < level.size.height; y++) {
+    uint8_t *dark = level.dark + (size_t)y * level.size.width;
+    rows.kernels->read_grayscale(image_row(rows, area.vertex[0].y + y),
+                                 area.vertex[0].x, level.size.width,
+                                 grayscale);
+    for (int32_t x = 0; x < level.size.width; x++) {
+      dark[x] = grayscale[x] <= image.abs_black_threshold;
+    }
+  }
+
+  free(grayscale);
+  return level;
+}
+
+/**
+ * Halves the resolution of a level, counting the dark pixels of each 2x2
+ * block of its cells. A cell is dark when at least one in
+ * PROJECTION_DARK_SHARE of the pixels it covers is.
+ */
+static ProjectionLevel projection_reduce(const ProjectionLevel *finer,
+                                         RectangleSize area_size, float step) {
+  ProjectionLevel level = projection_level_alloc(
+      (RectangleSize){(finer->size.width + 1) / 2,
+                      (finer->size.height + 1) / 2},
+      finer->factor * 2, step);
+
+  level.counts =
+      calloc((size_t)level.size.width * level.size.height, sizeof(uint32_t));
+  if (level.counts == NULL) {
+    errOutput("unable to allocate projection level.");
+  }
+
+  for (int32_t y = 0; y < finer->size.height; y++) {
+    uint32_t *counts = level.counts + (size_t)(y / 2) * level.size.width;
+    for (int32_t x = 0; x < finer->size.width; x++) {
+      const size_t cell = (size_t)y * finer->size.width + x;
+      counts[x / 2] += finer->counts != NULL ? finer->counts[cell]
+                                             : (finer->dark[cell] != 0);
+    }
+  }
+
+  for (int32_t y = 0; y < level.size.height; y++) {
+    const int32_t height =
+        min(level.factor, area_size.height - y * level.factor);
+    for (int32_t x = 0; x < level.size.width; x++) {
+      const int32_t width =
+          min(level.factor, area_size.width - x * level.factor);
+      const size_t cell = (size_t)y * level.size.width + x;
+      level.dark[cell] = (uint64_t)level.counts[cell] * PROJECTION_DARK_SHARE >=
+                         (uint64_t)width * height;
+    }
+  }
+
+  return level;
+}
+
+/**
+ * Returns how unevenly the dark cells of the level fall into rows slanted by
+ * the slope m: the sum of the squares of the number of dark cells in each
+ * row, which grows with the variance of the profile.
+ */
+static uint64_t projection_score(const ProjectionLevel *level, float m) {
+  const RectangleSize size = level->size;
+  const int32_t reach = (int32_t)ceilf(fabsf(m) * size.width) + 1;
+  int32_t *offsets = malloc(size.width * sizeof(int32_t));
+  uint32_t *bins = calloc(size.height + 2 * reach, sizeof(uint32_t));
+
+  if (offsets == NULL || bins == NULL) {
+    errOutput("unable to allocate projection profile.");
+  }
+
+  for (int32_t x = 0; x < size.width; x++) {
+    offsets[x] = reach - (int32_t)lrintf(x * m);
+  }
+
+  for (int32_t y = 0; y < size.height; y++) {
+    const uint8_t *dark = level->dark + (size_t)y * size.width;
+    for (int32_t x = 0; x < size.width; x++) {
+      if (dark[x]) {
+        bins[y + offsets[x]]++;
+      }
+    }
+  }
+
+  uint64_t score = 0;
+  for (int32_t i = 0; i < size.height + 2 * reach; i++) {
+    score += (uint64_t)bins[i] * bins[i];
+  }
+
+  free(offsets);
+  free(bins);
+  return score;
+}
+
+// Whether the first angle beats the second: a higher score, or the same score
+// closer to no rotation at all, as the edge scan would have it.
+static inline bool better_projection(uint64_t score, int k,
+                                     uint64_t other_score, int other_k) {
+  return score > other_score ||
+         (score == other_score && search_rank(k) < search_rank(other_k));
+}
+
+typedef struct {
+  const ProjectionLevel *level;
+  float step;
+  // Angles swept, in scan steps.
+  int first;
+  int stride;
+  uint64_t *scores;
+} ProjectionSweep;
+
+static void projection_sweep_tile(void *arg, Tile tile) {
+  const ProjectionSweep *sweep = arg;
+
+  for (int32_t i = tile.area.vertex[0].x; i <= tile.area.vertex[1].x; i++) {
+    const int k = sweep->first + i * sweep->stride;
+    sweep->scores[i] = projection_score(sweep->level, tanf(k * sweep->step));
+  }
+}
+
+/**
+ * Detects the rotation of the area from the horizontal projection profile of
+ * its dark pixels, which peaks as the lines of text line up with the rows.
+ *
+ * The area is binarized once at full resolution, and halved into a pyramid
+ * until no larger than PROJECTION_SIZE. The whole range is swept on the
+ * coarsest level, spread across the tile threads, then the best angle is
+ * climbed towards on each finer one, down to the area at full resolution.
+ */
+static float detect_projection_rotation(Image image, const Rectangle mask,
+                                        const DeskewParameters params) {
+  const Rectangle area = clip_rectangle(image, mask);
+  const RectangleSize size = size_of_rectangle(area);
+  const float step = params.deskewScanStepRad;
+
+  if (size.width <= 0 || size.height <= 0 || step <= 0.0) {
+    return 0.0;
+  }
+
+  const int steps = (int)(params.deskewScanRangeRad / step);
+  ProjectionLevel levels[PROJECTION_MAX_LEVELS];
+  int levels_count = 1;
+
+  levels[0] = projection_base(image, area, step);
+  while (levels_count < PROJECTION_MAX_LEVELS &&
+         max(levels[levels_count - 1].size.width,
+             levels[levels_count - 1].size.height) > PROJECTION_SIZE) {
+    levels[levels_count] =
+        projection_reduce(&levels[levels_count - 1], size, step);
+    levels_count++;
+  }
+
+  int detected = 0;
+  int evaluated = 0;
+  for (int i = levels_count - 1; i >= 0; i--) {
+    const ProjectionLevel *level = &levels[i];
+    uint64_t best;
+
+    if (i == levels_count - 1) {
+      ProjectionSweep sweep = {
+          .level = level,
+          .step = step,
+          .first = -steps / level->stride * level->stride,
+          .stride = level->stride,
+      };
+      const int count = (steps - sweep.first) / sweep.stride + 1;
+      uint64_t scores[count];
+      sweep.scores = scores;
+
+      run_tiles(
+          (TileGrid){
+              .area = {{POINT_ORIGIN, {count - 1, 0}}},
+              .tile_size = {1, 1},
+          },
+          projection_sweep_tile, &sweep);
+      evaluated += count;
+
+      // The order of the angles is total, so the best one does not depend
+      // on the order they are compared in.
+      best = 0;
+      for (int j = 0; j < count; j++) {
+        const int k = sweep.first + j * sweep.stride;
+        if (j == 0 || better_projection(scores[j], k, best, detected)) {
+          best = scores[j];
+          detected = k;
+        }
+      }
+    } else {
+      best = projection_score(level, tanf(detected * step));
+      evaluated++;
+    }
+
+    // Climb from the angle found so far, at the stride of this level.
+    for (int direction = -1; direction <= 1; direction += 2) {
+      for (int k = detected + direction * level->stride;
+           k >= -steps && k <= steps; k += direction * level->stride) {
+        const uint64_t score = projection_score(level, tanf(k * step));
+        evaluated++;
+        if (!better_projection(score, k, best, detected)) {
+          break;
+        }
+        best = score;
+        detected = k;
+      }
+    }
+  }
+
+  for (int i = 0; i < levels_count; i++) {
+    free(levels[i].dark);
+    free(levels[i].counts);
+  }
+
+  verboseLog(VERBOSE_MORE, "evaluated %d projections\n", evaluated);
+  return detected * step;
+}
+
+typedef struct {
+  const char *name;
+  Delta shift;
+  float sign;
+} EdgeScan;
+
+typedef struct {
+  Image image;
+  Rectangle mask;
+  DeskewParameters params;
+  EdgeScan edges[4];
+  float rotations[4];
+} EdgeScans;
+
+static void detect_edge_rotation_tile(void *arg, Tile tile) {
+  EdgeScans *scans = arg;
+
+  for (int32_t i = tile.area.vertex[0].x; i <= tile.area.vertex[1].x; i++) {
+    scans->rotations[i] =
+        scans->edges[i].sign * detect_edge_rotation(scans->image, scans->mask,
+                                                    scans->params,
+                                                    scans->edges[i].shift);
+  }
 }
+
 /**
  * detect rotation of a whole area.
  * angles between -deskew_scan_range and +deskew_scan_range are scanned, at
  * either the horizontal or vertical edges of the area specified by left, top,
- * right, bottom.
+ * right, bottom. The edges are scanned concurrently across the tile threads.
  */
 float detect_rotation(Image image, const Rectangle mask,
                       const DeskewParameters params) {
-  float rotation[4];
+  if (params.method == DESKEW_METHOD_PROJECTION) {
+    const float rotation = detect_projection_rotation(image, mask, params);
+    verboseLog(VERBOSE_NORMAL,
+               "detected rotation projection: [%d,%d,%d,%d]: %f\n",
+               mask.vertex[0].x, mask.vertex[0].y, mask.vertex[1].x,
+               mask.vertex[1].y, rotation);
+    return rotation;
+  }
+
+  EdgeScans scans = {
+      .image = image,
+      .mask = mask,
+      .params = params,
+  };
+  float *rotation = scans.rotations;
   int count = 0;
   float total;
   float average;
   float deviation;
 
+  // The top and bottom edges detect the rotation with the opposite sign.
   if (params.scan_edges.left) {
-    // left
-    rotation[count] =
-        detect_edge_rotation(image, mask, params, DELTA_RIGHTWARD);
-    verboseLog(VERBOSE_NORMAL, "detected rotation left: [%d,%d,%d,%d]: %f\n",
-               mask.vertex[0].x, mask.vertex[0].y, mask.vertex[1].x,
-               mask.vertex[1].y, rotation[count]);
-    count++;
+    scans.edges[count++] = (EdgeScan){"left", DELTA_RIGHTWARD, 1.0};
   }
   if (params.scan_edges.top) {
-    // top
-    rotation[count] =
-        -detect_edge_rotation(image, mask, params, DELTA_DOWNWARD);
-    verboseLog(VERBOSE_NORMAL, "detected rotation top: [%d,%d,%d,%d]: %f\n",
-               mask.vertex[0].x, mask.vertex[0].y, mask.vertex[1].x,
-               mask.vertex[1].y, rotation[count]);
-    count++;
+    scans.edges[count++] = (EdgeScan){"top", DELTA_DOWNWARD, -1.0};
   }
   if (params.scan_edges.right) {
-    // right
-    rotation[count] = detect_edge_rotation(image, mask, params, DELTA_LEFTWARD);
-    verboseLog(VERBOSE_NORMAL, "detected rotation right: [%d,%d,%d,%d]: %f\n",
-               mask.vertex[0].x, mask.vertex[0].y, mask.vertex[1].x,
-               mask.vertex[1].y, rotation[count]);
-    count++;
+    scans.edges[count++] = (EdgeScan){"right", DELTA_LEFTWARD, 1.0};
   }
   if (params.scan_edges.bottom) {
-    // bottom
-    rotation[count] = -detect_edge_rotation(image, mask, params, DELTA_UPWARD);
-    verboseLog(VERBOSE_NORMAL, "detected rotation bottom: [%d,%d,%d,%d]: %f\n",
-               mask.vertex[0].x, mask.vertex[0].y, mask.vertex[1].x,
-               mask.vertex[1].y, rotation[count]);
-    count++;
+    scans.edges[count++] = (EdgeScan){"bottom", DELTA_UPWARD, -1.0};
+  }
+
+  run_tiles(
+      (TileGrid){
+          .area = {{POINT_ORIGIN, {count - 1, 0}}},
+          .tile_size = {1, 1},
+      },
+      detect_edge_rotation_tile, &scans);
+
+  for (int i = 0; i < count; i++) {
+    verboseLog(VERBOSE_NORMAL, "detected rotation %s: [%d,%d,%d,%d]: %f\n",
+               scans.edges[i].name, mask.vertex[0].x, mask.vertex[0].y,
+               mask.vertex[1].x, mask.vertex[1].y, rotation[i]);
   }
 
   total = 0.0;
@@ -239,30 +716,245 @@ float detect_rotation(Image image, const Rectangle mask,
   }
 }
 
+typedef struct {
+  Image image;
+  const Rectangle *masks;
+  DeskewParameters params;
+  float *rotations;
+} MaskRotations;
+
+static void detect_rotations_tile(void *arg, Tile tile) {
+  const MaskRotations *detection = arg;
+
+  for (int32_t i = tile.area.vertex[0].x; i <= tile.area.vertex[1].x; i++) {
+    detection->rotations[i] = detect_rotation(
+        detection->image, detection->masks[i], detection->params);
+  }
+}
+
+void detect_rotations(Image image, const Rectangle masks[], size_t count,
+                      const DeskewParameters params, float rotations[]) {
+  MaskRotations detection = {
+      .image = uncached_image(image),
+      .masks = masks,
+      .params = params,
+      .rotations = rotations,
+  };
+
+  run_tiles(
+      (TileGrid){
+          .area = {{POINT_ORIGIN, {(int32_t)count - 1, 0}}},
+          .tile_size = {1, 1},
+      },
+      detect_rotations_tile, &detection);
+}
+
 /**
- * Rotates a whole image buffer by the specified radians, around its
- * middle-point. (To rotate parts of an image, extract the part with copyBuffer,
- * rotate, and re-paste with copyBuffer.)
+ * Rotates the area of the source image by the specified radians around its
+ * middle-point, into a target image of the same size.
+ *
+ * The rotation is split into three shears, each moving whole rows or columns
+ * by the same fraction so that the interpolation taps are computed once for
+ * each of them: the rows of the source area are shifted into the first
+ * intermediate buffer, whose columns are shifted into the second, whose rows
+ * are shifted into the target. The intermediate buffers are wide enough for
+ * the shears not to cut off anything that ends up in the target.
+ *
+ * The first buffer spans the whole sheared area, so for grayscale and
+ * monochrome images it only holds the grayscale of each pixel, rather than a
+ * Pixel repeating it in all three channels.
  */
+typedef struct {
+  Image source;
+  Image target;
+  Rectangle source_area;
+  FloatPoint target_center;
+  // tangent of half the angle, the factor of both horizontal shears
+  float row_shear;
+  // negated sine of the angle, the factor of the vertical shear
+  float column_shear;
+  Interpolation interpolate_type;
+  // margins of the intermediate buffers around the target area
+  int32_t margin_x;
+  int32_t margin_y;
+  int32_t width;
+  // bytes of each pixel in the intermediate buffers: 1 for grayscale, or the
+  // size of a Pixel
+  int32_t pixel_bytes;
+  uint8_t *sheared_rows;
+  InterpolationTaps *column_taps;
+} RotatePass;
+
+static bool is_grayscale_format(int pixel_format) {
+  switch (pixel_format) {
+  case AV_PIX_FMT_GRAY8:
+  case AV_PIX_FMT_Y400A:
+  case AV_PIX_FMT_MONOWHITE:
+  case AV_PIX_FMT_MONOBLACK:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static inline InterpolationTaps row_taps(const RotatePass *pass, int32_t y) {
+  return interpolation_taps(pass->row_shear * (y - pass->target_center.y),
+                            pass->interpolate_type);
+}
+
+static inline uint8_t *sheared_row(const RotatePass *pass, int32_t y) {
+  return pass->sheared_rows +
+         (ptrdiff_t)(y + pass->margin_y) * pass->width * pass->pixel_bytes;
+}
+
+// Interpolates from the pixels of an intermediate buffer selected by the taps,
+// starting from the pixel at x and stride pixels apart.
+static inline Pixel shear_pixel(const RotatePass *pass, InterpolationTaps taps,
+                                const uint8_t *pixels, int32_t x,
+                                ptrdiff_t stride) {
+  if (pass->pixel_bytes == 1) {
+    const uint8_t value = apply_taps_grayscale(taps, pixels + x, stride);
+    return (Pixel){value, value, value};
+  }
+  return apply_taps(taps, (const Pixel *)pixels + x, stride);
+}
+
+static inline void store_sheared_pixel(const RotatePass *pass,
+                                       uint8_t *pixels, int32_t x,
+                                       Pixel pixel) {
+  if (pass->pixel_bytes == 1) {
+    pixels[x] = pixel.r;
+  } else {
+    ((Pixel *)pixels)[x] = pixel;
+  }
+}
+
+// Shears the rows of the source area into the first intermediate buffer.
+static void rotate_shear_rows(void *arg, Tile tile) {
+  const RotatePass *pass = arg;
+  ImageRows rows = image_rows(pass->source);
+  uint8_t *line = malloc((size_t)(pass->width + 3) * pass->pixel_bytes);
+  if (line == NULL) {
+    errOutput("unable to allocate rotation buffer.");
+  }
+
+  for (int32_t y = tile.area.vertex[0].y; y <= tile.area.vertex[1].y; y++) {
+    const InterpolationTaps taps = row_taps(pass, y);
+    const int32_t length = pass->width + taps.count - 1;
+    const Point first = {
+        pass->source_area.vertex[0].x - pass->margin_x + taps.first,
+        pass->source_area.vertex[0].y + y,
+    };
+    // the part of the line within the source image, if any
+    const Rectangle within = clip_rectangle(
+        pass->source, (Rectangle){{first, {first.x + length - 1, first.y}}});
+
+    for (int32_t i = 0; i < length; i++) {
+      store_sheared_pixel(pass, line, i, PIXEL_WHITE);
+    }
+    if (within.vertex[0].x <= within.vertex[1].x &&
+        within.vertex[0].y <= within.vertex[1].y) {
+      const uint8_t *row = image_row(rows, first.y);
+      const int32_t count = size_of_rectangle(within).width;
+      const int32_t offset = within.vertex[0].x - first.x;
+      if (pass->pixel_bytes == 1) {
+        rows.kernels->read_grayscale(row, within.vertex[0].x, count,
+                                     line + offset);
+      } else {
+        rows.kernels->read_pixels(row, within.vertex[0].x, count,
+                                  (Pixel *)line + offset);
+      }
+    }
+
+    uint8_t *out = sheared_row(pass, y);
+    for (int32_t x = 0; x < pass->width; x++) {
+      store_sheared_pixel(pass, out, x, shear_pixel(pass, taps, line, x, 1));
+    }
+  }
+
+  free(line);
+}
+
+// Shears the columns of the first intermediate buffer into rows of the second,
+// which are in turn sheared into the target.
+static void rotate_shear_columns(void *arg, Tile tile) {
+  const RotatePass *pass = arg;
+  ImageRows rows = image_rows(pass->target);
+  const int32_t width = size_of_rectangle(tile.area).width;
+  uint8_t *line = malloc((size_t)pass->width * pass->pixel_bytes);
+  Pixel *out = malloc(width * sizeof(Pixel));
+  if (line == NULL || out == NULL) {
+    errOutput("unable to allocate rotation buffer.");
+  }
+
+  for (int32_t y = tile.area.vertex[0].y; y <= tile.area.vertex[1].y; y++) {
+    for (int32_t x = 0; x < pass->width; x++) {
+      const InterpolationTaps taps = pass->column_taps[x];
+      store_sheared_pixel(pass, line, x,
+                          shear_pixel(pass, taps,
+                                      sheared_row(pass, y + taps.first), x,
+                                      pass->width));
+    }
+
+    const InterpolationTaps taps = row_taps(pass, y);
+    for (int32_t x = 0; x < width; x++) {
+      out[x] = shear_pixel(pass, taps, line, pass->margin_x + x + taps.first,
+                           1);
+    }
+    rows.kernels->write_pixels(image_row(rows, y), tile.area.vertex[0].x,
+                               width, out, rows.abs_black_threshold);
+  }
+
+  free(line);
+  free(out);
+}
+
 static void rotate(Image source, Rectangle source_area, Image target,
                    const float radians, Interpolation interpolate_type) {
   Rectangle target_area = full_image(target);
-  FloatPoint source_center = center_of_rectangle(source_area);
-  FloatPoint target_center = center_of_rectangle(target_area);
-
-  // create 2D rotation matrix
-  const float sinval = sinf(radians);
-  const float cosval = cosf(radians);
-
-  scan_rectangle(target_area) {
-    const float srcX = source_center.x + (x - target_center.x) * cosval +
-                       (y - target_center.y) * sinval;
-    const float srcY = source_center.y + (y - target_center.y) * cosval -
-                       (x - target_center.x) * sinval;
-    const Pixel pxl =
-        interpolate(source, (FloatPoint){srcX, srcY}, interpolate_type);
-    set_pixel(target, (Point){x, y}, pxl);
+  RectangleSize size = size_of_rectangle(target_area);
+
+  RotatePass pass = {
+      .source = uncached_image(source),
+      .target = uncached_image(target),
+      .source_area = normalize_rectangle(source_area),
+      .target_center = center_of_rectangle(target_area),
+      .row_shear = tanf(radians / 2.0f),
+      .column_shear = -sinf(radians),
+      .interpolate_type = interpolate_type,
+      .pixel_bytes = is_grayscale_format(source.frame->format)
+                         ? 1
+                         : (int32_t)sizeof(Pixel),
+  };
+
+  // Each shear moves pixels by at most its factor times half the size of the
+  // buffer across, plus the reach of the interpolation.
+  pass.margin_x = (int32_t)ceilf(fabsf(pass.row_shear) * size.height / 2) + 3;
+  pass.width = size.width + 2 * pass.margin_x;
+  pass.margin_y = (int32_t)ceilf(fabsf(pass.column_shear) *
+                                 (size.width / 2.0f + pass.margin_x)) +
+                  3;
+
+  const int32_t height = size.height + 2 * pass.margin_y;
+  pass.sheared_rows = malloc((size_t)pass.width * height * pass.pixel_bytes);
+  pass.column_taps = malloc(pass.width * sizeof(InterpolationTaps));
+  if (pass.sheared_rows == NULL || pass.column_taps == NULL) {
+    errOutput("unable to allocate rotation buffer.");
   }
+  for (int32_t x = 0; x < pass.width; x++) {
+    pass.column_taps[x] = interpolation_taps(
+        pass.column_shear * (x - pass.margin_x - pass.target_center.x),
+        interpolate_type);
+  }
+
+  run_tiles(row_bands((Rectangle){{{0, -pass.margin_y},
+                                   {0, size.height + pass.margin_y - 1}}}),
+            rotate_shear_rows, &pass);
+  run_tiles(row_bands(target_area), rotate_shear_columns, &pass);
+  mark_image_changed(target, target_area);
+
+  free(pass.sheared_rows);
+  free(pass.column_taps);
 }
 
 void deskew(Image source, Rectangle mask, float radians,
@@ -4,13 +4,23 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "imageprocess/image.h"
 #include "imageprocess/interpolate.h"
 #include "imageprocess/primitives.h"
 
+typedef enum {
+  // Finds the edges of the mask with a virtual line at each angle.
+  DESKEW_METHOD_EDGES,
+  // Finds the angle at which the rows of a downsampled, binarized copy of the
+  // mask are most unevenly dark, as the lines of text line up with them.
+  DESKEW_METHOD_PROJECTION,
+} DeskewMethod;
+
 typedef struct {
+  DeskewMethod method;
   float deskewScanRangeRad;
   float deskewScanStepRad;
   float deskewScanDeviationRad;
@@ -19,13 +29,18 @@ typedef struct {
   Edges scan_edges;
 } DeskewParameters;
 
-bool validate_deskew_parameters(DeskewParameters *params, float deskewScanRange,
-                                float deskewScanStep, float deskewScanDeviation,
-                                int deskewScanSize, float deskewScanDepth,
-                                Edges deskewScanEdges);
+bool validate_deskew_parameters(DeskewParameters *params, DeskewMethod method,
+                                float deskewScanRange, float deskewScanStep,
+                                float deskewScanDeviation, int deskewScanSize,
+                                float deskewScanDepth, Edges deskewScanEdges);
 
 float detect_rotation(Image image, Rectangle mask,
                       const DeskewParameters params);
+// Detects the rotation of each of the masks concurrently. Deskewing a mask only
+// changes the pixels within it, so for masks that do not intersect this gives
+// the same rotations as detecting and deskewing them one after the other.
+void detect_rotations(Image image, const Rectangle masks[], size_t count,
+                      const DeskewParameters params, float rotations[]);
 
 void deskew(Image source, Rectangle mask, float radians,
             Interpolation interpolate_type);
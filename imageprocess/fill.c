@@ -2,8 +2,13 @@
 //
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <stdbool.h>
+#include <stdlib.h>
+
 #include "imageprocess/fill.h"
 #include "imageprocess/pixel.h"
+#include "lib/logging.h"
+#include "lib/math_util.h"
 
 /**
  * Solidly fills a line of pixels heading towards a specified direction
@@ -42,66 +47,126 @@ static uint64_t fill_line(Image image, Point p, Delta step, Pixel color,
   }
 }
 
+// The four arms of the cross filled from each starting point, in the order
+// they are filled, with the two neighbours probed along each of them.
+static const struct {
+  Delta direction;
+  Delta neighbours[2];
+} ARMS[4] = {
+    // leftward: downward, upward
+    {{-1, 0}, {{0, 1}, {0, -1}}},
+    // upward: rightward, leftward
+    {{0, -1}, {{1, 0}, {-1, 0}}},
+    // rightward: downward, upward
+    {{1, 0}, {{0, 1}, {0, -1}}},
+    // downward: rightward, leftward
+    {{0, 1}, {{1, 0}, {-1, 0}}},
+};
+
+// A cross filled around a starting point, whose arms still have to be probed
+// for neighbouring pixels to start from.
+struct FloodFillFrame {
+  Point origin;
+  uint64_t distance[4];
+  // Position of the next neighbour to probe: the arm, the pixel along it
+  // (counting from 0 for the one next to the origin) and which side of it.
+  int arm;
+  uint64_t step;
+  int side;
+};
+
+static void push_frame(FloodFillStack *stack, FloodFillFrame frame) {
+  if (stack->count >= stack->allocated) {
+    stack->allocated = max(stack->allocated * 2, 64);
+    stack->frames =
+        realloc(stack->frames, stack->allocated * sizeof(stack->frames[0]));
+    if (stack->frames == NULL) {
+      errOutput("unable to allocate flood-fill stack.");
+    }
+  }
+
+  stack->frames[stack->count++] = frame;
+}
+
 /**
- * Start flood-filling around the edges of a line which has previously been
- * filled using fillLine(). Here, the flood-fill algorithm performs its
- * indirect recursion.
- *
- * @param step_x either -1 or 1, if step_y is 0, else 0
- * @param step_y either -1 or 1, if step_x is 0, else 0
- * @see fillLine()
+ * Fills a 'cross' (both vertical and horizontal line) from the point, if the
+ * point itself is to be filled.
  */
-static void flood_fill_around_line(Image image, Point p, Delta step,
-                                   uint64_t distance, Pixel color,
-                                   uint8_t mask_min, uint8_t mask_max,
-                                   uint64_t intensity) {
-  for (uint64_t d = 0; d < distance; d++) {
-    if (step.horizontal != 0) {
-      p.x += step.horizontal;
-      // indirect recursion
-      flood_fill(image, shift_point(p, DELTA_DOWNWARD), color, mask_min,
-                 mask_max, intensity);
-      flood_fill(image, shift_point(p, DELTA_UPWARD), color, mask_min, mask_max,
-                 intensity);
-    } else { // step.vertical != 0
-      p.y += step.vertical;
-      flood_fill(image, shift_point(p, DELTA_RIGHTWARD), color, mask_min,
-                 mask_max, intensity);
-      flood_fill(image, shift_point(p, DELTA_LEFTWARD), color, mask_min,
-                 mask_max, intensity);
-    }
+static bool fill_cross(Image image, Point p, Pixel color, uint8_t mask_min,
+                       uint8_t mask_max, uint64_t intensity,
+                       FloodFillFrame *frame) {
+  uint8_t pixel = get_pixel_grayscale(image, p);
+  if ((pixel < mask_min) || (pixel > mask_max)) {
+    return false;
   }
+
+  set_pixel(image, p, color);
+
+  *frame = (FloodFillFrame){.origin = p};
+  for (int arm = 0; arm < 4; arm++) {
+    frame->distance[arm] = fill_line(image, p, ARMS[arm].direction, color,
+                                     mask_min, mask_max, intensity);
+  }
+
+  return true;
 }
 
 /**
- * Flood-fill an area of pixels. (Naive implementation, optimizable.)
+ * Flood-fill an area of pixels.
  *
- * @see earlier header-declaration to enable indirect recursive calls
+ * Each pixel filled along the arms of a cross starts a new cross on either
+ * side of the arm, if it is to be filled. The crosses still to be probed are
+ * kept on an explicit stack and processed depth-first, so that pixels are
+ * filled in the same order as the original recursive implementation, which
+ * the intensity (gap-bridging) semantics depend on.
  */
 void flood_fill(Image image, Point p, Pixel color, uint8_t mask_min,
-                uint8_t mask_max, uint64_t intensity) {
-  // is current pixel to be filled?
-  uint8_t pixel = get_pixel_grayscale(image, p);
-  if ((pixel >= mask_min) && (pixel <= mask_max)) {
-    // first, fill a 'cross' (both vertical, horizontal line)
-    set_pixel(image, p, color);
-    const uint64_t left = fill_line(image, p, DELTA_LEFTWARD, color, mask_min,
-                                    mask_max, intensity);
-    const uint64_t top =
-        fill_line(image, p, DELTA_UPWARD, color, mask_min, mask_max, intensity);
-    const uint64_t right = fill_line(image, p, DELTA_RIGHTWARD, color, mask_min,
-                                     mask_max, intensity);
-    const uint64_t bottom = fill_line(image, p, DELTA_DOWNWARD, color, mask_min,
-                                      mask_max, intensity);
-    // now recurse on each neighborhood-pixel of the cross (most recursions will
-    // immediately return)
-    flood_fill_around_line(image, p, DELTA_LEFTWARD, left, color, mask_min,
-                           mask_max, intensity);
-    flood_fill_around_line(image, p, DELTA_UPWARD, top, color, mask_min,
-                           mask_max, intensity);
-    flood_fill_around_line(image, p, DELTA_RIGHTWARD, right, color, mask_min,
-                           mask_max, intensity);
-    flood_fill_around_line(image, p, DELTA_DOWNWARD, bottom, color, mask_min,
-                           mask_max, intensity);
+                uint8_t mask_max, uint64_t intensity, FloodFillStack *stack) {
+  const size_t bottom = stack->count;
+  FloodFillFrame frame;
+
+  if (!fill_cross(image, p, color, mask_min, mask_max, intensity, &frame)) {
+    return;
+  }
+  push_frame(stack, frame);
+
+  while (stack->count > bottom) {
+    FloodFillFrame *top = &stack->frames[stack->count - 1];
+
+    if (top->arm == 4) {
+      stack->count--;
+      continue;
+    }
+    if (top->step == top->distance[top->arm]) {
+      top->arm++;
+      top->step = 0;
+      continue;
+    }
+
+    const Delta direction = ARMS[top->arm].direction;
+    const Point along = {
+        top->origin.x + (top->step + 1) * direction.horizontal,
+        top->origin.y + (top->step + 1) * direction.vertical,
+    };
+    const Point neighbour =
+        shift_point(along, ARMS[top->arm].neighbours[top->side]);
+
+    if (top->side == 0) {
+      top->side = 1;
+    } else {
+      top->side = 0;
+      top->step++;
+    }
+
+    // Pushing might move the stack, so the top frame is not used past here.
+    if (fill_cross(image, neighbour, color, mask_min, mask_max, intensity,
+                   &frame)) {
+      push_frame(stack, frame);
+    }
   }
 }
+
+void free_flood_fill_stack(FloodFillStack *stack) {
+  free(stack->frames);
+  *stack = (FloodFillStack){0};
+}
@@ -4,10 +4,22 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "imageprocess/image.h"
 #include "imageprocess/primitives.h"
 
+typedef struct FloodFillFrame FloodFillFrame;
+
+// Work stack for flood_fill(), reused across calls to avoid reallocating it.
+// Zero-initialize before the first use.
+typedef struct {
+  FloodFillFrame *frames;
+  size_t count;
+  size_t allocated;
+} FloodFillStack;
+
 void flood_fill(Image image, Point p, Pixel color, uint8_t mask_min,
-                uint8_t mask_max, uint64_t intensity);
+                uint8_t mask_max, uint64_t intensity, FloodFillStack *stack);
+void free_flood_fill_stack(FloodFillStack *stack);
@@ -3,7 +3,10 @@
 // SPDX-License-Identifier: GPL-2.0-only
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "constants.h"
 #include "imageprocess/blit.h"
@@ -12,6 +15,7 @@
 #include "imageprocess/pixel.h"
 #include "lib/logging.h"
 #include "lib/math_util.h"
+#include "lib/tiles.h"
 
 /***************
  * Blackfilter *
@@ -45,9 +49,9 @@ bool validate_blackfilter_parameters(BlackfilterParameters *params,
   return true;
 }
 
-static void blackfilter_scan(Image image, BlackfilterParameters params,
-                             Delta step, RectangleSize stripe_size,
-                             Delta shift) {
+static uint64_t blackfilter_scan(Image image, BlackfilterParameters params,
+                                 Delta step, RectangleSize stripe_size,
+                                 Delta shift) {
   if (step.horizontal != 0 && step.vertical != 0) {
     errOutput("blackfilter_scan() called with diagonal steps, impossible! "
               "(%" PRId32 ", %" PRId32 ")",
@@ -55,6 +59,8 @@ static void blackfilter_scan(Image image, BlackfilterParameters params,
   }
 
   const Rectangle image_area = full_image(image);
+  FloodFillStack stack = {0};
+  uint64_t count = 0;
 
   Rectangle area = rectangle_from_size(POINT_ORIGIN, stripe_size);
   while (point_in_rectangle(area.vertex[0], image_area)) {
@@ -79,12 +85,13 @@ static void blackfilter_scan(Image image, BlackfilterParameters params,
                      area.vertex[0].x, area.vertex[0].y, area.vertex[1].x,
                      area.vertex[1].y);
           already_excluded_logged = false;
+          count++;
           // start flood-fill in this area (on each pixel to make sure we get
           // everything, in most cases first flood-fill from first pixel will
           // delete all other black pixels in the area already)
           scan_rectangle(area) {
             flood_fill(image, (Point){x, y}, PIXEL_WHITE, 0,
-                       image.abs_black_threshold, params.intensity);
+                       image.abs_black_threshold, params.intensity, &stack);
           }
         } else if (!already_excluded_logged) {
           verboseLog(VERBOSE_NORMAL, "black-area EXCLUDED: [%d,%d,%d,%d]\n",
@@ -100,17 +107,25 @@ static void blackfilter_scan(Image image, BlackfilterParameters params,
 
     area = shift_rectangle(area, shift);
   }
+
+  free_flood_fill_stack(&stack);
+
+  return count;
 }
 
 /**
  * Filters out solidly black areas, as appearing on bad photocopies.
  * A virtual bar of width 'size' and height 'depth' is horizontally moved
  * above the middle of the sheet (or the full sheet, if depth ==-1).
+ *
+ * Returns the number of black areas flood-filled.
  */
-void blackfilter(Image image, BlackfilterParameters params) {
+uint64_t blackfilter(Image image, BlackfilterParameters params) {
+  uint64_t count = 0;
+
   // Left-to-Right scan.
   if (params.scan_direction.horizontal) {
-    blackfilter_scan(
+    count += blackfilter_scan(
         image, params, (Delta){params.scan_step.horizontal, 0},
         (RectangleSize){params.scan_size.width, params.scan_depth.vertical},
         (Delta){0, params.scan_depth.vertical});
@@ -118,11 +133,13 @@ void blackfilter(Image image, BlackfilterParameters params) {
 
   // To-to-Bottom scan.
   if (params.scan_direction.vertical) {
-    blackfilter_scan(
+    count += blackfilter_scan(
         image, params, (Delta){0, params.scan_step.vertical},
         (RectangleSize){params.scan_depth.horizontal, params.scan_size.height},
         (Delta){params.scan_depth.horizontal, 0});
   }
+
+  return count;
 }
 
 /**************
@@ -141,8 +158,38 @@ bool validate_blurfilter_parameters(BlurfilterParameters *params,
   return true;
 }
 
-void blurfilter(Image image, BlurfilterParameters params,
-                uint8_t abs_white_threshold) {
+// The counts of the blur-filter do not depend on the blocks wiped before they
+// are taken: no two blocks of a row overlap, and each block is counted before
+// the one of the row of blocks above that it overlaps gets wiped. All of the
+// counts can thus be taken up front, on the unchanged image.
+typedef struct {
+  Image image;
+  BlurfilterParameters params;
+  uint8_t abs_white_threshold;
+  uint32_t columns;
+  uint64_t *counts;
+} BlurfilterCounts;
+
+static void blurfilter_count_rows(void *arg, Tile tile) {
+  const BlurfilterCounts *counts = arg;
+  const BlurfilterParameters params = counts->params;
+
+  scan_rectangle(tile.area) {
+    // The first row of counts is at the top of the image, the others are one
+    // vertical step below each row of blocks.
+    const int32_t top =
+        y == 0 ? 0
+               : (y - 1) * params.scan_size.height + params.scan_step.vertical;
+    counts->counts[y * counts->columns + x] = count_pixels_within_brightness(
+        counts->image,
+        rectangle_from_size((Point){x * params.scan_size.width, top},
+                            params.scan_size),
+        0, counts->abs_white_threshold, false);
+  }
+}
+
+uint64_t blurfilter(Image image, BlurfilterParameters params,
+                    uint8_t abs_white_threshold) {
   verboseLog(VERBOSE_NORMAL, "blur-filter...");
 
   RectangleSize image_size = size_of_image(image);
@@ -151,6 +198,30 @@ void blurfilter(Image image, BlurfilterParameters params,
       params.scan_size.width * params.scan_size.height;
   uint64_t count = 0;
 
+  const int32_t max_left = image_size.width - params.scan_size.width;
+  const int32_t max_top = image_size.height - params.scan_size.height;
+  const uint32_t blocks_per_column =
+      max_top < 0 ? 0 : max_top / params.scan_size.height + 1;
+
+  BlurfilterCounts counts = {
+      .image = uncached_image(image),
+      .params = params,
+      .abs_white_threshold = abs_white_threshold,
+      .columns = blocks_per_row + 1,
+  };
+  const uint32_t counts_rows = blocks_per_column + 1;
+  counts.counts = calloc(counts.columns * counts_rows, sizeof(uint64_t));
+  if (counts.counts == NULL) {
+    errOutput("unable to allocate blurfilter counts.");
+  }
+
+  run_tiles(
+      (TileGrid){
+          .area = {{POINT_ORIGIN, {counts.columns - 1, counts_rows - 1}}},
+          .tile_size = {counts.columns, 1},
+      },
+      blurfilter_count_rows, &counts);
+
   // allocate one extra block left and right
   uint64_t count_buffers[3][blocks_per_row + 2];
 
@@ -167,12 +238,10 @@ void blurfilter(Image image, BlurfilterParameters params,
   nextCounts[0] = total_pixels_in_block;
   nextCounts[blocks_per_row] = total_pixels_in_block;
 
-  const int32_t max_left = image_size.width - params.scan_size.width;
   for (int32_t left = 0, block = 1; left <= max_left;
        left += params.scan_size.width) {
-    curCounts[block++] = count_pixels_within_brightness(
-        image, rectangle_from_size((Point){left, 0}, params.scan_size), 0,
-        abs_white_threshold, false);
+    curCounts[block] = counts.counts[block - 1];
+    block++;
   }
 
   // Loop through all blocks. For a block calculate the number of dark pixels in
@@ -180,24 +249,16 @@ void blurfilter(Image image, BlurfilterParameters params,
   // and similarly for the block in the top-right, bottom-left and bottom-right
   // corner. Take the maximum of these values. Clear the block if this number is
   // not large enough compared to the total number of pixels in a block.
-  int32_t max_top = image_size.height - params.scan_size.height;
-  for (int32_t top = 0; top <= max_top; top += params.scan_size.height) {
-    nextCounts[0] = count_pixels_within_brightness(
-        image,
-        rectangle_from_size((Point){0, top + params.scan_step.vertical},
-                            params.scan_size),
-        0, abs_white_threshold, false);
+  for (int32_t top = 0, row = 1; top <= max_top;
+       top += params.scan_size.height, row++) {
+    const uint64_t *rowCounts = &counts.counts[row * counts.columns];
+    nextCounts[0] = rowCounts[0];
 
     for (int32_t left = 0, block = 1; left <= max_left;
          left += params.scan_size.width) {
 
       // bottom right (has still to be calculated)
-      nextCounts[block + 1] = count_pixels_within_brightness(
-          image,
-          rectangle_from_size((Point){left + params.scan_size.width,
-                                      top + params.scan_step.vertical},
-                              params.scan_size),
-          0, abs_white_threshold, false);
+      nextCounts[block + 1] = rowCounts[block];
 
       uint64_t max = max3(
           nextCounts[block - 1], nextCounts[block + 1],
@@ -223,118 +284,214 @@ void blurfilter(Image image, BlurfilterParameters params,
     nextCounts = tmpCounts;
   }
 
+  free(counts.counts);
+
   verboseLog(VERBOSE_NORMAL, " deleted %" PRIu64 " pixels.\n", count);
+  return count;
 }
 
 /***************
  * Noisefilter *
  ***************/
 
-static bool noisefilter_compare_and_clear(Image image, Point p, bool clear,
-                                          uint8_t min_white_level) {
-  uint8_t lightness = get_pixel_lightness(image, p);
-  if (lightness >= min_white_level) {
-    return false;
+// Dark pixels are grouped into 8-connected clusters by labelling them row by
+// row, keeping the labels of the previous row only, and merging the clusters
+// with a union-find whenever a pixel joins two of them.
+typedef struct {
+  uint32_t parent;
+  uint64_t size;
+  // Whether the cluster has a pixel dark in all of its components, as needed
+  // for it to be deleted.
+  bool seeded;
+  Rectangle extent;
+} NoiseCluster;
+
+typedef struct {
+  NoiseCluster *clusters;
+  uint32_t count;
+  uint32_t allocated;
+} NoiseClusters;
+
+static uint32_t noisefilter_find(NoiseClusters *clusters, uint32_t label) {
+  NoiseCluster *c = clusters->clusters;
+
+  while (c[label].parent != label) {
+    c[label].parent = c[c[label].parent].parent;
+    label = c[label].parent;
   }
+  return label;
+}
 
-  if (clear) {
-    set_pixel(image, p, PIXEL_WHITE);
+static void noisefilter_merge(NoiseClusters *clusters, uint32_t a,
+                              uint32_t b) {
+  a = noisefilter_find(clusters, a);
+  b = noisefilter_find(clusters, b);
+  if (a == b) {
+    return;
   }
-  return true;
+
+  NoiseCluster *root = &clusters->clusters[min(a, b)];
+  NoiseCluster *child = &clusters->clusters[max(a, b)];
+
+  child->parent = min(a, b);
+  root->size += child->size;
+  root->seeded |= child->seeded;
+  root->extent = (Rectangle){{
+      {min(root->extent.vertex[0].x, child->extent.vertex[0].x),
+       min(root->extent.vertex[0].y, child->extent.vertex[0].y)},
+      {max(root->extent.vertex[1].x, child->extent.vertex[1].x),
+       max(root->extent.vertex[1].y, child->extent.vertex[1].y)},
+  }};
 }
 
-static uint64_t
-noisefilter_count_pixel_neighbors_level(Image image, Point p, uint32_t level,
-                                        bool clear, uint8_t min_white_level) {
-  uint64_t count = 0;
+static uint32_t noisefilter_new_cluster(NoiseClusters *clusters) {
+  if (clusters->count == clusters->allocated) {
+    clusters->allocated = max(clusters->allocated * 2, 1024);
+    clusters->clusters = realloc(clusters->clusters,
+                                 clusters->allocated * sizeof(NoiseCluster));
+    if (clusters->clusters == NULL) {
+      errOutput("unable to allocate noisefilter clusters.");
+    }
+  }
 
-  // upper and lower rows
-  for (int32_t xx = p.x - level; xx <= p.x + level; xx++) {
-    Point upper = {xx, p.y - level}, lower = {xx, p.y + level};
+  const uint32_t label = clusters->count++;
+  clusters->clusters[label] = (NoiseCluster){
+      .parent = label,
+      .extent = {{POINT_INFINITY, {-1, -1}}},
+  };
+  return label;
+}
 
-    count += noisefilter_compare_and_clear(image, upper, clear, min_white_level)
-                 ? 1
-                 : 0;
-    count += noisefilter_compare_and_clear(image, lower, clear, min_white_level)
-                 ? 1
-                 : 0;
-  }
+static void noisefilter_add_pixel(NoiseClusters *clusters, uint32_t label,
+                                  Point p, bool seed) {
+  NoiseCluster *cluster =
+      &clusters->clusters[noisefilter_find(clusters, label)];
+
+  cluster->size++;
+  cluster->seeded |= seed;
+  cluster->extent.vertex[0].x = min(cluster->extent.vertex[0].x, p.x);
+  cluster->extent.vertex[0].y = min(cluster->extent.vertex[0].y, p.y);
+  cluster->extent.vertex[1].x = max(cluster->extent.vertex[1].x, p.x);
+  cluster->extent.vertex[1].y = max(cluster->extent.vertex[1].y, p.y);
+}
 
-  // middle rows
-  for (int32_t yy = p.y - (level - 1); yy <= p.y + (level - 1); yy++) {
-    Point first = {p.x - level, yy}, last = {p.x + level, yy};
-    count += noisefilter_compare_and_clear(image, first, clear, min_white_level)
-                 ? 1
-                 : 0;
-    count += noisefilter_compare_and_clear(image, last, clear, min_white_level)
-                 ? 1
-                 : 0;
+// Labels the dark pixels of the image. Labels are handed out in the same order
+// on every pass over an unchanged image, so rather than storing a label per
+// pixel, the clearing pass replays the labelling of the first one, looking up
+// the clusters it built, and clears the pixels of those found deletable.
+static void noisefilter_label(Image image, NoiseClusters *clusters,
+                              uint8_t min_white_level, bool clear,
+                              uint64_t intensity) {
+  const RectangleSize size = size_of_image(image);
+  ImageRows rows = image_rows(image);
+  uint8_t *lightness = malloc(2 * (size_t)size.width);
+  uint8_t *darkness = lightness + size.width;
+  // One unlabelled column on either side of the labels spares the bound
+  // checks on the neighbours.
+  uint32_t *labels = calloc(2 * ((size_t)size.width + 2), sizeof(uint32_t));
+  if (lightness == NULL || labels == NULL) {
+    errOutput("unable to allocate noisefilter rows.");
   }
+  uint32_t *previous = labels, *current = labels + size.width + 2;
+  uint32_t next_label = 1;
 
-  return count;
-}
+  for (int32_t y = 0; y < size.height; y++) {
+    uint8_t *row = image_row(rows, y);
 
-static uint64_t noisefilter_count_pixel_neighbors(Image image, Point p,
-                                                  uint64_t intensity,
-                                                  uint8_t min_white_level) {
-  // can finish when one level is completely zero
-  uint64_t count = 1; // assume self as set
-  uint64_t lCount;
-  uint32_t level = 1;
-  do {
-    lCount = noisefilter_count_pixel_neighbors_level(image, p, level, false,
-                                                     min_white_level);
-    count += lCount;
-    level++;
-  } while (lCount != 0 && (level <= intensity));
+    rows.kernels->read_lightness(row, 0, size.width, lightness);
+    if (!clear) {
+      rows.kernels->read_darkness_inverse(row, 0, size.width, darkness);
+    }
 
-  return count;
-}
+    for (int32_t x = 0; x < size.width; x++) {
+      if (lightness[x] >= min_white_level) {
+        current[x + 1] = 0;
+        continue;
+      }
+
+      const uint32_t neighbors[] = {current[x], previous[x], previous[x + 1],
+                                    previous[x + 2]};
+      uint32_t label = 0;
+      for (size_t i = 0; i < sizeof(neighbors) / sizeof(*neighbors); i++) {
+        if (neighbors[i] == 0) {
+          continue;
+        }
+        if (label == 0) {
+          label = neighbors[i];
+        } else if (!clear && neighbors[i] != label) {
+          noisefilter_merge(clusters, label, neighbors[i]);
+        }
+      }
+
+      if (label == 0) {
+        label = clear ? next_label++ : noisefilter_new_cluster(clusters);
+      }
+      current[x + 1] = label;
+
+      if (!clear) {
+        noisefilter_add_pixel(clusters, label, (Point){x, y},
+                              darkness[x] < min_white_level);
+        continue;
+      }
 
-static void noisefilter_clear_pixel_neighbors(Image image, Point p,
-                                              uint8_t min_white_level) {
-  set_pixel(image, p, PIXEL_WHITE);
-
-  // lCount will become 0, otherwise countPixelNeighbors() would previously have
-  // delivered a bigger value (and this here would not have been called)
-  uint64_t lCount;
-  uint32_t level = 1;
-  do {
-    lCount = noisefilter_count_pixel_neighbors_level(image, p, level, true,
-                                                     min_white_level);
-    level++;
-  } while (lCount != 0);
+      const NoiseCluster *cluster =
+          &clusters->clusters[noisefilter_find(clusters, label)];
+      if (cluster->seeded && cluster->size <= intensity) {
+        rows.kernels->set(row, x, PIXEL_WHITE, rows.abs_black_threshold);
+      }
+    }
+
+    uint32_t *swap = previous;
+    previous = current;
+    current = swap;
+  }
+
+  free(lightness);
+  free(labels);
 }
 
 /**
  * Applies a simple noise filter to the image.
  *
  * @param intensity maximum cluster size to delete
+ * @return the number of clusters deleted
  */
-void noisefilter(Image image, uint64_t intensity, uint8_t min_white_level) {
+uint64_t noisefilter(Image image, uint64_t intensity, uint8_t min_white_level) {
+  NoiseClusters clusters = {0};
   uint64_t count = 0;
-  Rectangle area = full_image(image);
+  Rectangle changed = {{POINT_INFINITY, {-1, -1}}};
 
   verboseLog(VERBOSE_NORMAL, "noise-filter ...");
 
-  scan_rectangle(area) {
-    Point p = {x, y};
-
-    uint8_t darkness = get_pixel_darkness_inverse(image, p);
-    if (darkness < min_white_level) { // one dark pixel found
-      // get number of non-light pixels in neighborhood
-      uint64_t neighbors = noisefilter_count_pixel_neighbors(
-          image, p, intensity, min_white_level);
+  // Label 0 marks the pixels not belonging to any cluster.
+  noisefilter_new_cluster(&clusters);
+  noisefilter_label(image, &clusters, min_white_level, false, intensity);
 
-      // If not more than 'intensity', delete area.
-      if (neighbors <= intensity) {
-        noisefilter_clear_pixel_neighbors(image, p, min_white_level);
-        count++;
-      }
+  for (uint32_t label = 1; label < clusters.count; label++) {
+    const NoiseCluster *cluster = &clusters.clusters[label];
+    if (cluster->parent != label || !cluster->seeded ||
+        cluster->size > intensity) {
+      continue;
     }
+
+    count++;
+    changed = (Rectangle){{
+        {min(changed.vertex[0].x, cluster->extent.vertex[0].x),
+         min(changed.vertex[0].y, cluster->extent.vertex[0].y)},
+        {max(changed.vertex[1].x, cluster->extent.vertex[1].x),
+         max(changed.vertex[1].y, cluster->extent.vertex[1].y)},
+    }};
+  }
+
+  if (count > 0) {
+    noisefilter_label(image, &clusters, min_white_level, true, intensity);
+    mark_image_changed(image, changed);
   }
 
+  free(clusters.clusters);
+
   verboseLog(VERBOSE_NORMAL, " deleted %" PRIu64 " clusters.\n", count);
+  return count;
 }
 
 /***************
@@ -353,36 +510,189 @@ bool validate_grayfilter_parameters(GrayfilterParameters *params,
   return true;
 }
 
-void grayfilter(Image image, GrayfilterParameters params) {
+// Rows of windows measured by each task of the gray-filter.
+#define GRAYFILTER_BAND_ROWS 8
+
+// Only windows without any black pixel get wiped, so that wiping one does not
+// change the black pixels counted in the others, and only changes the
+// lightness of those overlapping it. All windows are thus measured up front on
+// the unchanged image, band by band, before being visited in order, only
+// measuring again the lightness of those overlapped by a window wiped before.
+typedef struct {
+  Image image;
+  GrayfilterParameters params;
+  uint32_t columns;
+  uint64_t *blacks;
+  uint8_t *lightness;
+} GrayfilterWindows;
+
+// Adds one row of the image to the black pixels and lightness summed up for
+// each column, or removes it with a negative sign.
+static void grayfilter_sum_row(ImageRows rows, int32_t y, int32_t width,
+                               int sign, uint32_t blacks[],
+                               uint32_t lightness[], uint8_t values[]) {
+  const uint8_t *row = image_row(rows, y);
+
+  rows.kernels->read_grayscale(row, 0, width, values);
+  for (int32_t x = 0; x < width; x++) {
+    blacks[x] += sign * (values[x] <= rows.abs_black_threshold);
+  }
+
+  rows.kernels->read_lightness(row, 0, width, values);
+  for (int32_t x = 0; x < width; x++) {
+    lightness[x] += sign * values[x];
+  }
+}
+
+static void grayfilter_measure(void *arg, Tile tile) {
+  const GrayfilterWindows *windows = arg;
+  const GrayfilterParameters params = windows->params;
+  const RectangleSize image_size = size_of_image(windows->image);
+  const int32_t width = image_size.width;
+  const int32_t last_row = min(tile.reach.vertex[1].y, image_size.height - 1);
+  ImageRows rows = image_rows(windows->image);
+  // The row buffers are allocated once per tile, as images can be too wide
+  // for them to fit the stack of the tile threads.
+  uint32_t *blacks = calloc(2 * (size_t)width, sizeof(uint32_t));
+  uint64_t *black_sums = calloc(2 * ((size_t)width + 1), sizeof(uint64_t));
+  uint8_t *values = malloc(width);
+  if (blacks == NULL || black_sums == NULL || values == NULL) {
+    errOutput("unable to allocate grayfilter rows.");
+  }
+  uint32_t *lightness = blacks + width;
+  uint64_t *lightness_sums = black_sums + width + 1;
+
+  // The rows from first to end (excluded) are summed up per column, moving
+  // down with the windows.
+  int32_t first = tile.area.vertex[0].y, end = first;
+
+  for (int32_t top = tile.area.vertex[0].y; top <= tile.area.vertex[1].y;
+       top += params.scan_step.vertical) {
+    const int32_t bottom = min(top + params.scan_size.height - 1, last_row);
+
+    for (; first < top && first < end; first++) {
+      grayfilter_sum_row(rows, first, width, -1, blacks, lightness, values);
+    }
+    first = top;
+    end = max(end, top);
+    for (; end <= bottom; end++) {
+      grayfilter_sum_row(rows, end, width, 1, blacks, lightness, values);
+    }
+
+    for (int32_t x = 0; x < width; x++) {
+      black_sums[x + 1] = black_sums[x] + blacks[x];
+      lightness_sums[x + 1] = lightness_sums[x] + lightness[x];
+    }
+
+    const size_t index = (top / params.scan_step.vertical) * windows->columns;
+    for (uint32_t column = 0; column < windows->columns; column++) {
+      const int32_t left = column * params.scan_step.horizontal;
+      const int32_t right = min(left + params.scan_size.width, width);
+      const uint64_t inside =
+          left < right ? (uint64_t)(right - left) * (end - first) : 0;
+      uint64_t blacks_count = 0;
+      uint8_t inverse_lightness = UINT8_MAX;
+
+      if (inside > 0) {
+        blacks_count = black_sums[right] - black_sums[left];
+        inverse_lightness =
+            0xFF - (lightness_sums[right] - lightness_sums[left]) / inside;
+      }
+      // Pixels outside of the image read as white.
+      if (windows->image.abs_black_threshold == UINT8_MAX) {
+        blacks_count += count_pixels(rectangle_from_size(
+                            (Point){left, top}, params.scan_size)) -
+                        inside;
+      }
+
+      windows->blacks[index + column] = blacks_count;
+      windows->lightness[index + column] = inverse_lightness;
+    }
+  }
+
+  free(blacks);
+  free(black_sums);
+  free(values);
+}
+
+uint64_t grayfilter(Image image, GrayfilterParameters params) {
   RectangleSize image_size = size_of_image(image);
-  Point filter_origin = POINT_ORIGIN;
   uint64_t count = 0;
 
   verboseLog(VERBOSE_NORMAL, "gray-filter...");
 
-  do {
-    Rectangle area = rectangle_from_size(filter_origin, params.scan_size);
-    uint64_t count = count_pixels_within_brightness(
-        image, area, 0, image.abs_black_threshold, false);
+  // Each row of windows ends with the first one starting at or past the right
+  // edge of the image, and the last row is the last one starting within it.
+  const uint32_t columns =
+      (image_size.width + params.scan_step.horizontal - 1) /
+          params.scan_step.horizontal +
+      1;
+  const uint32_t rows = image_size.height / params.scan_step.vertical + 1;
+  GrayfilterWindows windows = {
+      .image = uncached_image(image),
+      .params = params,
+      .columns = columns,
+      .blacks = calloc((size_t)rows * columns, sizeof(uint64_t)),
+      .lightness = calloc((size_t)rows * columns, sizeof(uint8_t)),
+  };
+  bool *overlapped = calloc((size_t)rows * columns, sizeof(bool));
+  if (windows.blacks == NULL || windows.lightness == NULL ||
+      overlapped == NULL) {
+    errOutput("unable to allocate grayfilter windows.");
+  }
+
+  run_tiles(
+      (TileGrid){
+          .area = {{POINT_ORIGIN,
+                    {image_size.width - 1,
+                     rows * params.scan_step.vertical - 1}}},
+          .tile_size = {image_size.width,
+                        params.scan_step.vertical * GRAYFILTER_BAND_ROWS},
+          .halo = {0, max(params.scan_size.height - params.scan_step.vertical,
+                          0)},
+      },
+      grayfilter_measure, &windows);
+
+  const uint32_t overlapping_rows =
+      (params.scan_size.height - 1) / params.scan_step.vertical;
+  const uint32_t overlapping_columns =
+      (params.scan_size.width - 1) / params.scan_step.horizontal;
+
+  for (uint32_t row = 0; row < rows; row++) {
+    for (uint32_t column = 0; column < columns; column++) {
+      const size_t index = (size_t)row * columns + column;
+      if (windows.blacks[index] != 0) {
+        continue;
+      }
 
-    if (count == 0) {
-      uint8_t lightness = inverse_lightness_rect(image, area);
+      Rectangle area = rectangle_from_size(
+          (Point){column * params.scan_step.horizontal,
+                  row * params.scan_step.vertical},
+          params.scan_size);
+      uint8_t lightness = overlapped[index]
+                              ? inverse_lightness_rect(image, area)
+                              : windows.lightness[index];
       // (lower threshold->more deletion)
-      if (lightness < params.abs_threshold) {
-        count += count_pixels(area);
-        wipe_rectangle(image, area, PIXEL_WHITE);
+      if (lightness >= params.abs_threshold) {
+        continue;
       }
-    }
 
-    // Continue on the same row unless we reached the end of the row.
-    if (filter_origin.x < image_size.width) {
-      filter_origin.x += params.scan_step.horizontal;
-    } else {
-      // next row:
-      filter_origin.x = 0;
-      filter_origin.y += params.scan_step.vertical;
+      count += count_pixels(clip_rectangle(image, area));
+      wipe_rectangle(image, area, PIXEL_WHITE);
+
+      for (uint32_t r = row; r <= min(row + overlapping_rows, rows - 1); r++) {
+        for (uint32_t c = column - min(column, overlapping_columns);
+             c <= min(column + overlapping_columns, columns - 1); c++) {
+          overlapped[(size_t)r * columns + c] = true;
+        }
+      }
     }
-  } while (filter_origin.y <= image_size.height);
+  }
+
+  free(overlapped);
+  free(windows.lightness);
+  free(windows.blacks);
 
   verboseLog(VERBOSE_NORMAL, " deleted %" PRIu64 " pixels.\n", count);
+  return count;
 }
@@ -28,7 +28,7 @@ typedef struct {
   Rectangle *exclusions;
 } BlackfilterParameters;
 
-void blackfilter(Image image, BlackfilterParameters params);
+uint64_t blackfilter(Image image, BlackfilterParameters params);
 
 bool validate_blackfilter_parameters(BlackfilterParameters *params,
                                      RectangleSize scan_size, Delta scan_step,
@@ -50,10 +50,11 @@ bool validate_blurfilter_parameters(BlurfilterParameters *params,
                                     RectangleSize scan_size, Delta scan_step,
                                     float intensity);
 
-void blurfilter(Image image, BlurfilterParameters params,
-                uint8_t abs_white_threshold);
+// Returns the number of pixels deleted.
+uint64_t blurfilter(Image image, BlurfilterParameters params,
+                    uint8_t abs_white_threshold);
 
-void noisefilter(Image image, uint64_t intensity, uint8_t min_white_level);
+uint64_t noisefilter(Image image, uint64_t intensity, uint8_t min_white_level);
 
 typedef struct {
   RectangleSize scan_size;
@@ -67,4 +68,5 @@ bool validate_grayfilter_parameters(GrayfilterParameters *params,
                                     RectangleSize scan_size, Delta scan_step,
                                     float threshold);
 
-void grayfilter(Image image, GrayfilterParameters params);
+// Returns the number of pixels deleted.
+uint64_t grayfilter(Image image, GrayfilterParameters params);
@@ -0,0 +1,157 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <libavutil/buffer.h>
+#include <libavutil/common.h>
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixfmt.h>
+
+#include "imageprocess/framepool.h"
+#include "lib/logging.h"
+
+// Alignment of the rows, as create_image() always asked av_frame_get_buffer()
+// for.
+#define FRAME_ALIGN 8
+
+// Rows and bytes allocated beyond the image, as av_frame_get_buffer() does,
+// for code reading a little past the last row.
+#define FRAME_HEIGHT_ALIGN 32
+#define FRAME_PADDING 64
+
+// Number of distinct sizes and formats kept at once; the least recently used
+// pool makes way for a new one.
+#define FRAME_POOLS 16
+
+typedef struct {
+  RectangleSize size;
+  int pixel_format;
+  int linesize;
+  AVBufferPool *buffers;
+  uint64_t last_used;
+} FramePool;
+
+static struct {
+  pthread_mutex_t mutex;
+  FramePool pools[FRAME_POOLS];
+  uint64_t uses;
+} frame_pools = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static bool single_plane_format(int pixel_format) {
+  switch (pixel_format) {
+  case AV_PIX_FMT_Y400A:
+  case AV_PIX_FMT_GRAY8:
+  case AV_PIX_FMT_RGB24:
+  case AV_PIX_FMT_MONOBLACK:
+  case AV_PIX_FMT_MONOWHITE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/**
+ * Lays out the rows of the frame the way av_frame_get_buffer() would, and
+ * returns the size of the buffer holding them.
+ */
+static size_t frame_layout(RectangleSize size, int pixel_format,
+                           int *linesize) {
+  int linesizes[4];
+
+  for (int align = 1; align <= FRAME_ALIGN; align *= 2) {
+    if (av_image_fill_linesizes(linesizes, pixel_format,
+                                FFALIGN(size.width, align)) < 0) {
+      errOutput("unable to lay out a %dx%d frame.", size.width, size.height);
+    }
+    if (linesizes[0] % FRAME_ALIGN == 0) {
+      break;
+    }
+  }
+
+  *linesize = linesizes[0];
+  return (size_t)linesizes[0] * FFALIGN(size.height, FRAME_HEIGHT_ALIGN) +
+         FRAME_PADDING;
+}
+
+static FramePool *find_pool(RectangleSize size, int pixel_format) {
+  FramePool *found = NULL;
+  FramePool *oldest = &frame_pools.pools[0];
+
+  for (int i = 0; i < FRAME_POOLS; i++) {
+    FramePool *pool = &frame_pools.pools[i];
+    if (pool->buffers != NULL && compare_sizes(pool->size, size) == 0 &&
+        pool->pixel_format == pixel_format) {
+      found = pool;
+      break;
+    }
+    if (pool->last_used < oldest->last_used) {
+      oldest = pool;
+    }
+  }
+
+  if (found == NULL) {
+    // Buffers still in use outlive the pool they came from.
+    found = oldest;
+    av_buffer_pool_uninit(&found->buffers);
+
+    found->size = size;
+    found->pixel_format = pixel_format;
+    found->buffers = av_buffer_pool_init(
+        frame_layout(size, pixel_format, &found->linesize), NULL);
+    if (found->buffers == NULL) {
+      errOutput("unable to allocate frame pool.");
+    }
+  }
+
+  found->last_used = ++frame_pools.uses;
+  return found;
+}
+
+AVFrame *frame_pool_get(RectangleSize size, int pixel_format) {
+  AVFrame *frame = av_frame_alloc();
+  if (frame == NULL) {
+    errOutput("unable to allocate frame.");
+  }
+
+  frame->width = size.width;
+  frame->height = size.height;
+  frame->format = pixel_format;
+
+  if (!single_plane_format(pixel_format)) {
+    int ret = av_frame_get_buffer(frame, FRAME_ALIGN);
+    if (ret < 0) {
+      char errbuff[1024];
+      av_strerror(ret, errbuff, sizeof(errbuff));
+      errOutput("unable to allocate buffer: %s", errbuff);
+    }
+    return frame;
+  }
+
+  pthread_mutex_lock(&frame_pools.mutex);
+  FramePool *pool = find_pool(size, pixel_format);
+  frame->buf[0] = av_buffer_pool_get(pool->buffers);
+  frame->linesize[0] = pool->linesize;
+  pthread_mutex_unlock(&frame_pools.mutex);
+
+  if (frame->buf[0] == NULL) {
+    errOutput("unable to allocate buffer.");
+  }
+  frame->data[0] = frame->buf[0]->data;
+
+  return frame;
+}
+
+void frame_pool_drain(void) {
+  pthread_mutex_lock(&frame_pools.mutex);
+  for (int i = 0; i < FRAME_POOLS; i++) {
+    av_buffer_pool_uninit(&frame_pools.pools[i].buffers);
+    frame_pools.pools[i].last_used = 0;
+  }
+  pthread_mutex_unlock(&frame_pools.mutex);
+}
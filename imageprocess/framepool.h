@@ -0,0 +1,23 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include "imageprocess/primitives.h"
+
+typedef struct AVFrame AVFrame;
+
+// Pools of frame buffers keyed by size and pixel format, so that the sheets
+// of a batch, which mostly share both, reuse the buffers of the frames freed
+// before them rather than allocating new ones at each stage.
+//
+// Frames are reference counted as usual: a buffer goes back to its pool once
+// the last frame referencing it is freed, from whichever thread. Its pixels
+// are left as the previous frame had them.
+
+// Returns a new frame of the size and format, with a buffer from its pool.
+AVFrame *frame_pool_get(RectangleSize size, int pixel_format);
+
+// Drops all the pools, whose buffers are released once returned.
+void frame_pool_drain(void);
@@ -2,59 +2,153 @@
 //
 // SPDX-License-Identifier: GPL-2.0-only
 
+#include <stddef.h>
+#include <string.h>
+
 #include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
 
 #include "imageprocess/blit.h"
+#include "imageprocess/framepool.h"
 #include "imageprocess/image.h"
+#include "imageprocess/integral.h"
+#include "imageprocess/planes.h"
 #include "imageprocess/pixel.h"
 #include "lib/logging.h"
 #include "lib/math_util.h"
 
 /**
- * Allocates a memory block for storing image data and fills the AVFrame-struct
- * with the specified values.
+ * Fills a whole fresh frame with the background. No other image shares its
+ * rows, so the first row is replicated over all of the buffer at once, the
+ * padding at the end of the rows included.
+ */
+static void fill_frame(Image image) {
+  ImageRows rows = image_rows(image);
+  const RectangleSize size = size_of_image(image);
+  const size_t total = (size_t)rows.linesize * size.height;
+
+  rows.kernels->fill(rows.data, 0, size.width, image.background,
+                     rows.abs_black_threshold);
+  for (size_t filled = rows.linesize; filled < total; filled *= 2) {
+    memcpy(rows.data + filled, rows.data, min(filled, total - filled));
+  }
+  mark_image_changed(image, full_image(image));
+}
+
+/**
+ * Takes a buffer for storing image data from the pool of the size and format,
+ * and fills the AVFrame-struct with the specified values.
  */
 Image create_image(RectangleSize size, int pixel_format, bool fill,
                    Pixel sheet_background, uint8_t abs_black_threshold) {
   Image image = {
-      .frame = av_frame_alloc(),
+      .frame = frame_pool_get(size, pixel_format),
       .background = sheet_background,
       .abs_black_threshold = abs_black_threshold,
+      .integrals = integral_cache_create(size),
+      .planes = pixel_planes_create(size),
   };
 
-  image.frame->width = size.width;
-  image.frame->height = size.height;
-  image.frame->format = pixel_format;
-
-  int ret = av_frame_get_buffer(image.frame, 8);
-  if (ret < 0) {
-    char errbuff[1024];
-    av_strerror(ret, errbuff, sizeof(errbuff));
-    errOutput("unable to allocate buffer: %s", errbuff);
-  }
-
   if (fill) {
-    wipe_rectangle(image, full_image(image), image.background);
+    fill_frame(image);
   }
 
   return image;
 }
 
+Image image_from_frame(AVFrame *frame, Pixel sheet_background,
+                       uint8_t abs_black_threshold) {
+  const RectangleSize size = {frame->width, frame->height};
+
+  return (Image){
+      .frame = frame,
+      .background = sheet_background,
+      .abs_black_threshold = abs_black_threshold,
+      .integrals = integral_cache_create(size),
+      .planes = pixel_planes_create(size),
+  };
+}
+
 void replace_image(Image *image, Image *new_image) {
   free_image(image);
   image->frame = new_image->frame;
   image->background = new_image->background;
   image->abs_black_threshold = new_image->abs_black_threshold;
+  image->integrals = new_image->integrals;
+  image->planes = new_image->planes;
   new_image->frame = NULL;
+  new_image->integrals = NULL;
+  new_image->planes = NULL;
 }
 
-void free_image(Image *image) { av_frame_free(&image->frame); }
+void free_image(Image *image) {
+  av_frame_free(&image->frame);
+  integral_cache_free(&image->integrals);
+  pixel_planes_free(&image->planes);
+}
+
+void mark_image_changed(Image image, Rectangle area) {
+  integral_cache_invalidate(image.integrals, area);
+  pixel_planes_update(image, area);
+}
+
+Image uncached_image(Image image) {
+  image.integrals = NULL;
+  image.planes = NULL;
+  return image;
+}
 
 Image create_compatible_image(Image source, RectangleSize size, bool fill) {
   return create_image(size, source.frame->format, fill, source.background,
                       source.abs_black_threshold);
 }
 
+/**
+ * Returns the offset of the pixel column within a row, or -1 if it does not
+ * start on a byte.
+ */
+static ptrdiff_t column_offset(int pixel_format, int32_t x) {
+  switch (pixel_format) {
+  case AV_PIX_FMT_GRAY8:
+    return x;
+  case AV_PIX_FMT_Y400A:
+    return (ptrdiff_t)x * 2;
+  case AV_PIX_FMT_RGB24:
+    return (ptrdiff_t)x * 3;
+  case AV_PIX_FMT_MONOWHITE:
+  case AV_PIX_FMT_MONOBLACK:
+    return x % 8 == 0 ? x / 8 : -1;
+  default:
+    return -1;
+  }
+}
+
+Image image_view(Image image, Rectangle area) {
+  const Rectangle clipped = clip_rectangle(image, area);
+  const ptrdiff_t offset =
+      column_offset(image.frame->format, clipped.vertex[0].x);
+
+  if (offset < 0) {
+    Image copy =
+        create_compatible_image(image, size_of_rectangle(clipped), false);
+    copy_rectangle(image, copy, clipped, POINT_ORIGIN);
+    return copy;
+  }
+
+  Image view = uncached_image(image);
+  view.frame = av_frame_alloc();
+  if (view.frame == NULL || av_frame_ref(view.frame, image.frame) < 0) {
+    errOutput("unable to allocate image view.");
+  }
+
+  view.frame->width = size_of_rectangle(clipped).width;
+  view.frame->height = size_of_rectangle(clipped).height;
+  view.frame->data[0] +=
+      (ptrdiff_t)clipped.vertex[0].y * view.frame->linesize[0] + offset;
+
+  return view;
+}
+
 RectangleSize size_of_image(Image image) {
   return (RectangleSize){
       .width = image.frame->width,
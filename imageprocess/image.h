@@ -7,21 +7,43 @@
 #include "imageprocess/primitives.h"
 
 typedef struct AVFrame AVFrame;
+typedef struct IntegralCache IntegralCache;
+typedef struct PixelPlanes PixelPlanes;
 
 typedef struct {
   AVFrame *frame;
   Pixel background;
   uint8_t abs_black_threshold;
+  // Shared by all the copies of the Image, owned by the frame's creator.
+  IntegralCache *integrals;
+  PixelPlanes *planes;
 } Image;
 
 #define EMPTY_IMAGE                                                            \
-  (Image) { NULL, PIXEL_WHITE, 0 }
+  (Image) { NULL, PIXEL_WHITE, 0, NULL, NULL }
 
 Image create_image(RectangleSize size, int pixel_format, bool fill,
                    Pixel sheet_background, uint8_t abs_black_threshold);
+// Returns an image of the pixels of the frame, taking over the reference to it
+// rather than taking a buffer from the pool.
+Image image_from_frame(AVFrame *frame, Pixel sheet_background,
+                       uint8_t abs_black_threshold);
 void replace_image(Image *image, Image *new_image);
 void free_image(Image *image);
+// Brings the data derived from the pixels in the area up to date after they
+// changed, or drops it.
+void mark_image_changed(Image image, Rectangle area);
+// Returns a copy of the image that neither uses nor maintains its derived data,
+// as needed to access the pixels from several threads at once. Once done, the
+// areas written to have to be marked as changed on the image itself.
+Image uncached_image(Image image);
 Image create_compatible_image(Image source, RectangleSize size, bool fill);
+// Returns an image of the area of another, sharing its pixels rather than
+// copying them, with no derived data of its own. Writes through the view have
+// to be marked as changed on the image it was taken from. As pixels of
+// bilevel images share their bytes, a view of one starting mid-byte is a copy
+// instead. Either way, it is freed as any other image.
+Image image_view(Image image, Rectangle area);
 
 RectangleSize size_of_image(Image image);
 Rectangle full_image(Image image);
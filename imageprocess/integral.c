@@ -0,0 +1,305 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <libavutil/frame.h>
+
+#include "imageprocess/bitplane.h"
+#include "imageprocess/integral.h"
+#include "imageprocess/pixel.h"
+#include "lib/logging.h"
+#include "lib/math_util.h"
+
+// Blackfilter, grayfilter and mask detection need at most two statistics at
+// a time each, so a handful of tables covers all the stages.
+#define INTEGRAL_CACHE_TABLES 4
+
+#define TILE_SIZE 64
+// Each tile has a leading row and column of zeroes, so that lookups never
+// need to special-case the tile edges.
+#define TILE_STRIDE (TILE_SIZE + 1)
+#define TILE_ENTRIES (TILE_STRIDE * TILE_STRIDE)
+#define MAX_TILE_BACKOFF 8
+
+typedef struct {
+  bool valid;
+  // Tiles written to before their lookups made up for building them wait
+  // for twice as many pixels to be scanned before being built again.
+  uint8_t backoff;
+  // Pixels scanned directly since the tile was invalidated, or looked up
+  // since it was built.
+  uint32_t pixels;
+} TileState;
+
+typedef struct {
+  bool used;
+  IntegralKind kind;
+  uint8_t min;
+  uint8_t max;
+  uint64_t last_use;
+
+  // For each tile, entry (x, y) holds the sum over the pixels of the tile
+  // above and to the left of (x, y).
+  uint32_t *sums;
+  TileState *tiles;
+} IntegralTable;
+
+struct IntegralCache {
+  int32_t tiles_per_row;
+  int32_t tiles_per_column;
+  IntegralTable tables[INTEGRAL_CACHE_TABLES];
+  uint64_t clock;
+};
+
+IntegralCache *integral_cache_create(RectangleSize size) {
+  IntegralCache *cache = calloc(1, sizeof(IntegralCache));
+  if (cache == NULL) {
+    errOutput("unable to allocate integral cache.");
+  }
+
+  cache->tiles_per_row = (size.width + TILE_SIZE - 1) / TILE_SIZE;
+  cache->tiles_per_column = (size.height + TILE_SIZE - 1) / TILE_SIZE;
+
+  return cache;
+}
+
+static void free_table(IntegralTable *table) {
+  free(table->sums);
+  free(table->tiles);
+}
+
+void integral_cache_free(IntegralCache **cache) {
+  if (*cache == NULL) {
+    return;
+  }
+
+  for (int i = 0; i < INTEGRAL_CACHE_TABLES; i++) {
+    free_table(&(*cache)->tables[i]);
+  }
+  free(*cache);
+  *cache = NULL;
+}
+
+void integral_cache_invalidate(IntegralCache *cache, Rectangle area) {
+  if (cache == NULL) {
+    return;
+  }
+
+  area = normalize_rectangle(area);
+  const int32_t first_column = max(area.vertex[0].x, 0) / TILE_SIZE;
+  const int32_t last_column =
+      min(area.vertex[1].x / TILE_SIZE, cache->tiles_per_row - 1);
+  const int32_t first_row = max(area.vertex[0].y, 0) / TILE_SIZE;
+  const int32_t last_row =
+      min(area.vertex[1].y / TILE_SIZE, cache->tiles_per_column - 1);
+
+  for (int i = 0; i < INTEGRAL_CACHE_TABLES; i++) {
+    IntegralTable *table = &cache->tables[i];
+    if (table->tiles == NULL) {
+      continue;
+    }
+
+    for (int32_t row = first_row; row <= last_row; row++) {
+      for (int32_t column = first_column; column <= last_column; column++) {
+        TileState *tile = &table->tiles[row * cache->tiles_per_row + column];
+        if (!tile->valid) {
+          continue;
+        }
+
+        if (tile->pixels < TILE_SIZE * TILE_SIZE) {
+          tile->backoff = min(tile->backoff + 1, MAX_TILE_BACKOFF);
+        } else {
+          tile->backoff = 0;
+        }
+        tile->valid = false;
+        tile->pixels = 0;
+      }
+    }
+  }
+}
+
+static IntegralTable *find_table(IntegralCache *cache, IntegralKind kind,
+                                 uint8_t min, uint8_t max) {
+  IntegralTable *victim = &cache->tables[0];
+
+  if (kind != INTEGRAL_GRAYSCALE_WITHIN) {
+    min = max = 0;
+  }
+
+  for (int i = 0; i < INTEGRAL_CACHE_TABLES; i++) {
+    IntegralTable *table = &cache->tables[i];
+    if (table->used && table->kind == kind && table->min == min &&
+        table->max == max) {
+      table->last_use = ++cache->clock;
+      return table;
+    }
+
+    if (!table->used ||
+        (victim->used && table->last_use < victim->last_use)) {
+      victim = table;
+    }
+  }
+
+  const size_t tiles = (size_t)cache->tiles_per_row * cache->tiles_per_column;
+
+  free_table(victim);
+  *victim = (IntegralTable){
+      .used = true,
+      .kind = kind,
+      .min = min,
+      .max = max,
+      .last_use = ++cache->clock,
+      .sums = calloc(tiles * TILE_ENTRIES, sizeof(uint32_t)),
+      .tiles = calloc(tiles, sizeof(TileState)),
+  };
+
+  if (victim->sums == NULL || victim->tiles == NULL) {
+    errOutput("unable to allocate integral table.");
+  }
+
+  return victim;
+}
+
+static uint64_t sum_directly(Image image, Rectangle area, IntegralKind kind,
+                             uint8_t min, uint8_t max) {
+  const int32_t width = area.vertex[1].x - area.vertex[0].x + 1;
+  ImageRows rows = image_rows(image);
+  uint64_t sum = 0;
+
+  for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y; y++) {
+    uint8_t *row = image_row(rows, y);
+
+    switch (kind) {
+    case INTEGRAL_GRAYSCALE:
+      sum += rows.kernels->sum_grayscale(row, area.vertex[0].x, width);
+      break;
+    case INTEGRAL_LIGHTNESS:
+      sum += rows.kernels->sum_lightness(row, area.vertex[0].x, width);
+      break;
+    case INTEGRAL_DARKNESS_INVERSE:
+      sum += rows.kernels->sum_darkness_inverse(row, area.vertex[0].x, width);
+      break;
+    case INTEGRAL_GRAYSCALE_WITHIN:
+      sum += rows.kernels->count_grayscale_within(row, area.vertex[0].x, width,
+                                                  min, max, false);
+      break;
+    }
+  }
+
+  return sum;
+}
+
+static void read_values(ImageRows rows, int32_t y, int32_t x, int32_t count,
+                        const IntegralTable *table, uint8_t *values) {
+  const uint8_t *row = image_row(rows, y);
+
+  switch (table->kind) {
+  case INTEGRAL_GRAYSCALE:
+    rows.kernels->read_grayscale(row, x, count, values);
+    break;
+  case INTEGRAL_LIGHTNESS:
+    rows.kernels->read_lightness(row, x, count, values);
+    break;
+  case INTEGRAL_DARKNESS_INVERSE:
+    rows.kernels->read_darkness_inverse(row, x, count, values);
+    break;
+  case INTEGRAL_GRAYSCALE_WITHIN:
+    rows.kernels->read_grayscale(row, x, count, values);
+    for (int32_t i = 0; i < count; i++) {
+      values[i] = values[i] >= table->min && values[i] <= table->max;
+    }
+    break;
+  }
+}
+
+static void build_tile(Image image, IntegralTable *table, Rectangle tile,
+                       uint32_t *sums) {
+  const int32_t width = tile.vertex[1].x - tile.vertex[0].x + 1;
+  ImageRows rows = image_rows(image);
+  uint8_t values[TILE_SIZE];
+
+  for (int32_t y = tile.vertex[0].y, i = 1; y <= tile.vertex[1].y; y++, i++) {
+    const uint32_t *previous = sums + (i - 1) * TILE_STRIDE;
+    uint32_t *current = sums + i * TILE_STRIDE;
+    uint32_t row_sum = 0;
+
+    read_values(rows, y, tile.vertex[0].x, width, table, values);
+    for (int32_t j = 0; j < width; j++) {
+      row_sum += values[j];
+      current[j + 1] = previous[j + 1] + row_sum;
+    }
+  }
+}
+
+uint64_t integral_sum(Image image, Rectangle area, IntegralKind kind,
+                      uint8_t min, uint8_t max) {
+  if (area.vertex[0].x > area.vertex[1].x ||
+      area.vertex[0].y > area.vertex[1].y) {
+    return 0;
+  }
+
+  // Bilevel images are summed a word at a time already, faster than tiles
+  // could be built from single pixels.
+  IntegralCache *cache = image.integrals;
+  if (cache == NULL || is_bitplane_format(image.frame->format)) {
+    return sum_directly(image, area, kind, min, max);
+  }
+
+  IntegralTable *table = find_table(cache, kind, min, max);
+  uint64_t sum = 0;
+
+  for (int32_t row = area.vertex[0].y / TILE_SIZE;
+       row <= area.vertex[1].y / TILE_SIZE; row++) {
+    for (int32_t column = area.vertex[0].x / TILE_SIZE;
+         column <= area.vertex[1].x / TILE_SIZE; column++) {
+      const size_t index = row * cache->tiles_per_row + column;
+      uint32_t *sums = table->sums + index * TILE_ENTRIES;
+
+      const Rectangle tile = clip_rectangle(
+          image, rectangle_from_size((Point){column * TILE_SIZE,
+                                             row * TILE_SIZE},
+                                     (RectangleSize){TILE_SIZE, TILE_SIZE}));
+      const Rectangle part = {{
+          {max(area.vertex[0].x, tile.vertex[0].x),
+           max(area.vertex[0].y, tile.vertex[0].y)},
+          {min(area.vertex[1].x, tile.vertex[1].x),
+           min(area.vertex[1].y, tile.vertex[1].y)},
+      }};
+
+      TileState *state = &table->tiles[index];
+
+      if (!state->valid) {
+        // Only pay for building the tile once scanning it directly has cost
+        // as much, so that stages writing to the image as they go do not
+        // keep rebuilding it.
+        state->pixels += count_pixels(part);
+        if (state->pixels < count_pixels(tile) << state->backoff) {
+          sum += sum_directly(image, part, kind, min, max);
+          continue;
+        }
+
+        build_tile(image, table, tile, sums);
+        state->valid = true;
+        state->pixels = 0;
+      }
+
+      state->pixels = min(state->pixels + count_pixels(part),
+                          (uint32_t)(TILE_SIZE * TILE_SIZE));
+
+      const int32_t left = part.vertex[0].x - tile.vertex[0].x;
+      const int32_t right = part.vertex[1].x - tile.vertex[0].x + 1;
+      const uint32_t *top = sums + (part.vertex[0].y - tile.vertex[0].y) *
+                                       TILE_STRIDE;
+      const uint32_t *bottom =
+          sums + (part.vertex[1].y - tile.vertex[0].y + 1) * TILE_STRIDE;
+
+      sum += bottom[right] - bottom[left] - top[right] + top[left];
+    }
+  }
+
+  return sum;
+}
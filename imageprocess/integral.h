@@ -0,0 +1,35 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdint.h>
+
+#include "imageprocess/image.h"
+#include "imageprocess/primitives.h"
+
+// Per-image cache of summed-area tables (integral images) of derived pixel
+// values, so that summing them over a rectangle costs one lookup per tile
+// the rectangle touches, rather than one read per pixel.
+//
+// The tables are kept per tile, so that writing to the image only
+// invalidates the tiles that were written to. Tiles are built lazily, once
+// scanning them directly has cost as much as building them would.
+
+typedef enum {
+  INTEGRAL_GRAYSCALE,
+  INTEGRAL_LIGHTNESS,
+  INTEGRAL_DARKNESS_INVERSE,
+  // Number of pixels with a grayscale value within [min, max].
+  INTEGRAL_GRAYSCALE_WITHIN,
+} IntegralKind;
+
+IntegralCache *integral_cache_create(RectangleSize size);
+void integral_cache_free(IntegralCache **cache);
+void integral_cache_invalidate(IntegralCache *cache, Rectangle area);
+
+// Sums the values of the given kind over an area already clipped to the image.
+// The range is only used by INTEGRAL_GRAYSCALE_WITHIN.
+uint64_t integral_sum(Image image, Rectangle area, IntegralKind kind,
+                      uint8_t min, uint8_t max);
@@ -127,3 +127,72 @@ Pixel interpolate(Image image, FloatPoint coords, Interpolation function) {
     return interp_bicubic(image, coords);
   }
 }
+
+InterpolationTaps interpolation_taps(float position, Interpolation function) {
+  const float base = floorf(position);
+  const float f = position - base;
+
+  switch (function) {
+  case INTERP_NN:
+    return (InterpolationTaps){
+        .first = (int32_t)roundf(position),
+        .count = 1,
+        .weights = {1.0f},
+    };
+  case INTERP_LINEAR:
+    return (InterpolationTaps){
+        .first = (int32_t)base,
+        .count = 2,
+        .weights = {1.0f - f, f},
+    };
+  case INTERP_CUBIC:
+  default:
+    // The weights of cubic_scale() for each of its four pixels.
+    return (InterpolationTaps){
+        .first = (int32_t)base - 1,
+        .count = 4,
+        .weights =
+            {
+                0.5f * f * (-1.0f + f * (2.0f - f)),
+                1.0f + 0.5f * f * f * (-5.0f + 3.0f * f),
+                0.5f * f * (1.0f + f * (4.0f - 3.0f * f)),
+                0.5f * f * f * (f - 1.0f),
+            },
+    };
+  }
+}
+
+Pixel apply_taps(InterpolationTaps taps, const Pixel *pixels,
+                 ptrdiff_t stride) {
+  if (taps.count == 1) {
+    return pixels[0];
+  }
+
+  float r = 0.0f, g = 0.0f, b = 0.0f;
+  for (int32_t i = 0; i < taps.count; i++) {
+    const Pixel pxl = pixels[i * stride];
+    r += taps.weights[i] * pxl.r;
+    g += taps.weights[i] * pxl.g;
+    b += taps.weights[i] * pxl.b;
+  }
+
+  return (Pixel){
+      .r = av_clip_uint8(lrintf(r)),
+      .g = av_clip_uint8(lrintf(g)),
+      .b = av_clip_uint8(lrintf(b)),
+  };
+}
+
+uint8_t apply_taps_grayscale(InterpolationTaps taps, const uint8_t *values,
+                             ptrdiff_t stride) {
+  if (taps.count == 1) {
+    return values[0];
+  }
+
+  float value = 0.0f;
+  for (int32_t i = 0; i < taps.count; i++) {
+    value += taps.weights[i] * values[i * stride];
+  }
+
+  return av_clip_uint8(lrintf(value));
+}
@@ -4,6 +4,9 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "imageprocess/image.h"
 #include "imageprocess/primitives.h"
 
@@ -15,3 +18,24 @@ typedef enum {
 } Interpolation;
 
 Pixel interpolate(Image image, FloatPoint coords, Interpolation function);
+
+// The pixels and weights interpolating the value at a position along a line of
+// pixels: the position is between pixel first and the next one, and the value
+// the weighted sum of count pixels from first on. Passes moving a whole row or
+// column by the same fraction compute the taps once for all of its pixels.
+typedef struct {
+  int32_t first;
+  int32_t count;
+  float weights[4];
+} InterpolationTaps;
+
+InterpolationTaps interpolation_taps(float position, Interpolation function);
+
+// Interpolates from the pixels selected by the taps, starting from pixels and
+// stride pixels apart.
+Pixel apply_taps(InterpolationTaps taps, const Pixel *pixels,
+                 ptrdiff_t stride);
+
+// As apply_taps(), for grayscale values.
+uint8_t apply_taps_grayscale(InterpolationTaps taps, const uint8_t *values,
+                             ptrdiff_t stride);
@@ -11,6 +11,8 @@
 #include "imageprocess/pixel.h"
 #include "imageprocess/primitives.h"
 #include "lib/logging.h"
+#include "lib/math_util.h"
+#include "lib/tiles.h"
 
 bool validate_mask_detection_parameters(
     MaskDetectionParameters *params, Direction scan_direction,
@@ -207,6 +209,33 @@ size_t detect_masks(Image image, MaskDetectionParameters params,
   return masks_count;
 }
 
+/**
+ * Moves the pixels of the mask to the target coordinates. The part of the mask
+ * within the image lands at the target, followed by background for the part
+ * beyond it.
+ */
+static void move_mask(Image image, Rectangle mask, Point target) {
+  const RectangleSize size = size_of_rectangle(mask);
+  const RectangleSize moved = size_of_rectangle(clip_rectangle(image, mask));
+
+  move_rectangle(image, mask, target);
+
+  if (moved.width < size.width) {
+    wipe_rectangle(image,
+                   (Rectangle){{{target.x + moved.width, target.y},
+                                {target.x + size.width - 1,
+                                 target.y + size.height - 1}}},
+                   image.background);
+  }
+  if (moved.height < size.height) {
+    wipe_rectangle(image,
+                   (Rectangle){{{target.x, target.y + moved.height},
+                                {target.x + moved.width - 1,
+                                 target.y + size.height - 1}}},
+                   image.background);
+  }
+}
+
 /**
  * Moves a rectangular area of pixels to be centered above the centerX, centerY
  * coordinates.
@@ -225,11 +254,7 @@ void center_mask(Image image, const Point center, const Rectangle area) {
                area.vertex[0].x, area.vertex[0].y, area.vertex[1].x,
                area.vertex[1].y, center.x, center.y,
                target.x - area.vertex[0].x, target.y - area.vertex[0].y);
-    Image newimage = create_compatible_image(image, size, false);
-    copy_rectangle(image, newimage, area, POINT_ORIGIN);
-    wipe_rectangle(image, area, image.background);
-    copy_rectangle(newimage, image, full_image(newimage), target);
-    free_image(&newimage);
+    move_mask(image, area, target);
   } else {
     verboseLog(VERBOSE_NORMAL,
                "centering mask [%d,%d,%d,%d] (%d,%d): %d, %d - NO CENTERING "
@@ -284,11 +309,56 @@ void align_mask(Image image, const Rectangle inside_area,
              target.y, target.x - inside_area.vertex[0].x,
              target.y - inside_area.vertex[0].y);
 
-  Image newimage = create_compatible_image(image, inside_size, true);
-  copy_rectangle(image, newimage, inside_area, POINT_ORIGIN);
-  wipe_rectangle(image, inside_area, image.background);
-  copy_rectangle(newimage, image, full_image(newimage), target);
-  free_image(&newimage);
+  move_mask(image, inside_area, target);
+}
+
+typedef struct {
+  Image image;
+  // Normalized, and sorted by their left edge.
+  const Rectangle *masks;
+  size_t masks_count;
+  Pixel color;
+} MasksPass;
+
+static int compare_mask_left(const void *a, const void *b) {
+  const Rectangle *first = a;
+  const Rectangle *second = b;
+
+  return (first->vertex[0].x > second->vertex[0].x) -
+         (first->vertex[0].x < second->vertex[0].x);
+}
+
+static void apply_masks_band(void *arg, Tile tile) {
+  const MasksPass *pass = arg;
+  ImageRows rows = image_rows(pass->image);
+  const int32_t left = tile.area.vertex[0].x;
+  const int32_t right = tile.area.vertex[1].x;
+
+  for (int32_t y = tile.area.vertex[0].y; y <= tile.area.vertex[1].y; y++) {
+    uint8_t *row = image_row(rows, y);
+    // Walking the masks by their left edge, x is the first column not yet
+    // known to be either covered by a mask or filled.
+    int32_t x = left;
+
+    for (size_t i = 0; i < pass->masks_count && x <= right; i++) {
+      const Rectangle mask = pass->masks[i];
+      if (y < mask.vertex[0].y || y > mask.vertex[1].y ||
+          mask.vertex[1].x < x) {
+        continue;
+      }
+
+      if (mask.vertex[0].x > x) {
+        rows.kernels->fill(row, x, min(mask.vertex[0].x, right + 1) - x,
+                           pass->color, rows.abs_black_threshold);
+      }
+      x = mask.vertex[1].x + 1;
+    }
+
+    if (x <= right) {
+      rows.kernels->fill(row, x, right - x + 1, pass->color,
+                         rows.abs_black_threshold);
+    }
+  }
 }
 
 /**
@@ -301,14 +371,21 @@ void apply_masks(Image image, const Rectangle masks[], size_t masks_count,
     return;
   }
 
-  Rectangle image_area = full_image(image);
-
-  scan_rectangle(image_area) {
-    Point p = {x, y};
-    if (!point_in_rectangles_any(p, masks_count, masks)) {
-      set_pixel(image, p, color);
-    }
+  Rectangle sorted[masks_count];
+  for (size_t i = 0; i < masks_count; i++) {
+    sorted[i] = normalize_rectangle(masks[i]);
   }
+  qsort(sorted, masks_count, sizeof(Rectangle), compare_mask_left);
+
+  MasksPass pass = {
+      .image = uncached_image(image),
+      .masks = sorted,
+      .masks_count = masks_count,
+      .color = color,
+  };
+
+  run_tiles(row_bands(full_image(image)), apply_masks_band, &pass);
+  mark_image_changed(image, full_image(image));
 }
 
 /**
@@ -317,7 +394,7 @@ void apply_masks(Image image, const Rectangle masks[], size_t masks_count,
  */
 void apply_wipes(Image image, Wipes wipes, Pixel color) {
   for (size_t i = 0; i < wipes.count; i++) {
-    scan_rectangle(wipes.areas[i]) { set_pixel(image, (Point){x, y}, color); }
+    wipe_rectangle(image, wipes.areas[i], color);
 
     verboseLog(VERBOSE_MORE,
                "wipe [%" PRId32 ",%" PRId32 ",%" PRId32 ",%" PRId32 "]\n",
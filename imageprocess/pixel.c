@@ -4,12 +4,15 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <libavutil/avutil.h>
 #include <libavutil/frame.h>
 #include <libavutil/pixfmt.h>
 
+#include "imageprocess/bitplane.h"
 #include "imageprocess/pixel.h"
+#include "imageprocess/planes.h"
 #include "lib/logging.h"
 #include "lib/math_util.h"
 
@@ -17,50 +20,346 @@ static inline uint8_t pixel_grayscale(Pixel pixel) {
   return (pixel.r + pixel.g + pixel.b) / 3;
 }
 
-static Pixel get_pixel_components(Image image, Point coords) {
-  uint8_t *pix;
+/*
+ * Single-pixel accessors for each of the supported pixel formats. These are
+ * inlined into the span kernels below, so that walking a row never goes
+ * through the pixel format switch.
+ */
 
-  if (!point_in_rectangle(coords, full_image(image))) {
-    return PIXEL_WHITE;
+static inline Pixel gray8_get(const uint8_t *row, int32_t x) {
+  return (Pixel){row[x], row[x], row[x]};
+}
+
+static inline void gray8_set(uint8_t *row, int32_t x, Pixel pixel,
+                             uint8_t abs_black_threshold) {
+  row[x] = pixel_grayscale(pixel);
+}
+
+static inline Pixel y400a_get(const uint8_t *row, int32_t x) {
+  return (Pixel){row[x * 2], row[x * 2], row[x * 2]};
+}
+
+static inline void y400a_set(uint8_t *row, int32_t x, Pixel pixel,
+                             uint8_t abs_black_threshold) {
+  row[x * 2] = pixel_grayscale(pixel);
+  row[x * 2 + 1] = 0xFF; // no alpha.
+}
+
+static inline Pixel rgb24_get(const uint8_t *row, int32_t x) {
+  const uint8_t *pix = row + x * 3;
+  return (Pixel){
+      .r = pix[0],
+      .g = pix[1],
+      .b = pix[2],
+  };
+}
+
+static inline void rgb24_set(uint8_t *row, int32_t x, Pixel pixel,
+                             uint8_t abs_black_threshold) {
+  uint8_t *pix = row + x * 3;
+  pix[0] = pixel.r;
+  pix[1] = pixel.g;
+  pix[2] = pixel.b;
+}
+
+static inline bool mono_bit(const uint8_t *row, int32_t x) {
+  return row[x / 8] & (128 >> (x % 8));
+}
+
+static inline void mono_set_bit(uint8_t *row, int32_t x, bool bit) {
+  if (bit) {
+    row[x / 8] |= (128 >> (x % 8));
+  } else {
+    row[x / 8] &= ~(128 >> (x % 8));
   }
+}
+
+static inline Pixel monowhite_get(const uint8_t *row, int32_t x) {
+  return mono_bit(row, x) ? PIXEL_BLACK : PIXEL_WHITE;
+}
+
+static inline void monowhite_set(uint8_t *row, int32_t x, Pixel pixel,
+                                 uint8_t abs_black_threshold) {
+  mono_set_bit(row, x, pixel_grayscale(pixel) < abs_black_threshold);
+}
+
+static inline Pixel monoblack_get(const uint8_t *row, int32_t x) {
+  return mono_bit(row, x) ? PIXEL_WHITE : PIXEL_BLACK;
+}
+
+static inline void monoblack_set(uint8_t *row, int32_t x, Pixel pixel,
+                                 uint8_t abs_black_threshold) {
+  mono_set_bit(row, x, pixel_grayscale(pixel) >= abs_black_threshold);
+}
+
+/*
+ * Span kernels, generated from the single-pixel accessors above. The derived
+ * values (grayscale, lightness, darkness) are computed the same way as the
+ * get_pixel_*() functions below.
+ */
+
+#define DEFINE_PIXEL_KERNELS(format)                                           \
+  static void format##_read_pixels(const uint8_t *row, int32_t x,              \
+                                   int32_t count, Pixel *out) {                \
+    for (int32_t i = 0; i < count; i++) {                                      \
+      out[i] = format##_get(row, x + i);                                       \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void format##_write_pixels(uint8_t *row, int32_t x, int32_t count,    \
+                                    const Pixel *in,                           \
+                                    uint8_t abs_black_threshold) {             \
+    for (int32_t i = 0; i < count; i++) {                                      \
+      format##_set(row, x + i, in[i], abs_black_threshold);                    \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void format##_read_grayscale(const uint8_t *row, int32_t x,           \
+                                      int32_t count, uint8_t *out) {           \
+    for (int32_t i = 0; i < count; i++) {                                      \
+      out[i] = pixel_grayscale(format##_get(row, x + i));                      \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void format##_read_lightness(const uint8_t *row, int32_t x,           \
+                                      int32_t count, uint8_t *out) {           \
+    for (int32_t i = 0; i < count; i++) {                                      \
+      Pixel p = format##_get(row, x + i);                                      \
+      out[i] = min3(p.r, p.g, p.b);                                            \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void format##_read_darkness_inverse(const uint8_t *row, int32_t x,    \
+                                             int32_t count, uint8_t *out) {    \
+    for (int32_t i = 0; i < count; i++) {                                      \
+      Pixel p = format##_get(row, x + i);                                      \
+      out[i] = max3(p.r, p.g, p.b);                                            \
+    }                                                                          \
+  }
+
+// Repeats the first size bytes of the span over all of it, doubling the
+// filled part with each copy.
+static inline void fill_pattern(uint8_t *span, size_t size, size_t total) {
+  for (size_t filled = size; filled < total; filled *= 2) {
+    memcpy(span + filled, span, min(filled, total - filled));
+  }
+}
+
+/*
+ * Kernels for the byte-oriented formats, which address each pixel on its own
+ * in the given number of bytes, so that fills and copies work on whole spans
+ * of bytes. The abs_black_threshold is only meaningful for the bilevel formats,
+ * so it is not needed to clear or copy pixels here.
+ */
+
+#define DEFINE_BYTE_KERNELS(format, bytes)                                     \
+  DEFINE_PIXEL_KERNELS(format)                                                 \
+                                                                               \
+  static uint64_t format##_sum_grayscale(const uint8_t *row, int32_t x,        \
+                                         int32_t count) {                      \
+    uint64_t sum = 0;                                                          \
+    for (int32_t i = 0; i < count; i++) {                                      \
+      sum += pixel_grayscale(format##_get(row, x + i));                        \
+    }                                                                          \
+    return sum;                                                                \
+  }                                                                            \
+                                                                               \
+  static uint64_t format##_sum_lightness(const uint8_t *row, int32_t x,        \
+                                         int32_t count) {                      \
+    uint64_t sum = 0;                                                          \
+    for (int32_t i = 0; i < count; i++) {                                      \
+      Pixel p = format##_get(row, x + i);                                      \
+      sum += min3(p.r, p.g, p.b);                                              \
+    }                                                                          \
+    return sum;                                                                \
+  }                                                                            \
+                                                                               \
+  static uint64_t format##_sum_darkness_inverse(const uint8_t *row, int32_t x, \
+                                                int32_t count) {               \
+    uint64_t sum = 0;                                                          \
+    for (int32_t i = 0; i < count; i++) {                                      \
+      Pixel p = format##_get(row, x + i);                                      \
+      sum += max3(p.r, p.g, p.b);                                              \
+    }                                                                          \
+    return sum;                                                                \
+  }                                                                            \
+                                                                               \
+  static uint64_t format##_count_grayscale_within(                             \
+      uint8_t *row, int32_t x, int32_t count, uint8_t min, uint8_t max,        \
+      bool clear) {                                                            \
+    uint64_t result = 0;                                                       \
+    for (int32_t i = 0; i < count; i++) {                                      \
+      const uint8_t value = pixel_grayscale(format##_get(row, x + i));         \
+      if (value < min || value > max) {                                        \
+        continue;                                                              \
+      }                                                                        \
+      if (clear) {                                                             \
+        format##_set(row, x + i, PIXEL_WHITE, 0);                              \
+      }                                                                        \
+      result++;                                                                \
+    }                                                                          \
+    return result;                                                             \
+  }                                                                            \
+                                                                               \
+  static void format##_fill(uint8_t *row, int32_t x, int32_t count,            \
+                            Pixel color, uint8_t abs_black_threshold) {        \
+    if (count <= 0) {                                                          \
+      return;                                                                  \
+    }                                                                          \
+    format##_set(row, x, color, abs_black_threshold);                          \
+    if (bytes == 1) {                                                          \
+      memset(row + x, row[x], count);                                          \
+    } else {                                                                   \
+      fill_pattern(row + (ptrdiff_t)x * bytes, bytes, (size_t)count * bytes);  \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void format##_copy(uint8_t *target_row, int32_t target_x,             \
+                            const uint8_t *source_row, int32_t source_x,       \
+                            int32_t count) {                                   \
+    memmove(target_row + (ptrdiff_t)target_x * bytes,                          \
+            source_row + (ptrdiff_t)source_x * bytes, (size_t)count * bytes);  \
+  }                                                                            \
+                                                                               \
+  static const PixelRowKernels format##_kernels = {                            \
+      .get = format##_get,                                                     \
+      .set = format##_set,                                                     \
+      .read_pixels = format##_read_pixels,                                     \
+      .write_pixels = format##_write_pixels,                                   \
+      .read_grayscale = format##_read_grayscale,                               \
+      .read_lightness = format##_read_lightness,                               \
+      .read_darkness_inverse = format##_read_darkness_inverse,                 \
+      .sum_grayscale = format##_sum_grayscale,                                 \
+      .sum_lightness = format##_sum_lightness,                                 \
+      .sum_darkness_inverse = format##_sum_darkness_inverse,                   \
+      .count_grayscale_within = format##_count_grayscale_within,               \
+      .fill = format##_fill,                                                   \
+      .copy = format##_copy,                                                   \
+  };
+
+DEFINE_BYTE_KERNELS(gray8, 1)
+DEFINE_BYTE_KERNELS(y400a, 2)
+DEFINE_BYTE_KERNELS(rgb24, 3)
+
+/*
+ * Kernels for the packed bilevel formats, working on whole words of bits
+ * through the bitplane functions. A pixel is either black (0) or white
+ * (UINT8_MAX) in all of grayscale, lightness and darkness, so a single sum
+ * covers all three. The two formats only differ in the value of the bits that
+ * represent white pixels.
+ */
+
+static inline uint64_t mono_count_white(const uint8_t *row, int32_t x,
+                                        int32_t count, bool white_bit) {
+  const uint64_t set_bits = bitplane_count(row, x, count);
+  return white_bit ? set_bits : count - set_bits;
+}
 
-  switch (image.frame->format) {
+static inline uint64_t mono_count_grayscale_within(uint8_t *row, int32_t x,
+                                                   int32_t count, uint8_t min,
+                                                   uint8_t max, bool clear,
+                                                   bool white_bit) {
+  const uint64_t white = mono_count_white(row, x, count, white_bit);
+  uint64_t result = 0;
+
+  if (max == UINT8_MAX) {
+    result += white;
+  }
+  if (min == 0) {
+    result += count - white;
+    // Clearing the white pixels to white is a no-op, so the whole span can
+    // be filled at once.
+    if (clear) {
+      bitplane_fill(row, x, count, white_bit);
+    }
+  }
+
+  return result;
+}
+
+#define DEFINE_MONO_KERNELS(format, white_bit)                                 \
+  DEFINE_PIXEL_KERNELS(format)                                                 \
+                                                                               \
+  static uint64_t format##_sum(const uint8_t *row, int32_t x, int32_t count) { \
+    return UINT8_MAX * mono_count_white(row, x, count, white_bit);             \
+  }                                                                            \
+                                                                               \
+  static uint64_t format##_count_grayscale_within(                             \
+      uint8_t *row, int32_t x, int32_t count, uint8_t min, uint8_t max,        \
+      bool clear) {                                                            \
+    return mono_count_grayscale_within(row, x, count, min, max, clear,         \
+                                       white_bit);                             \
+  }                                                                            \
+                                                                               \
+  static void format##_fill(uint8_t *row, int32_t x, int32_t count,            \
+                            Pixel color, uint8_t abs_black_threshold) {        \
+    const bool white = pixel_grayscale(color) >= abs_black_threshold;          \
+    bitplane_fill(row, x, count, white == white_bit);                          \
+  }                                                                            \
+                                                                               \
+  static void format##_copy(uint8_t *target_row, int32_t target_x,             \
+                            const uint8_t *source_row, int32_t source_x,       \
+                            int32_t count) {                                   \
+    bitplane_copy(target_row, target_x, source_row, source_x, count, false);   \
+  }                                                                            \
+                                                                               \
+  static const PixelRowKernels format##_kernels = {                            \
+      .get = format##_get,                                                     \
+      .set = format##_set,                                                     \
+      .read_pixels = format##_read_pixels,                                     \
+      .write_pixels = format##_write_pixels,                                   \
+      .read_grayscale = format##_read_grayscale,                               \
+      .read_lightness = format##_read_lightness,                               \
+      .read_darkness_inverse = format##_read_darkness_inverse,                 \
+      .sum_grayscale = format##_sum,                                           \
+      .sum_lightness = format##_sum,                                           \
+      .sum_darkness_inverse = format##_sum,                                    \
+      .count_grayscale_within = format##_count_grayscale_within,               \
+      .fill = format##_fill,                                                   \
+      .copy = format##_copy,                                                   \
+  };
+
+DEFINE_MONO_KERNELS(monowhite, false)
+DEFINE_MONO_KERNELS(monoblack, true)
+
+/**
+ * Returns the table of row kernels for the given pixel format.
+ */
+const PixelRowKernels *pixel_row_kernels(int pixel_format) {
+  switch (pixel_format) {
   case AV_PIX_FMT_GRAY8:
-    pix =
-        image.frame->data[0] + (coords.y * image.frame->linesize[0] + coords.x);
-    return (Pixel){*pix, *pix, *pix};
+    return &gray8_kernels;
   case AV_PIX_FMT_Y400A:
-    pix = image.frame->data[0] +
-          (coords.y * image.frame->linesize[0] + coords.x * 2);
-    return (Pixel){*pix, *pix, *pix};
+    return &y400a_kernels;
   case AV_PIX_FMT_RGB24:
-    pix = image.frame->data[0] +
-          (coords.y * image.frame->linesize[0] + coords.x * 3);
-    return (Pixel){
-        .r = pix[0],
-        .g = pix[1],
-        .b = pix[2],
-    };
+    return &rgb24_kernels;
   case AV_PIX_FMT_MONOWHITE:
-    pix = image.frame->data[0] +
-          (coords.y * image.frame->linesize[0] + coords.x / 8);
-    if (*pix & (128 >> (coords.x % 8)))
-      return PIXEL_BLACK;
-    else
-      return PIXEL_WHITE;
+    return &monowhite_kernels;
   case AV_PIX_FMT_MONOBLACK:
-    pix = image.frame->data[0] +
-          (coords.y * image.frame->linesize[0] + coords.x / 8);
-    if (*pix & (128 >> (coords.x % 8)))
-      return PIXEL_WHITE;
-    else
-      return PIXEL_BLACK;
+    return &monoblack_kernels;
   default:
     errOutput("unknown pixel format.");
-    return PIXEL_WHITE; // technically unreachable
   }
 }
 
+ImageRows image_rows(Image image) {
+  return (ImageRows){
+      .kernels = pixel_row_kernels(image.frame->format),
+      .data = image.frame->data[0],
+      .linesize = image.frame->linesize[0],
+      .abs_black_threshold = image.abs_black_threshold,
+  };
+}
+
+static Pixel get_pixel_components(Image image, Point coords) {
+  if (!point_in_rectangle(coords, full_image(image))) {
+    return PIXEL_WHITE;
+  }
+
+  ImageRows rows = image_rows(image);
+  return rows.kernels->get(image_row(rows, coords.y), coords.x);
+}
+
 Pixel pixel_from_value(uint32_t value) {
   return (Pixel){
       .r = (value >> 16) & 0xff,
@@ -76,6 +375,15 @@ int compare_pixel(Pixel a, Pixel b) {
   return pixel_grayscale(a) < pixel_grayscale(b) ? -1 : 1;
 }
 
+static inline uint8_t get_plane_value(Image image, const uint8_t *plane,
+                                      Point coords) {
+  if (!point_in_rectangle(coords, full_image(image))) {
+    return UINT8_MAX;
+  }
+
+  return plane[coords.y * image.frame->width + coords.x];
+}
+
 /* Returns the color or grayscale value of a single pixel.
  * Always returns a color-compatible value (which may be interpreted as 8-bit
  * grayscale)
@@ -88,6 +396,11 @@ Pixel get_pixel(Image image, Point coords) {
  * Returns the grayscale (=brightness) value of a single pixel.
  */
 uint8_t get_pixel_grayscale(Image image, Point coords) {
+  const uint8_t *plane = image_plane(image, PLANE_GRAYSCALE);
+  if (plane != NULL) {
+    return get_plane_value(image, plane, coords);
+  }
+
   return pixel_grayscale(get_pixel(image, coords));
 }
 
@@ -104,6 +417,11 @@ uint8_t get_pixel_grayscale(Image image, Point coords) {
  * UINT8_MAX if the coordinates are outside the image
  */
 uint8_t get_pixel_lightness(Image image, Point coords) {
+  const uint8_t *plane = image_plane(image, PLANE_LIGHTNESS);
+  if (plane != NULL) {
+    return get_plane_value(image, plane, coords);
+  }
+
   Pixel p = get_pixel_components(image, coords);
   return min3(p.r, p.g, p.b);
 }
@@ -121,6 +439,11 @@ uint8_t get_pixel_lightness(Image image, Point coords) {
  * pixel, or UINT8_MAX if the coordinates are outside the image
  */
 uint8_t get_pixel_darkness_inverse(Image image, Point coords) {
+  const uint8_t *plane = image_plane(image, PLANE_DARKNESS_INVERSE);
+  if (plane != NULL) {
+    return get_plane_value(image, plane, coords);
+  }
+
   Pixel p = get_pixel_components(image, coords);
   return max3(p.r, p.g, p.b);
 }
@@ -129,45 +452,12 @@ uint8_t get_pixel_darkness_inverse(Image image, Point coords) {
  * Sets the color/grayscale value of a single pixel.
  */
 void set_pixel(Image image, Point coords, Pixel pixel) {
-  uint8_t *pix;
-
   if (!point_in_rectangle(coords, full_image(image))) {
     return;
   }
 
-  bool pixel_black = pixel_grayscale(pixel) < image.abs_black_threshold;
-
-  switch (image.frame->format) {
-  case AV_PIX_FMT_GRAY8:
-    pix =
-        image.frame->data[0] + (coords.y * image.frame->linesize[0] + coords.x);
-    *pix = pixel_grayscale(pixel);
-    break;
-  case AV_PIX_FMT_Y400A:
-    pix = image.frame->data[0] +
-          (coords.y * image.frame->linesize[0] + coords.x * 2);
-    pix[0] = pixel_grayscale(pixel);
-    pix[1] = 0xFF; // no alpha.
-    break;
-  case AV_PIX_FMT_RGB24:
-    pix = image.frame->data[0] +
-          (coords.y * image.frame->linesize[0] + coords.x * 3);
-    pix[0] = pixel.r;
-    pix[1] = pixel.g;
-    pix[2] = pixel.b;
-    break;
-  case AV_PIX_FMT_MONOWHITE:
-    pixel_black = !pixel_black; // reverse compared to following case
-  case AV_PIX_FMT_MONOBLACK:
-    pix = image.frame->data[0] +
-          (coords.y * image.frame->linesize[0] + coords.x / 8);
-    if (!pixel_black) {
-      *pix = *pix | (128 >> (coords.x % 8));
-    } else if (pixel_black) {
-      *pix = *pix & ~(128 >> (coords.x % 8));
-    }
-    break;
-  default:
-    errOutput("unknown pixel format.");
-  }
+  ImageRows rows = image_rows(image);
+  rows.kernels->set(image_row(rows, coords.y), coords.x, pixel,
+                    rows.abs_black_threshold);
+  mark_image_changed(image, (Rectangle){{coords, coords}});
 }
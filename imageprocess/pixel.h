@@ -5,6 +5,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "imageprocess/image.h"
@@ -17,3 +18,62 @@ uint8_t get_pixel_grayscale(Image image, Point coords);
 uint8_t get_pixel_lightness(Image image, Point coords);
 uint8_t get_pixel_darkness_inverse(Image image, Point coords);
 void set_pixel(Image image, Point coords, Pixel pixel);
+
+// Format-specialized kernels operating on a span of a single row.
+//
+// Every function receives the base pointer of the row, the first column of the
+// span and (for the span functions) the number of pixels in it. No bounds
+// checking is done: the caller is responsible for only passing spans within a
+// validated (clipped) rectangle.
+typedef struct {
+  Pixel (*get)(const uint8_t *row, int32_t x);
+  void (*set)(uint8_t *row, int32_t x, Pixel pixel,
+              uint8_t abs_black_threshold);
+
+  void (*read_pixels)(const uint8_t *row, int32_t x, int32_t count,
+                      Pixel *out);
+  void (*write_pixels)(uint8_t *row, int32_t x, int32_t count,
+                       const Pixel *in, uint8_t abs_black_threshold);
+
+  void (*read_grayscale)(const uint8_t *row, int32_t x, int32_t count,
+                         uint8_t *out);
+  void (*read_lightness)(const uint8_t *row, int32_t x, int32_t count,
+                         uint8_t *out);
+  void (*read_darkness_inverse)(const uint8_t *row, int32_t x, int32_t count,
+                                uint8_t *out);
+
+  // Sums of the derived values over the span.
+  uint64_t (*sum_grayscale)(const uint8_t *row, int32_t x, int32_t count);
+  uint64_t (*sum_lightness)(const uint8_t *row, int32_t x, int32_t count);
+  uint64_t (*sum_darkness_inverse)(const uint8_t *row, int32_t x,
+                                   int32_t count);
+
+  // Counts the pixels whose grayscale is within [min, max], optionally
+  // clearing them to white.
+  uint64_t (*count_grayscale_within)(uint8_t *row, int32_t x, int32_t count,
+                                     uint8_t min, uint8_t max, bool clear);
+
+  void (*fill)(uint8_t *row, int32_t x, int32_t count, Pixel color,
+               uint8_t abs_black_threshold);
+  // Copies a span between two rows of the same pixel format, which must not
+  // overlap.
+  void (*copy)(uint8_t *target_row, int32_t target_x,
+               const uint8_t *source_row, int32_t source_x, int32_t count);
+} PixelRowKernels;
+
+const PixelRowKernels *pixel_row_kernels(int pixel_format);
+
+// Row-level view of an image: the kernel table for its pixel format, together
+// with the base pointer and stride of its pixel data.
+typedef struct {
+  const PixelRowKernels *kernels;
+  uint8_t *data;
+  ptrdiff_t linesize;
+  uint8_t abs_black_threshold;
+} ImageRows;
+
+ImageRows image_rows(Image image);
+
+static inline uint8_t *image_row(ImageRows rows, int32_t y) {
+  return rows.data + y * rows.linesize;
+}
@@ -0,0 +1,147 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "imageprocess/pixel.h"
+#include "imageprocess/planes.h"
+#include "lib/logging.h"
+#include "lib/math_util.h"
+
+// A plane is computed once the single-pixel reads of its derivation add up to
+// this fraction of the image.
+#define PLANE_READS_DIVISOR 8
+
+// Writes covering more than this fraction of the image drop the planes rather
+// than refreshing values that might not be read again.
+#define PLANE_REFRESH_DIVISOR 4
+
+struct PixelPlanes {
+  RectangleSize size;
+  uint8_t *planes[PLANE_KINDS];
+  uint64_t reads[PLANE_KINDS];
+};
+
+PixelPlanes *pixel_planes_create(RectangleSize size) {
+  PixelPlanes *planes = calloc(1, sizeof(PixelPlanes));
+  if (planes == NULL) {
+    errOutput("unable to allocate pixel planes.");
+  }
+
+  planes->size = size;
+  return planes;
+}
+
+void pixel_planes_free(PixelPlanes **planes) {
+  if (*planes == NULL) {
+    return;
+  }
+
+  for (int kind = 0; kind < PLANE_KINDS; kind++) {
+    free((*planes)->planes[kind]);
+  }
+  free(*planes);
+  *planes = NULL;
+}
+
+static void read_plane_row(ImageRows rows, PlaneKind kind, int32_t y,
+                           int32_t x, int32_t count, uint8_t *out) {
+  const uint8_t *row = image_row(rows, y);
+
+  switch (kind) {
+  case PLANE_GRAYSCALE:
+    rows.kernels->read_grayscale(row, x, count, out);
+    break;
+  case PLANE_LIGHTNESS:
+    rows.kernels->read_lightness(row, x, count, out);
+    break;
+  case PLANE_DARKNESS_INVERSE:
+    rows.kernels->read_darkness_inverse(row, x, count, out);
+    break;
+  case PLANE_KINDS:
+    break;
+  }
+}
+
+static bool has_planes(const PixelPlanes *planes) {
+  for (int kind = 0; kind < PLANE_KINDS; kind++) {
+    if (planes->planes[kind] != NULL) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void pixel_planes_update(Image image, Rectangle input_area) {
+  PixelPlanes *planes = image.planes;
+  if (planes == NULL || !has_planes(planes)) {
+    return;
+  }
+
+  Rectangle area = clip_rectangle(image, input_area);
+  const int32_t width = area.vertex[1].x - area.vertex[0].x + 1;
+  const int32_t height = area.vertex[1].y - area.vertex[0].y + 1;
+  if (width <= 0 || height <= 0) {
+    return;
+  }
+
+  const uint64_t image_pixels =
+      (uint64_t)planes->size.width * planes->size.height;
+  const bool refresh =
+      (uint64_t)width * height <= image_pixels / PLANE_REFRESH_DIVISOR;
+  ImageRows rows = image_rows(image);
+
+  for (int kind = 0; kind < PLANE_KINDS; kind++) {
+    uint8_t *plane = planes->planes[kind];
+    if (plane == NULL) {
+      continue;
+    }
+
+    if (!refresh) {
+      free(plane);
+      planes->planes[kind] = NULL;
+      planes->reads[kind] = 0;
+      continue;
+    }
+
+    for (int32_t y = area.vertex[0].y; y <= area.vertex[1].y; y++) {
+      read_plane_row(rows, kind, y, area.vertex[0].x, width,
+                     plane + (ptrdiff_t)y * planes->size.width +
+                         area.vertex[0].x);
+    }
+  }
+}
+
+const uint8_t *image_plane(Image image, PlaneKind kind) {
+  PixelPlanes *planes = image.planes;
+  if (planes == NULL) {
+    return NULL;
+  }
+
+  if (planes->planes[kind] != NULL) {
+    return planes->planes[kind];
+  }
+
+  const uint64_t image_pixels =
+      (uint64_t)planes->size.width * planes->size.height;
+  if (++planes->reads[kind] < image_pixels / PLANE_READS_DIVISOR) {
+    return NULL;
+  }
+
+  uint8_t *plane = malloc(image_pixels);
+  if (plane == NULL) {
+    errOutput("unable to allocate pixel plane.");
+  }
+
+  ImageRows rows = image_rows(image);
+  for (int32_t y = 0; y < planes->size.height; y++) {
+    read_plane_row(rows, kind, y, 0, planes->size.width,
+                   plane + (ptrdiff_t)y * planes->size.width);
+  }
+
+  planes->planes[kind] = plane;
+  return plane;
+}
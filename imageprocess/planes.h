@@ -0,0 +1,35 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdint.h>
+
+#include "imageprocess/image.h"
+#include "imageprocess/primitives.h"
+
+// Per-image cache of 8-bit planes holding one derived value per pixel, so that
+// stages reading the same derivation over and over do not recompute it from
+// the pixel format each time.
+//
+// A plane is only computed (in a single pass over the image) once enough
+// single-pixel reads of its derivation were requested to pay for it. Small
+// writes to the image are applied to the computed planes as well, larger
+// ones drop them.
+
+typedef enum {
+  PLANE_GRAYSCALE,
+  PLANE_LIGHTNESS,
+  PLANE_DARKNESS_INVERSE,
+  PLANE_KINDS,
+} PlaneKind;
+
+PixelPlanes *pixel_planes_create(RectangleSize size);
+void pixel_planes_free(PixelPlanes **planes);
+void pixel_planes_update(Image image, Rectangle area);
+
+// Returns the plane for the given derivation, with one byte per pixel and a
+// stride equal to the image width, or NULL if it is not (yet) worth computing.
+// Every call counts as a single-pixel read.
+const uint8_t *image_plane(Image image, PlaneKind kind);
@@ -122,6 +122,16 @@ bool rectangles_overlap(Rectangle first_input, Rectangle second_input) {
          point_in_rectangle(first.vertex[1], second);
 }
 
+bool rectangles_intersect(Rectangle first_input, Rectangle second_input) {
+  Rectangle first = normalize_rectangle(first_input);
+  Rectangle second = normalize_rectangle(second_input);
+
+  return first.vertex[0].x <= second.vertex[1].x &&
+         second.vertex[0].x <= first.vertex[1].x &&
+         first.vertex[0].y <= second.vertex[1].y &&
+         second.vertex[0].y <= first.vertex[1].y;
+}
+
 bool rectangle_overlap_any(Rectangle first_input, size_t count,
                            Rectangle *rectangles) {
   for (size_t n = 0; n < count; n++) {
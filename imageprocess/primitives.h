@@ -97,6 +97,9 @@ bool point_in_rectangles_any(Point p, size_t count,
                              const Rectangle rectangles[]);
 bool rectangle_in_rectangle(Rectangle inner, Rectangle outer);
 bool rectangles_overlap(Rectangle first_input, Rectangle second_input);
+// Whether the rectangles share any point, including when they cross each other
+// without either holding a vertex of the other.
+bool rectangles_intersect(Rectangle first_input, Rectangle second_input);
 bool rectangle_overlap_any(Rectangle first_input, size_t count,
                            Rectangle *rectangles);
 
@@ -20,19 +20,32 @@ void verboseLog(VerboseLevel level, const char *fmt, ...) {
   va_end(vl);
 }
 
+static void printError(const char *fmt, va_list vl) {
+  fprintf(stderr, "unpaper: error: ");
+  vfprintf(stderr, fmt, vl);
+  fprintf(stderr, "\nTry 'man unpaper' for more information.\n");
+}
+
 /**
  * Print an error and exit process
  */
 void errOutput(const char *fmt, ...) {
   va_list vl;
 
-  fprintf(stderr, "unpaper: error: ");
-
   va_start(vl, fmt);
-  vfprintf(stderr, fmt, vl);
+  printError(fmt, vl);
   va_end(vl);
 
-  fprintf(stderr, "\nTry 'man unpaper' for more information.\n");
-
   exit(1);
 }
+
+/**
+ * Print an error, without exiting
+ */
+void errReport(const char *fmt, ...) {
+  va_list vl;
+
+  va_start(vl, fmt);
+  printError(fmt, vl);
+  va_end(vl);
+}
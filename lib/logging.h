@@ -20,3 +20,5 @@ void verboseLog(VerboseLevel level, const char *fmt, ...)
     __attribute__((format(printf, 2, 3)));
 void errOutput(const char *fmt, ...) __attribute__((format(printf, 1, 2)))
 __attribute__((noreturn));
+// Like errOutput(), but leaves it to the caller to fail.
+void errReport(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
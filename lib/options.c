@@ -23,6 +23,12 @@ void options_init(Options *o) {
       .overwrite_output = false,
       .multiple_sheets = true,
       .output_pixel_format = AV_PIX_FMT_NONE,
+      .jobs = 1,
+      .threads = 1,
+      .read_ahead = 0,
+      .write_behind = 0,
+      .timings_file = NULL,
+      .input_format = NULL,
 
       .layout = LAYOUT_SINGLE,
       .start_sheet = 1,
@@ -57,6 +63,11 @@ void options_init(Options *o) {
       .pre_wipes = (Wipes){.count = 0},
       .wipes = (Wipes){.count = 0},
       .post_wipes = (Wipes){.count = 0},
+      .middle_wipe = {0, 0},
+
+      .points_count = 0,
+      .masks_count = 0,
+      .pre_masks_count = 0,
 
       .pre_shift = (Delta){0, 0},
       .post_shift = (Delta){0, 0},
@@ -395,3 +406,34 @@ bool parse_interpolate(const char *str, Interpolation *interpolation) {
 
   return false;
 }
+
+static const struct {
+  const char name[12];
+  DeskewMethod method;
+} DESKEW_METHODS[] = {
+    {"edges", DESKEW_METHOD_EDGES},
+    {"projection", DESKEW_METHOD_PROJECTION},
+};
+
+bool parse_deskew_method(const char *str, DeskewMethod *method) {
+  for (size_t j = 0; j < sizeof(DESKEW_METHODS) / sizeof(DESKEW_METHODS[0]);
+       j++) {
+    if (strcasecmp(str, DESKEW_METHODS[j].name) == 0) {
+      *method = DESKEW_METHODS[j].method;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+const char *deskew_method_to_string(DeskewMethod method) {
+  for (size_t j = 0; j < sizeof(DESKEW_METHODS) / sizeof(DESKEW_METHODS[0]);
+       j++) {
+    if (DESKEW_METHODS[j].method == method) {
+      return DESKEW_METHODS[j].name;
+    }
+  }
+
+  return "unknown";
+}
@@ -21,6 +21,18 @@ typedef struct {
   bool overwrite_output;
   bool multiple_sheets;
   enum AVPixelFormat output_pixel_format;
+  // Number of sheets processed concurrently.
+  int jobs;
+  // Number of threads the filters of all sheets split their work between.
+  int threads;
+  // Number of sheets loaded ahead of the one about to be processed.
+  int read_ahead;
+  // Number of output pages waiting to be saved while processing goes on.
+  int write_behind;
+  // File to write the timings of the processing stages to, if any.
+  const char *timings_file;
+  // Format of all the input files, if declared rather than probed.
+  const char *input_format;
 
   Layout layout;
   int start_sheet;
@@ -52,6 +64,16 @@ typedef struct {
   Wipes pre_wipes;
   Wipes wipes;
   Wipes post_wipes;
+  int32_t middle_wipe[2];
+
+  // Explicitly set mask detection points and masks. Sheets without explicit
+  // points get them from the layout.
+  size_t points_count;
+  Point points[MAX_POINTS];
+  size_t masks_count;
+  Rectangle masks[MAX_MASKS];
+  size_t pre_masks_count;
+  Rectangle pre_masks[MAX_MASKS];
 
   Delta pre_shift;
   Delta post_shift;
@@ -125,3 +147,6 @@ int print_edges(Edges edges);
 bool parse_layout(const char *str, Layout *layout);
 
 bool parse_interpolate(const char *str, Interpolation *interpolation);
+
+bool parse_deskew_method(const char *str, DeskewMethod *method);
+const char *deskew_method_to_string(DeskewMethod method);
@@ -0,0 +1,308 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lib/logging.h"
+#include "lib/math_util.h"
+#include "lib/tiles.h"
+#include "lib/workers.h"
+
+// Each thread taking part in a run owns a range of tile indexes, packed as
+// first << 32 | end so that it can be shrunk from either side atomically: the
+// owner takes tiles from the front, other threads steal from the back.
+typedef struct TileRun {
+  TileGrid grid;
+  TileTask task;
+  void *arg;
+  uint32_t columns;
+
+  size_t ranges_count;
+  _Atomic uint64_t *ranges;
+  atomic_size_t joined;
+
+  // Protected by the scheduler mutex.
+  int helpers;
+  uint64_t helpers_cpu_ns;
+  struct TileRun *next;
+} TileRun;
+
+static struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t posted;
+  pthread_cond_t left;
+  bool stopping;
+
+  int threads;
+  pthread_t *helpers;
+  // Runs that might still have tiles left to claim.
+  TileRun *runs;
+} scheduler = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .posted = PTHREAD_COND_INITIALIZER,
+    .left = PTHREAD_COND_INITIALIZER,
+    .threads = 1,
+};
+
+// CPU time the helpers spent on the runs the thread started, including that
+// spent in turn on the runs they started from within those.
+static _Thread_local uint64_t helped_cpu_ns;
+
+uint64_t tile_cpu_time_ns(void) {
+  struct timespec cpu;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+
+  return (uint64_t)cpu.tv_sec * 1000000000 + cpu.tv_nsec + helped_cpu_ns;
+}
+
+static inline uint64_t pack_range(uint32_t first, uint32_t end) {
+  return (uint64_t)first << 32 | end;
+}
+
+static inline uint32_t range_first(uint64_t range) { return range >> 32; }
+
+static inline uint32_t range_end(uint64_t range) { return (uint32_t)range; }
+
+static void run_tile(const TileRun *run, uint32_t index) {
+  const TileGrid grid = run->grid;
+  const Point origin = {
+      grid.area.vertex[0].x + (index % run->columns) * grid.tile_size.width,
+      grid.area.vertex[0].y + (index / run->columns) * grid.tile_size.height,
+  };
+  const Rectangle area = {{
+      origin,
+      {min(origin.x + grid.tile_size.width - 1, grid.area.vertex[1].x),
+       min(origin.y + grid.tile_size.height - 1, grid.area.vertex[1].y)},
+  }};
+  const Rectangle reach = {{
+      {max(area.vertex[0].x - grid.halo.horizontal, grid.area.vertex[0].x),
+       max(area.vertex[0].y - grid.halo.vertical, grid.area.vertex[0].y)},
+      {min(area.vertex[1].x + grid.halo.horizontal, grid.area.vertex[1].x),
+       min(area.vertex[1].y + grid.halo.vertical, grid.area.vertex[1].y)},
+  }};
+
+  run->task(run->arg, (Tile){area, reach});
+}
+
+static bool take_front(_Atomic uint64_t *range, uint32_t *index) {
+  uint64_t current = atomic_load(range);
+
+  do {
+    if (range_first(current) >= range_end(current)) {
+      return false;
+    }
+  } while (!atomic_compare_exchange_weak(
+      range, &current,
+      pack_range(range_first(current) + 1, range_end(current))));
+
+  *index = range_first(current);
+  return true;
+}
+
+// Steals the back half of the fullest range. Returns the first and end index
+// of the stolen tiles packed the same way.
+static uint64_t steal(TileRun *run) {
+  while (true) {
+    size_t victim = 0;
+    uint32_t most = 0;
+    uint64_t current = 0;
+
+    for (size_t i = 0; i < run->ranges_count; i++) {
+      const uint64_t range = atomic_load(&run->ranges[i]);
+      if (range_first(range) >= range_end(range)) {
+        continue;
+      }
+      if (range_end(range) - range_first(range) > most) {
+        victim = i;
+        most = range_end(range) - range_first(range);
+        current = range;
+      }
+    }
+    if (most == 0) {
+      return 0;
+    }
+
+    const uint32_t middle = range_end(current) - (most + 1) / 2;
+    if (atomic_compare_exchange_strong(
+            &run->ranges[victim], &current,
+            pack_range(range_first(current), middle))) {
+      return pack_range(middle, range_end(current));
+    }
+  }
+}
+
+static void work_on(TileRun *run) {
+  const size_t own = atomic_fetch_add(&run->joined, 1);
+  uint32_t index;
+
+  // Threads joining a run after all the ranges were handed out have none of
+  // their own, and run whatever they steal right away.
+  if (own >= run->ranges_count) {
+    uint64_t stolen;
+    while ((stolen = steal(run)) != 0) {
+      for (index = range_first(stolen); index < range_end(stolen); index++) {
+        run_tile(run, index);
+      }
+    }
+    return;
+  }
+
+  _Atomic uint64_t *range = &run->ranges[own];
+  while (true) {
+    while (take_front(range, &index)) {
+      run_tile(run, index);
+    }
+
+    const uint64_t stolen = steal(run);
+    if (stolen == 0) {
+      return;
+    }
+
+    // Keep the stolen tiles in the own range, so that they can in turn be
+    // stolen by others running out of work.
+    atomic_store(range, stolen);
+  }
+}
+
+static void unlist_run(TileRun *run) {
+  for (TileRun **p = &scheduler.runs; *p != NULL; p = &(*p)->next) {
+    if (*p == run) {
+      *p = run->next;
+      return;
+    }
+  }
+}
+
+static void *helper_main(void *arg) {
+  pthread_mutex_lock(&scheduler.mutex);
+  while (!scheduler.stopping) {
+    TileRun *run = scheduler.runs;
+    if (run == NULL) {
+      pthread_cond_wait(&scheduler.posted, &scheduler.mutex);
+      continue;
+    }
+
+    run->helpers++;
+    pthread_mutex_unlock(&scheduler.mutex);
+    const uint64_t started = tile_cpu_time_ns();
+    work_on(run);
+    const uint64_t spent = tile_cpu_time_ns() - started;
+    pthread_mutex_lock(&scheduler.mutex);
+
+    // All the tiles of the run have been claimed by now.
+    unlist_run(run);
+    run->helpers_cpu_ns += spent;
+    run->helpers--;
+    pthread_cond_broadcast(&scheduler.left);
+  }
+  pthread_mutex_unlock(&scheduler.mutex);
+
+  return NULL;
+}
+
+void tile_threads_start(int threads) {
+  if (threads <= 1) {
+    return;
+  }
+
+  scheduler.helpers = calloc(threads - 1, sizeof(pthread_t));
+  if (scheduler.helpers == NULL) {
+    errOutput("unable to allocate tile threads.");
+  }
+
+  pthread_attr_t attr;
+  if (pthread_attr_init(&attr) != 0 ||
+      pthread_attr_setstacksize(&attr, PROCESSING_THREAD_STACK_SIZE) != 0) {
+    errOutput("unable to set up tile threads.");
+  }
+  for (; scheduler.threads < threads; scheduler.threads++) {
+    if (pthread_create(&scheduler.helpers[scheduler.threads - 1], &attr,
+                       helper_main, NULL) != 0) {
+      errOutput("unable to start tile thread.");
+    }
+  }
+  pthread_attr_destroy(&attr);
+}
+
+void tile_threads_stop(void) {
+  pthread_mutex_lock(&scheduler.mutex);
+  scheduler.stopping = true;
+  pthread_cond_broadcast(&scheduler.posted);
+  pthread_mutex_unlock(&scheduler.mutex);
+
+  for (int i = 0; i < scheduler.threads - 1; i++) {
+    pthread_join(scheduler.helpers[i], NULL);
+  }
+
+  free(scheduler.helpers);
+  scheduler.helpers = NULL;
+  scheduler.threads = 1;
+  scheduler.stopping = false;
+}
+
+TileGrid row_bands(Rectangle area) {
+  return (TileGrid){
+      .area = area,
+      .tile_size = {size_of_rectangle(area).width, TILE_BAND_HEIGHT},
+  };
+}
+
+void run_tiles(TileGrid grid, TileTask task, void *arg) {
+  if (grid.area.vertex[0].x > grid.area.vertex[1].x ||
+      grid.area.vertex[0].y > grid.area.vertex[1].y) {
+    return;
+  }
+
+  const RectangleSize size = size_of_rectangle(grid.area);
+  TileRun run = {
+      .grid = grid,
+      .task = task,
+      .arg = arg,
+      .columns = (size.width + grid.tile_size.width - 1) / grid.tile_size.width,
+  };
+  const uint32_t rows =
+      (size.height + grid.tile_size.height - 1) / grid.tile_size.height;
+  const uint32_t tiles = run.columns * rows;
+
+  if (scheduler.threads <= 1 || tiles == 1) {
+    for (uint32_t index = 0; index < tiles; index++) {
+      run_tile(&run, index);
+    }
+    return;
+  }
+
+  // Hand out the tiles in contiguous shares, so that neighboring tiles tend
+  // to be run by the same thread.
+  _Atomic uint64_t ranges[scheduler.threads];
+  run.ranges = ranges;
+  run.ranges_count = scheduler.threads;
+  for (size_t i = 0; i < run.ranges_count; i++) {
+    atomic_init(&ranges[i],
+                pack_range((uint64_t)tiles * i / run.ranges_count,
+                           (uint64_t)tiles * (i + 1) / run.ranges_count));
+  }
+  atomic_init(&run.joined, 0);
+
+  pthread_mutex_lock(&scheduler.mutex);
+  run.next = scheduler.runs;
+  scheduler.runs = &run;
+  pthread_cond_broadcast(&scheduler.posted);
+  pthread_mutex_unlock(&scheduler.mutex);
+
+  work_on(&run);
+
+  pthread_mutex_lock(&scheduler.mutex);
+  unlist_run(&run);
+  while (run.helpers > 0) {
+    pthread_cond_wait(&scheduler.left, &scheduler.mutex);
+  }
+  pthread_mutex_unlock(&scheduler.mutex);
+
+  helped_cpu_ns += run.helpers_cpu_ns;
+}
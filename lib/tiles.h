@@ -0,0 +1,58 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdint.h>
+
+#include "imageprocess/primitives.h"
+
+// Splits a pass over an image into tiles, which a shared set of threads runs
+// concurrently, each starting on its own share of the tiles and stealing from
+// the others' once done with it.
+//
+// Tasks must only write to their own tile, and not through the derived data
+// cached with the image (see uncached_image()), so that the result does not
+// depend on how the tiles end up distributed. As pixels of bilevel images
+// share their bytes with their neighbors on the same row, tiles writing to an
+// image should span whole rows.
+
+typedef struct {
+  // The area covered by the whole grid.
+  Rectangle area;
+  // The size of each tile; those at the right and bottom edges of the area
+  // are cut down to it.
+  RectangleSize tile_size;
+  // How far beyond its own area a task needs to read, on either side.
+  Delta halo;
+} TileGrid;
+
+typedef struct {
+  // The area the task is to process.
+  Rectangle area;
+  // The area grown by the halo of the grid, within the area of the grid.
+  Rectangle reach;
+} Tile;
+
+typedef void (*TileTask)(void *arg, Tile tile);
+
+// Height of the row bands passes without a better choice split images into.
+#define TILE_BAND_HEIGHT 32
+
+// Returns a grid of whole-row bands over the area, without any halo.
+TileGrid row_bands(Rectangle area);
+
+// Starts the threads the tiles of all the passes are shared between, the
+// calling thread of each pass included. With a single thread, the tiles are
+// run in order on the calling thread.
+void tile_threads_start(int threads);
+void tile_threads_stop(void);
+
+// Runs the task over all the tiles of the grid, returning once all of them
+// are done. Can be called from several threads at once.
+void run_tiles(TileGrid grid, TileTask task, void *arg);
+
+// Returns the CPU time used by the calling thread, in nanoseconds, together
+// with the time the other threads spent on the tiles of the runs it started.
+uint64_t tile_cpu_time_ns(void);
@@ -0,0 +1,197 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lib/logging.h"
+#include "lib/tiles.h"
+#include "lib/timings.h"
+
+typedef struct {
+  uint64_t runs;
+  uint64_t wall_ns;
+  uint64_t cpu_ns;
+  uint64_t pixels;
+  uint64_t count;
+} StageTiming;
+
+static const struct {
+  const char *name;
+  // Name of the stage-specific counter, if any.
+  const char *counter;
+} stages[STAGES_COUNT] = {
+    [STAGE_LOAD] = {"load", NULL},
+    [STAGE_PRE] = {"pre", NULL},
+    [STAGE_STRETCH] = {"stretch", NULL},
+    [STAGE_BLACKFILTER] = {"blackfilter", "flood_fills"},
+    [STAGE_NOISEFILTER] = {"noisefilter", "clusters"},
+    [STAGE_BLURFILTER] = {"blurfilter", "deleted_pixels"},
+    [STAGE_MASK_SCAN] = {"mask_scan", "masks"},
+    [STAGE_MASKING] = {"masking", "masks"},
+    [STAGE_GRAYFILTER] = {"grayfilter", "deleted_pixels"},
+    [STAGE_DESKEW_DETECT] = {"deskew_detect", NULL},
+    [STAGE_DESKEW_ROTATE] = {"deskew_rotate", "rotations"},
+    [STAGE_CENTERING] = {"centering", NULL},
+    [STAGE_BORDER_SCAN] = {"border_scan", NULL},
+    [STAGE_POST] = {"post", NULL},
+    [STAGE_SAVE] = {"save", "pages"},
+};
+
+struct SheetTimings {
+  int nr;
+  atomic_int holders;
+  StageTiming stages[STAGES_COUNT];
+};
+
+static struct {
+  pthread_mutex_t mutex;
+  FILE *file;
+  struct timespec started;
+
+  // Totals of all the sheets written out so far.
+  uint64_t sheets;
+  StageTiming stages[STAGES_COUNT];
+} report = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uint64_t elapsed_ns(struct timespec from, struct timespec to) {
+  return (uint64_t)(to.tv_sec - from.tv_sec) * 1000000000 + to.tv_nsec -
+         from.tv_nsec;
+}
+
+static void write_stages(const StageTiming stage_timings[]) {
+  bool first = true;
+
+  fputs("\"stages\":{", report.file);
+  for (Stage stage = 0; stage < STAGES_COUNT; stage++) {
+    const StageTiming *timing = &stage_timings[stage];
+    if (timing->runs == 0) {
+      continue;
+    }
+
+    fprintf(report.file,
+            "%s\"%s\":{\"runs\":%" PRIu64 ",\"wall_ms\":%.3f,"
+            "\"cpu_ms\":%.3f,\"pixels\":%" PRIu64,
+            first ? "" : ",", stages[stage].name, timing->runs,
+            timing->wall_ns / 1e6, timing->cpu_ns / 1e6, timing->pixels);
+    if (stages[stage].counter != NULL) {
+      fprintf(report.file, ",\"%s\":%" PRIu64, stages[stage].counter,
+              timing->count);
+    }
+    fputc('}', report.file);
+    first = false;
+  }
+  fputc('}', report.file);
+}
+
+bool timings_open(const char *filename) {
+  report.file = fopen(filename, "w");
+  if (report.file == NULL) {
+    return false;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &report.started);
+  return true;
+}
+
+void timings_close(void) {
+  if (report.file == NULL) {
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  fprintf(report.file,
+          "{\"summary\":true,\"sheets\":%" PRIu64 ",\"wall_ms\":%.3f,",
+          report.sheets, elapsed_ns(report.started, now) / 1e6);
+  write_stages(report.stages);
+  fputs("}\n", report.file);
+
+  if (fclose(report.file) != 0) {
+    errReport("unable to write timings.");
+  }
+  report.file = NULL;
+}
+
+SheetTimings *sheet_timings_create(int nr) {
+  if (report.file == NULL) {
+    return NULL;
+  }
+
+  SheetTimings *sheet = calloc(1, sizeof(SheetTimings));
+  if (sheet == NULL) {
+    errOutput("unable to allocate sheet timings.");
+  }
+  sheet->nr = nr;
+  atomic_init(&sheet->holders, 1);
+
+  return sheet;
+}
+
+void sheet_timings_hold(SheetTimings *timings) {
+  if (timings != NULL) {
+    atomic_fetch_add(&timings->holders, 1);
+  }
+}
+
+void sheet_timings_release(SheetTimings **sheet) {
+  SheetTimings *s = *sheet;
+  *sheet = NULL;
+
+  if (s == NULL || atomic_fetch_sub(&s->holders, 1) > 1) {
+    return;
+  }
+
+  pthread_mutex_lock(&report.mutex);
+  fprintf(report.file, "{\"sheet\":%d,", s->nr);
+  write_stages(s->stages);
+  fputs("}\n", report.file);
+
+  report.sheets++;
+  for (Stage stage = 0; stage < STAGES_COUNT; stage++) {
+    report.stages[stage].runs += s->stages[stage].runs;
+    report.stages[stage].wall_ns += s->stages[stage].wall_ns;
+    report.stages[stage].cpu_ns += s->stages[stage].cpu_ns;
+    report.stages[stage].pixels += s->stages[stage].pixels;
+    report.stages[stage].count += s->stages[stage].count;
+  }
+  pthread_mutex_unlock(&report.mutex);
+
+  free(s);
+}
+
+StageClock stage_start(void) {
+  StageClock started = {0};
+
+  if (report.file != NULL) {
+    clock_gettime(CLOCK_MONOTONIC, &started.wall);
+    started.cpu_ns = tile_cpu_time_ns();
+  }
+
+  return started;
+}
+
+void stage_record(SheetTimings *timings, Stage stage, StageClock start,
+                  uint64_t pixels, uint64_t count) {
+  if (timings == NULL) {
+    return;
+  }
+
+  StageClock now;
+  clock_gettime(CLOCK_MONOTONIC, &now.wall);
+  now.cpu_ns = tile_cpu_time_ns();
+
+  StageTiming *timing = &timings->stages[stage];
+  timing->runs++;
+  timing->wall_ns += elapsed_ns(start.wall, now.wall);
+  timing->cpu_ns += now.cpu_ns - start.cpu_ns;
+  timing->pixels += pixels;
+  timing->count += count;
+}
@@ -0,0 +1,62 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+// Per-stage timings of the processing of each sheet (--timings).
+//
+// Each stage records the wall time and the CPU time of the thread running it,
+// the latter including the time the tile threads spent helping that thread
+// (see tile_cpu_time_ns()) but not that of other sheets processed meanwhile,
+// the number of pixels it worked on, and a stage-specific counter (e.g. the
+// flood-fills of the blackfilter). The timings of a sheet are written out as
+// a single JSON line once all its pages are saved, and the totals of the whole
+// run as a last line when the timings are closed.
+
+typedef enum {
+  STAGE_LOAD,
+  STAGE_PRE,
+  STAGE_STRETCH,
+  STAGE_BLACKFILTER,
+  STAGE_NOISEFILTER,
+  STAGE_BLURFILTER,
+  STAGE_MASK_SCAN,
+  STAGE_MASKING,
+  STAGE_GRAYFILTER,
+  STAGE_DESKEW_DETECT,
+  STAGE_DESKEW_ROTATE,
+  STAGE_CENTERING,
+  STAGE_BORDER_SCAN,
+  STAGE_POST,
+  STAGE_SAVE,
+  STAGES_COUNT,
+} Stage;
+
+typedef struct {
+  struct timespec wall;
+  uint64_t cpu_ns;
+} StageClock;
+
+typedef struct SheetTimings SheetTimings;
+
+// Opens the file to write the timings to. Until then, no sheet timings are
+// created and recording stages does nothing.
+bool timings_open(const char *filename);
+// Writes the totals of the run, and closes the file.
+void timings_close(void);
+
+// Returns NULL unless the timings are open.
+SheetTimings *sheet_timings_create(int nr);
+// Each holder of the timings of a sheet releases them once done recording;
+// the last one to do so writes them out.
+void sheet_timings_hold(SheetTimings *timings);
+void sheet_timings_release(SheetTimings **timings);
+
+StageClock stage_start(void);
+void stage_record(SheetTimings *timings, Stage stage, StageClock start,
+                  uint64_t pixels, uint64_t count);
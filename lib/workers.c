@@ -0,0 +1,242 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib/logging.h"
+#include "lib/workers.h"
+
+typedef struct {
+  WorkerTask task;
+  void *arg;
+} QueuedTask;
+
+struct WorkerPool {
+  int workers_count;
+  pthread_t *workers;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t queued;
+  pthread_cond_t dequeued;
+  bool stopping;
+
+  // Ring buffer of the tasks waiting for a worker.
+  QueuedTask *queue;
+  size_t backlog;
+  size_t first;
+  size_t count;
+};
+
+static void *worker_main(void *arg) {
+  WorkerPool *pool = arg;
+
+  pthread_mutex_lock(&pool->mutex);
+  while (true) {
+    while (pool->count == 0 && !pool->stopping) {
+      pthread_cond_wait(&pool->queued, &pool->mutex);
+    }
+    if (pool->count == 0) {
+      break;
+    }
+
+    QueuedTask queued = pool->queue[pool->first];
+    pool->first = (pool->first + 1) % pool->backlog;
+    pool->count--;
+    pthread_cond_signal(&pool->dequeued);
+
+    pthread_mutex_unlock(&pool->mutex);
+    queued.task(queued.arg);
+    pthread_mutex_lock(&pool->mutex);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  return NULL;
+}
+
+WorkerPool *worker_pool_create(int workers, size_t backlog) {
+  WorkerPool *pool = calloc(1, sizeof(WorkerPool));
+  if (pool == NULL) {
+    errOutput("unable to allocate worker pool.");
+  }
+
+  if (workers < 1) {
+    return pool;
+  }
+
+  pool->backlog = backlog > 0 ? backlog : 1;
+  pool->queue = calloc(pool->backlog, sizeof(QueuedTask));
+  pool->workers = calloc(workers, sizeof(pthread_t));
+  if (pool->queue == NULL || pool->workers == NULL) {
+    errOutput("unable to allocate worker pool.");
+  }
+
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->queued, NULL);
+  pthread_cond_init(&pool->dequeued, NULL);
+
+  pthread_attr_t attr;
+  if (pthread_attr_init(&attr) != 0 ||
+      pthread_attr_setstacksize(&attr, PROCESSING_THREAD_STACK_SIZE) != 0) {
+    errOutput("unable to set up worker threads.");
+  }
+  for (; pool->workers_count < workers; pool->workers_count++) {
+    if (pthread_create(&pool->workers[pool->workers_count], &attr,
+                       worker_main, pool) != 0) {
+      errOutput("unable to start worker thread.");
+    }
+  }
+  pthread_attr_destroy(&attr);
+
+  return pool;
+}
+
+void worker_pool_submit(WorkerPool *pool, WorkerTask task, void *arg) {
+  if (pool->workers_count == 0) {
+    task(arg);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->mutex);
+  while (pool->count == pool->backlog) {
+    pthread_cond_wait(&pool->dequeued, &pool->mutex);
+  }
+
+  pool->queue[(pool->first + pool->count) % pool->backlog] =
+      (QueuedTask){task, arg};
+  pool->count++;
+  pthread_cond_signal(&pool->queued);
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+void worker_pool_free(WorkerPool **pool) {
+  WorkerPool *p = *pool;
+  if (p == NULL) {
+    return;
+  }
+
+  if (p->workers_count > 0) {
+    pthread_mutex_lock(&p->mutex);
+    p->stopping = true;
+    pthread_cond_broadcast(&p->queued);
+    pthread_mutex_unlock(&p->mutex);
+
+    for (int i = 0; i < p->workers_count; i++) {
+      pthread_join(p->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&p->dequeued);
+    pthread_cond_destroy(&p->queued);
+    pthread_mutex_destroy(&p->mutex);
+  }
+
+  free(p->workers);
+  free(p->queue);
+  free(p);
+  *pool = NULL;
+}
+
+struct PendingTask {
+  pthread_mutex_t mutex;
+  pthread_cond_t finished;
+  bool done;
+
+  WorkerTask task;
+  void *arg;
+};
+
+static void run_pending_task(void *arg) {
+  PendingTask *pending = arg;
+
+  pending->task(pending->arg);
+
+  pthread_mutex_lock(&pending->mutex);
+  pending->done = true;
+  pthread_cond_signal(&pending->finished);
+  pthread_mutex_unlock(&pending->mutex);
+}
+
+PendingTask *worker_pool_start(WorkerPool *pool, WorkerTask task, void *arg) {
+  PendingTask *pending = malloc(sizeof(PendingTask));
+  if (pending == NULL) {
+    errOutput("unable to allocate pending task.");
+  }
+
+  pthread_mutex_init(&pending->mutex, NULL);
+  pthread_cond_init(&pending->finished, NULL);
+  pending->done = false;
+  pending->task = task;
+  pending->arg = arg;
+
+  worker_pool_submit(pool, run_pending_task, pending);
+  return pending;
+}
+
+void pending_task_wait(PendingTask **pending) {
+  PendingTask *p = *pending;
+
+  pthread_mutex_lock(&p->mutex);
+  while (!p->done) {
+    pthread_cond_wait(&p->finished, &p->mutex);
+  }
+  pthread_mutex_unlock(&p->mutex);
+
+  pthread_cond_destroy(&p->finished);
+  pthread_mutex_destroy(&p->mutex);
+  free(p);
+  *pending = NULL;
+}
+
+struct Relay {
+  pthread_mutex_t mutex;
+  pthread_cond_t passed;
+  size_t turn;
+  size_t size;
+  unsigned char value[];
+};
+
+Relay *relay_create(const void *initial, size_t size) {
+  Relay *relay = malloc(sizeof(Relay) + size);
+  if (relay == NULL) {
+    errOutput("unable to allocate relay.");
+  }
+
+  pthread_mutex_init(&relay->mutex, NULL);
+  pthread_cond_init(&relay->passed, NULL);
+  relay->turn = 0;
+  relay->size = size;
+  memcpy(relay->value, initial, size);
+
+  return relay;
+}
+
+void relay_take(Relay *relay, size_t sequence, void *value) {
+  pthread_mutex_lock(&relay->mutex);
+  while (relay->turn != sequence) {
+    pthread_cond_wait(&relay->passed, &relay->mutex);
+  }
+  memcpy(value, relay->value, relay->size);
+  pthread_mutex_unlock(&relay->mutex);
+}
+
+void relay_pass(Relay *relay, const void *value) {
+  pthread_mutex_lock(&relay->mutex);
+  memcpy(relay->value, value, relay->size);
+  relay->turn++;
+  pthread_cond_broadcast(&relay->passed);
+  pthread_mutex_unlock(&relay->mutex);
+}
+
+void relay_free(Relay **relay) {
+  if (*relay == NULL) {
+    return;
+  }
+
+  pthread_cond_destroy(&(*relay)->passed);
+  pthread_mutex_destroy(&(*relay)->mutex);
+  free(*relay);
+  *relay = NULL;
+}
@@ -0,0 +1,47 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stddef.h>
+
+// Pool of worker threads running tasks in the order they were submitted in.
+//
+// At most `backlog` tasks wait for a worker at any time: submitting more blocks
+// until a worker picks one up, which keeps the memory held by the queued tasks
+// bounded. A pool without workers runs each task on the submitting thread
+// instead, without starting any thread at all.
+typedef struct WorkerPool WorkerPool;
+typedef void (*WorkerTask)(void *arg);
+
+// Stack size of the threads running the processing, be it as workers or as
+// tile threads: what the main thread typically gets, rather than the much
+// smaller default some C libraries give other threads.
+#define PROCESSING_THREAD_STACK_SIZE (8 * 1024 * 1024)
+
+WorkerPool *worker_pool_create(int workers, size_t backlog);
+void worker_pool_submit(WorkerPool *pool, WorkerTask task, void *arg);
+// Waits for all the submitted tasks to finish, then stops the workers.
+void worker_pool_free(WorkerPool **pool);
+
+// A task submitted to a pool that can be waited for, to use its results.
+typedef struct PendingTask PendingTask;
+
+PendingTask *worker_pool_start(WorkerPool *pool, WorkerTask task, void *arg);
+// Waits for the task to be done, then frees it.
+void pending_task_wait(PendingTask **pending);
+
+// Hands a value over from task to task, in the order of their sequence
+// numbers, starting from 0.
+//
+// relay_take() waits for the task before to have passed the value on, and
+// relay_pass() then hands it to the task after. Tasks must be started in
+// sequence order, so that the value is never waited for by a task that runs
+// ahead of the one holding it.
+typedef struct Relay Relay;
+
+Relay *relay_create(const void *initial, size_t size);
+void relay_take(Relay *relay, size_t sequence, void *value);
+void relay_pass(Relay *relay, const void *value);
+void relay_free(Relay **relay);
@@ -0,0 +1,216 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- Generator of synthetic scanned pages ------------------------------- */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/pixfmt.h>
+
+#include "imageprocess/image.h"
+#include "lib/physical.h"
+#include "tests/synthetic_page.h"
+#include "unpaper.h"
+
+#define USAGE                                                                  \
+  "Usage: generate_pages [options] <output-file>\n"                            \
+  "\n"                                                                         \
+  "Draws scanned-looking pages, the same for the same options anywhere.\n"     \
+  "The output file name may contain a placeholder such as '%%03d' for the\n"   \
+  "page number, as with unpaper.\n"                                            \
+  "\n"                                                                         \
+  "  -s, --size <size>          page size, a paper name or dimensions (a4)\n"  \
+  "  -d, --dpi <dpi>            resolution (300)\n"                            \
+  "  -t, --type <pbm|pgm|ppm>   output file type (pgm)\n"                      \
+  "  -n, --count <count>        number of pages (1)\n"                         \
+  "      --start <number>       number of the first page (1)\n"                \
+  "      --double               two pages side by side on each sheet\n"        \
+  "  -k, --skew <degrees>       largest skew of the text (2.0)\n"              \
+  "  -m, --black-margin <size>  width of the black margins (0.25in)\n"         \
+  "      --noise <share>        share of the pixels as dark specks (0.0005)\n" \
+  "      --smudges <count>      light gray smudges on each sheet (20)\n"       \
+  "  -S, --seed <number>        seed of the pages drawn (1)\n"                 \
+  "  -v, --verbose              list the pages with their skews\n"
+
+enum {
+  OPT_START = 0x100,
+  OPT_DOUBLE,
+  OPT_NOISE,
+  OPT_SMUDGES,
+};
+
+static float random_skew(uint32_t *state, float max_skew) {
+  return max_skew * ((synthetic_random(state) % 20001) / 10000.0 - 1.0);
+}
+
+int main(int argc, char *argv[]) {
+  MilsSize size;
+  MilsDelta black_margin = {250, 250, true};
+  int dpi = 300;
+  int pixel_format = AV_PIX_FMT_GRAY8;
+  int count = 1;
+  int start = 1;
+  bool double_page = false;
+  float max_skew = 2.0;
+  float noise = 0.0005;
+  int smudges = 20;
+  uint32_t seed = 1;
+
+  parse_physical_size("a4", &size);
+
+  static const struct option long_options[] = {
+      {"help", no_argument, NULL, 'h'},
+      {"size", required_argument, NULL, 's'},
+      {"dpi", required_argument, NULL, 'd'},
+      {"type", required_argument, NULL, 't'},
+      {"count", required_argument, NULL, 'n'},
+      {"start", required_argument, NULL, OPT_START},
+      {"double", no_argument, NULL, OPT_DOUBLE},
+      {"skew", required_argument, NULL, 'k'},
+      {"black-margin", required_argument, NULL, 'm'},
+      {"noise", required_argument, NULL, OPT_NOISE},
+      {"smudges", required_argument, NULL, OPT_SMUDGES},
+      {"seed", required_argument, NULL, 'S'},
+      {"verbose", no_argument, NULL, 'v'},
+      {NULL, no_argument, NULL, 0},
+  };
+
+  int c;
+  while ((c = getopt_long(argc, argv, "hs:d:t:n:k:m:S:v", long_options,
+                          NULL)) != -1) {
+    switch (c) {
+    case 'h':
+      fputs(USAGE, stdout);
+      return 0;
+
+    case 's':
+      if (!parse_physical_size(optarg, &size)) {
+        errOutput("unable to parse size: '%s'", optarg);
+      }
+      break;
+
+    case 'd':
+      if (sscanf(optarg, "%d", &dpi) != 1 || dpi < 50 || dpi > INT16_MAX) {
+        errOutput("unable to parse dpi: '%s'", optarg);
+      }
+      break;
+
+    case 't':
+      if (strcmp(optarg, "pbm") == 0) {
+        pixel_format = AV_PIX_FMT_MONOWHITE;
+      } else if (strcmp(optarg, "pgm") == 0) {
+        pixel_format = AV_PIX_FMT_GRAY8;
+      } else if (strcmp(optarg, "ppm") == 0) {
+        pixel_format = AV_PIX_FMT_RGB24;
+      } else {
+        errOutput("unknown output type: '%s'", optarg);
+      }
+      break;
+
+    case 'n':
+      if (sscanf(optarg, "%d", &count) != 1 || count < 1) {
+        errOutput("unable to parse count: '%s'", optarg);
+      }
+      break;
+
+    case OPT_START:
+      if (sscanf(optarg, "%d", &start) != 1 || start < 0) {
+        errOutput("unable to parse start: '%s'", optarg);
+      }
+      break;
+
+    case OPT_DOUBLE:
+      double_page = true;
+      break;
+
+    case 'k':
+      if (sscanf(optarg, "%f", &max_skew) != 1 || max_skew < 0 ||
+          max_skew > 45) {
+        errOutput("unable to parse skew: '%s'", optarg);
+      }
+      break;
+
+    case 'm':
+      if (!parse_physical_delta(optarg, &black_margin)) {
+        errOutput("unable to parse black margin: '%s'", optarg);
+      }
+      break;
+
+    case OPT_NOISE:
+      if (sscanf(optarg, "%f", &noise) != 1 || noise < 0 || noise > 1) {
+        errOutput("unable to parse noise: '%s'", optarg);
+      }
+      break;
+
+    case OPT_SMUDGES:
+      if (sscanf(optarg, "%d", &smudges) != 1 || smudges < 0) {
+        errOutput("unable to parse smudges: '%s'", optarg);
+      }
+      break;
+
+    case 'S':
+      if (sscanf(optarg, "%" SCNu32, &seed) != 1) {
+        errOutput("unable to parse seed: '%s'", optarg);
+      }
+      break;
+
+    case 'v':
+      verbose = VERBOSE_NORMAL;
+      break;
+
+    default:
+      fputs(USAGE, stderr);
+      return 1;
+    }
+  }
+
+  if (optind + 1 != argc) {
+    fputs(USAGE, stderr);
+    return 1;
+  }
+
+  SyntheticPageParameters params = synthetic_page_defaults(dpi);
+  params.size = mils_size_to_pixels(size, dpi);
+  params.pixel_format = pixel_format;
+  params.double_page = double_page;
+  params.black_margin = mils_delta_to_pixels(black_margin, dpi).horizontal;
+  params.noise = noise;
+  params.smudges = smudges;
+  if (double_page) {
+    params.size.width *= 2;
+  }
+  if (params.size.width < 1 || params.size.height < 1) {
+    errOutput("page size is empty.");
+  }
+
+  // Each sheet is drawn from a seed and skews of its own, all taken from the
+  // seed given in the same sequence.
+  uint32_t state = synthetic_random_state(seed);
+  bool failed = false;
+
+  for (int i = 0; i < count; i++) {
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), argv[optind], start + i);
+
+    params.seed = synthetic_random(&state);
+    params.skew[0] = random_skew(&state, max_skew);
+    params.skew[1] = random_skew(&state, max_skew);
+
+    Image page = synthetic_page(params);
+    verboseLog(VERBOSE_NORMAL, "%s: skew %.2f, %.2f\n", filename,
+               params.skew[0], params.skew[1]);
+    if (!saveImage(filename, page, pixel_format)) {
+      failed = true;
+    }
+    free_image(&page);
+  }
+
+  return failed ? 1 : 0;
+}
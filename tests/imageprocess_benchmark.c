@@ -0,0 +1,296 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+/* --- Microbenchmark of the image processing kernels --------------------- */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libavutil/frame.h>
+#include <libavutil/mathematics.h> // for M_PI
+#include <libavutil/pixfmt.h>
+
+#include "imageprocess/blit.h"
+#include "imageprocess/deskew.h"
+#include "imageprocess/filters.h"
+#include "imageprocess/image.h"
+#include "imageprocess/masks.h"
+#include "imageprocess/pixel.h"
+#include "lib/tiles.h"
+#include "tests/synthetic_page.h"
+#include "unpaper.h"
+
+#define USAGE                                                                  \
+  "Usage: imageprocess_benchmark [-d dpi]... [-k kernel]... [-r repeats]\n"    \
+  "                              [-t threads] [image-file...]\n"               \
+  "\n"                                                                         \
+  "Times each kernel on a synthetic A4 page at each dpi (150 and 300\n"        \
+  "unless given), and on each image file, in all supported pixel formats.\n"
+
+#define MAX_DPIS 8
+#define MAX_KERNELS 16
+
+// The rotation deskewed, the same as the skew of the synthetic pages.
+#define SKEW_RADIANS (M_PI / 180)
+
+/**
+ * The parameters of the kernels for a page, as unpaper sets them by default
+ * for a single-page layout.
+ */
+typedef struct {
+  BlackfilterParameters blackfilter;
+  Rectangle blackfilter_exclusion;
+  BlurfilterParameters blurfilter;
+  GrayfilterParameters grayfilter;
+  MaskDetectionParameters mask_detection;
+  Point center;
+  DeskewParameters deskew;
+  DeskewParameters deskew_projection;
+} KernelSetup;
+
+typedef void (*Kernel)(Image *image, const KernelSetup *setup);
+
+static void run_blackfilter(Image *image, const KernelSetup *setup) {
+  blackfilter(*image, setup->blackfilter);
+}
+
+static void run_noisefilter(Image *image, const KernelSetup *setup) {
+  noisefilter(*image, 4, WHITE * 0.9);
+}
+
+static void run_blurfilter(Image *image, const KernelSetup *setup) {
+  blurfilter(*image, setup->blurfilter, WHITE * 0.9);
+}
+
+static void run_grayfilter(Image *image, const KernelSetup *setup) {
+  grayfilter(*image, setup->grayfilter);
+}
+
+static void run_detect_masks(Image *image, const KernelSetup *setup) {
+  Rectangle masks[1];
+  detect_masks(*image, setup->mask_detection, &setup->center, 1, masks);
+}
+
+static void run_detect_rotation(Image *image, const KernelSetup *setup) {
+  detect_rotation(*image, full_image(*image), setup->deskew);
+}
+
+static void run_detect_rotation_projection(Image *image,
+                                          const KernelSetup *setup) {
+  detect_rotation(*image, full_image(*image), setup->deskew_projection);
+}
+
+static void run_deskew(Image *image, const KernelSetup *setup) {
+  deskew(*image, full_image(*image), SKEW_RADIANS, INTERP_CUBIC);
+}
+
+static void run_stretch(Image *image, const KernelSetup *setup) {
+  stretch_and_replace(image,
+                      (RectangleSize){image->frame->width * 5 / 4,
+                                      image->frame->height * 5 / 4},
+                      INTERP_CUBIC);
+}
+
+static void run_flip_rotate_90(Image *image, const KernelSetup *setup) {
+  flip_rotate_90(image, ROTATE_CLOCKWISE);
+}
+
+static const struct {
+  const char *name;
+  Kernel run;
+} kernels[] = {
+    {"blackfilter", run_blackfilter},
+    {"noisefilter", run_noisefilter},
+    {"blurfilter", run_blurfilter},
+    {"grayfilter", run_grayfilter},
+    {"detect_masks", run_detect_masks},
+    {"detect_rotation", run_detect_rotation},
+    {"detect_rotation_projection", run_detect_rotation_projection},
+    {"deskew", run_deskew},
+    {"stretch_and_replace", run_stretch},
+    {"flip_rotate_90", run_flip_rotate_90},
+};
+
+static const struct {
+  const char *name;
+  int pixel_format;
+} formats[] = {
+    {"monowhite", AV_PIX_FMT_MONOWHITE}, {"monoblack", AV_PIX_FMT_MONOBLACK},
+    {"gray8", AV_PIX_FMT_GRAY8},         {"y400a", AV_PIX_FMT_Y400A},
+    {"rgb24", AV_PIX_FMT_RGB24},
+};
+
+static KernelSetup kernel_setup(Image page) {
+  const RectangleSize size = size_of_image(page);
+  KernelSetup setup = {
+      .blackfilter_exclusion = rectangle_from_size(
+          (Point){size.width / 4, size.height / 4},
+          (RectangleSize){size.width / 2, size.height / 2}),
+      .center = {size.width / 2, size.height / 2},
+  };
+
+  validate_blackfilter_parameters(&setup.blackfilter, (RectangleSize){20, 20},
+                                  (Delta){5, 5}, 500, 500, DIRECTION_BOTH,
+                                  0.95, 20, 1, &setup.blackfilter_exclusion);
+  validate_blurfilter_parameters(&setup.blurfilter, (RectangleSize){100, 100},
+                                 (Delta){50, 50}, 0.01);
+  validate_grayfilter_parameters(&setup.grayfilter, (RectangleSize){50, 50},
+                                 (Delta){20, 20}, 0.5);
+  validate_mask_detection_parameters(
+      &setup.mask_detection, DIRECTION_HORIZONTAL, (RectangleSize){50, 50},
+      (int32_t[]){-1, -1}, (Delta){5, 5}, (float[]){0.1, 0.1},
+      (int[]){100, 100}, (int[]){size.width, size.height});
+  validate_deskew_parameters(
+      &setup.deskew, DESKEW_METHOD_EDGES, 5.0, 0.1, 1.0, 1500, 0.5,
+      (Edges){.left = true, .top = false, .right = true, .bottom = false});
+  setup.deskew_projection = setup.deskew;
+  setup.deskew_projection.method = DESKEW_METHOD_PROJECTION;
+
+  return setup;
+}
+
+static Image convert_page(Image page, int pixel_format) {
+  Image converted =
+      create_image(size_of_image(page), pixel_format, false, PIXEL_WHITE,
+                   page.abs_black_threshold);
+  copy_rectangle(page, converted, full_image(page), POINT_ORIGIN);
+  return converted;
+}
+
+static double now_seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static bool kernel_selected(const char *name, const char *selected[],
+                            int selected_count) {
+  for (int i = 0; i < selected_count; i++) {
+    if (strcmp(name, selected[i]) == 0) {
+      return true;
+    }
+  }
+  return selected_count == 0;
+}
+
+/**
+ * Runs each selected kernel on fresh copies of the page in each pixel format,
+ * and prints the fastest run of each.
+ */
+static void benchmark_page(const char *label, Image page, int repeats,
+                           const char *selected[], int selected_count) {
+  const KernelSetup setup = kernel_setup(page);
+  const uint64_t pixels = (uint64_t)page.frame->width * page.frame->height;
+
+  for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+    Image converted = convert_page(page, formats[f].pixel_format);
+
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+      if (!kernel_selected(kernels[k].name, selected, selected_count)) {
+        continue;
+      }
+
+      double best = -1;
+      for (int r = 0; r < repeats; r++) {
+        Image copy = convert_page(converted, formats[f].pixel_format);
+
+        const double start = now_seconds();
+        kernels[k].run(&copy, &setup);
+        const double elapsed = now_seconds() - start;
+
+        if (best < 0 || elapsed < best) {
+          best = elapsed;
+        }
+        free_image(&copy);
+      }
+
+      printf("%-20s %-10s %-16s %10" PRIu64 " %10.3f %10.2f\n",
+             kernels[k].name, formats[f].name, label, pixels, best * 1e3,
+             pixels / best / 1e6);
+      fflush(stdout);
+    }
+
+    free_image(&converted);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int dpis[MAX_DPIS];
+  int dpis_count = 0;
+  const char *selected[MAX_KERNELS];
+  int selected_count = 0;
+  int repeats = 3;
+  int threads = 1;
+  int c;
+
+  while ((c = getopt(argc, argv, "d:k:r:t:h")) != -1) {
+    switch (c) {
+    case 'd':
+      if (dpis_count == MAX_DPIS ||
+          sscanf(optarg, "%d", &dpis[dpis_count]) != 1 ||
+          dpis[dpis_count] < 10) {
+        errOutput("unable to parse dpi: '%s'", optarg);
+      }
+      dpis_count++;
+      break;
+    case 'k':
+      if (selected_count == MAX_KERNELS) {
+        errOutput("too many kernels selected.");
+      }
+      selected[selected_count++] = optarg;
+      break;
+    case 'r':
+      if (sscanf(optarg, "%d", &repeats) != 1 || repeats < 1) {
+        errOutput("unable to parse repeats: '%s'", optarg);
+      }
+      break;
+    case 't':
+      if (sscanf(optarg, "%d", &threads) != 1 || threads < 1) {
+        errOutput("unable to parse threads: '%s'", optarg);
+      }
+      break;
+    default:
+      fputs(USAGE, c == 'h' ? stdout : stderr);
+      return c == 'h' ? 0 : 1;
+    }
+  }
+
+  if (dpis_count == 0) {
+    dpis[dpis_count++] = 150;
+    dpis[dpis_count++] = 300;
+  }
+
+  tile_threads_start(threads);
+
+  printf("%-20s %-10s %-16s %10s %10s %10s\n", "kernel", "format", "page",
+         "pixels", "best ms", "Mpixels/s");
+
+  for (int i = 0; i < dpis_count; i++) {
+    char label[32];
+    snprintf(label, sizeof(label), "synthetic-%ddpi", dpis[i]);
+
+    Image page = synthetic_page(synthetic_page_defaults(dpis[i]));
+    benchmark_page(label, page, repeats, selected, selected_count);
+    free_image(&page);
+  }
+
+  for (int i = optind; i < argc; i++) {
+    const char *basename = strrchr(argv[i], '/');
+    Image page = EMPTY_IMAGE;
+
+    loadImage(argv[i], &page, PIXEL_WHITE, WHITE * (1.0 - 0.33));
+    benchmark_page(basename != NULL ? basename + 1 : argv[i], page, repeats,
+                   selected, selected_count);
+    free_image(&page);
+  }
+
+  tile_threads_stop();
+
+  return 0;
+}
@@ -0,0 +1,162 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#include <libavutil/mathematics.h> // for M_PI
+#include <libavutil/pixfmt.h>
+
+#include "constants.h"
+#include "imageprocess/blit.h"
+#include "imageprocess/deskew.h"
+#include "imageprocess/pixel.h"
+#include "lib/math_util.h"
+#include "tests/synthetic_page.h"
+
+static const Pixel TEXT_COLOR = {20, 20, 20};
+static const Pixel SMUDGE_COLOR = {200, 200, 200};
+static const Pixel GUTTER_COLOR = {110, 110, 110};
+
+uint32_t synthetic_random_state(uint32_t seed) {
+  // Spread the bits of small seeds, which xorshift takes a while to mix.
+  const uint32_t state = seed * 2654435761u ^ 0x2545f491;
+  return state != 0 ? state : 0x2545f491;
+}
+
+// xorshift32, so that the sheets are the same everywhere.
+uint32_t synthetic_random(uint32_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+SyntheticPageParameters synthetic_page_defaults(int dpi) {
+  return (SyntheticPageParameters){
+      .size = {dpi * 827 / 100, dpi * 1169 / 100},
+      .dpi = dpi,
+      .pixel_format = AV_PIX_FMT_GRAY8,
+      .seed = 1,
+      .skew = {1.0, 1.0},
+      .black_margin = dpi / 4,
+      .noise = 0.0005,
+      .smudges = 20,
+  };
+}
+
+/**
+ * Fills the page with paragraphs of words, a line of a sixth of an inch at a
+ * time, within margins of an inch, then skews them.
+ */
+static void draw_text(Image sheet, Rectangle page, int dpi, float skew,
+                      uint32_t *state) {
+  const Rectangle body = {{
+      {page.vertex[0].x + dpi, page.vertex[0].y + dpi},
+      {page.vertex[1].x - dpi, page.vertex[1].y - dpi},
+  }};
+  const int32_t body_width = body.vertex[1].x - body.vertex[0].x;
+  const int32_t word_height = dpi / 12;
+
+  if (body_width <= 0) {
+    return;
+  }
+
+  int32_t y = body.vertex[0].y;
+  while (y + word_height <= body.vertex[1].y) {
+    const uint32_t lines = 3 + synthetic_random(state) % 8;
+
+    for (uint32_t line = 0;
+         line < lines && y + word_height <= body.vertex[1].y; line++) {
+      // Paragraphs start indented, and end on a shorter line.
+      int32_t x = body.vertex[0].x + (line == 0 ? dpi / 3 : 0);
+      const int32_t end = line + 1 < lines
+                              ? body.vertex[1].x
+                              : x + synthetic_random(state) % body_width;
+
+      while (x < end) {
+        const int32_t width = dpi / 10 + synthetic_random(state) % (dpi / 4);
+        wipe_rectangle(
+            sheet,
+            (Rectangle){{{x, y}, {min(x + width, end), y + word_height}}},
+            TEXT_COLOR);
+        x += width + dpi / 20;
+      }
+      y += dpi / 6;
+    }
+    y += dpi / 6;
+  }
+
+  if (skew != 0.0) {
+    // Turn the whole page, so that the corners of the text are not clipped.
+    deskew(sheet, page, skew * M_PI / 180, INTERP_CUBIC);
+  }
+}
+
+Image synthetic_page(SyntheticPageParameters params) {
+  const RectangleSize size = params.size;
+  const int pages = params.double_page ? 2 : 1;
+  uint32_t state = synthetic_random_state(params.seed);
+
+  Image sheet = create_image(size, AV_PIX_FMT_GRAY8, true, PIXEL_WHITE,
+                             WHITE * (1.0 - 0.33));
+
+  for (int i = 0; i < pages; i++) {
+    const Rectangle page = {{
+        {size.width * i / pages, 0},
+        {size.width * (i + 1) / pages - 1, size.height - 1},
+    }};
+    draw_text(sheet, page, params.dpi, params.skew[i], &state);
+  }
+
+  if (params.double_page) {
+    wipe_rectangle(sheet,
+                   (Rectangle){{{size.width / 2 - params.dpi / 12, 0},
+                                {size.width / 2 + params.dpi / 12,
+                                 size.height - 1}}},
+                   GUTTER_COLOR);
+  }
+
+  if (params.black_margin > 0) {
+    wipe_rectangle(
+        sheet,
+        (Rectangle){{{0, 0}, {params.black_margin - 1, size.height - 1}}},
+        PIXEL_BLACK);
+    wipe_rectangle(sheet,
+                   (Rectangle){{{0, size.height - params.black_margin},
+                                {size.width - 1, size.height - 1}}},
+                   PIXEL_BLACK);
+    if (params.double_page) {
+      wipe_rectangle(sheet,
+                     (Rectangle){{{size.width - params.black_margin, 0},
+                                  {size.width - 1, size.height - 1}}},
+                     PIXEL_BLACK);
+    }
+  }
+
+  for (int i = 0; i < params.smudges; i++) {
+    const Point origin = {synthetic_random(&state) % size.width,
+                          synthetic_random(&state) % size.height};
+    wipe_rectangle(
+        sheet,
+        rectangle_from_size(origin,
+                            (RectangleSize){params.dpi / 3, params.dpi / 3}),
+        SMUDGE_COLOR);
+  }
+
+  const uint64_t specks =
+      (uint64_t)((double)size.width * size.height * params.noise);
+  for (uint64_t i = 0; i < specks; i++) {
+    set_pixel(sheet,
+              (Point){synthetic_random(&state) % size.width,
+                      synthetic_random(&state) % size.height},
+              PIXEL_BLACK);
+  }
+
+  if (params.pixel_format != AV_PIX_FMT_GRAY8) {
+    Image converted = create_image(size, params.pixel_format, false,
+                                   PIXEL_WHITE, sheet.abs_black_threshold);
+    copy_rectangle(sheet, converted, full_image(sheet), POINT_ORIGIN);
+    replace_image(&sheet, &converted);
+  }
+
+  return sheet;
+}
@@ -0,0 +1,48 @@
+// SPDX-FileCopyrightText: 2005 The unpaper authors
+//
+// SPDX-License-Identifier: GPL-2.0-only
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "imageprocess/image.h"
+#include "imageprocess/primitives.h"
+
+// Draws scanned-looking sheets for benchmarks and load tests: paragraphs of
+// word-like blocks, skewed as a page fed askew into a scanner, with the black
+// margins of a bad photocopy, light gray smudges and dark specks of noise.
+//
+// The sheets only depend on the parameters, the seed included, so that the
+// same ones can be drawn anywhere rather than shipped around.
+
+typedef struct {
+  RectangleSize size;
+  int dpi;
+  int pixel_format;
+  uint32_t seed;
+
+  // Two pages side by side, with a shadow along the gutter between them.
+  bool double_page;
+  // Rotation of the text of each page (only the first for a single page), in
+  // degrees, as deskew() turns it.
+  float skew[2];
+  // Width of the black margins along the outer edges and the bottom.
+  int32_t black_margin;
+  // Share of the pixels turned into dark specks.
+  float noise;
+  // Number of light gray smudges.
+  int smudges;
+} SyntheticPageParameters;
+
+// The parameters of a single A4 page at the resolution, with a skew of one
+// degree, margins and noise.
+SyntheticPageParameters synthetic_page_defaults(int dpi);
+
+Image synthetic_page(SyntheticPageParameters params);
+
+// The pseudo-random sequence the sheets are drawn with, for choosing their
+// parameters from a seed just as reproducibly.
+uint32_t synthetic_random_state(uint32_t seed);
+uint32_t synthetic_random(uint32_t *state);
@@ -3,6 +3,7 @@
 # SPDX-License-Identifier: GPL-2.0-only
 # SPDX-License-Identifier: MIT
 
+import json
 import logging
 import os
 import pathlib
@@ -66,16 +67,35 @@ def get_golden_directory() -> pathlib.Path:
     return pathlib.Path(os.getenv("TEST_GOLDEN_DIR", "tests/golden_images/"))
 
 
-def test_a1(imgsrc_path, goldendir_path, tmp_path):
-    """[A1] Single-Page Template Layout, Black+White, Full Processing."""
+@pytest.mark.parametrize(
+    "extra_args",
+    [
+        pytest.param([], id="serial"),
+        pytest.param(["--threads", "4"], id="threads"),
+    ],
+)
+def test_a1(imgsrc_path, goldendir_path, tmp_path, extra_args):
+    """[A1] Single-Page Template Layout, Black+White, Full Processing.
+
+    Splitting the filters across threads has to give the very same file as
+    running them on a single one.
+    """
     source_path = imgsrc_path / "imgsrc001.png"
     result_path = tmp_path / "result.pbm"
     golden_path = goldendir_path / "goldenA1.pbm"
 
-    run_unpaper(str(source_path), str(result_path))
+    run_unpaper(*extra_args, str(source_path), str(result_path))
 
     assert compare_images(golden=golden_path, result=result_path) < 0.05
 
+    if not extra_args:
+        return
+
+    serial_path = tmp_path / "serial.pbm"
+    run_unpaper("--threads", "1", str(source_path), str(serial_path))
+
+    assert result_path.read_bytes() == serial_path.read_bytes()
+
 
 def test_a2(imgsrc_path, goldendir_path, tmp_path):
     """[A2] Single-Page Template Layout, Black+White, Full Processing, PPI scaling."""
@@ -90,6 +110,19 @@ def test_a2(imgsrc_path, goldendir_path, tmp_path):
     assert compare_images(golden=golden_path, result=result_path) < 0.05
 
 
+def test_a1_deskew_projection(imgsrc_path, goldendir_path, tmp_path):
+    """[A1] Single-Page Template Layout, Black+White, Full Processing, projection deskew."""
+    source_path = imgsrc_path / "imgsrc001.png"
+    result_path = tmp_path / "result.pbm"
+    golden_path = goldendir_path / "goldenA1.pbm"
+
+    run_unpaper(
+        "--deskew-method", "projection", str(source_path), str(result_path)
+    )
+
+    assert compare_images(golden=golden_path, result=result_path) < 0.05
+
+
 def test_b1(imgsrc_path, goldendir_path, tmp_path):
     """[B1] Combined Color/Gray, No Processing."""
 
@@ -261,17 +294,35 @@ def test_sheet_stretch(imgsrc_path, goldendir_path, tmp_path):
     assert compare_images(golden=golden_path, result=result_path) < 0.05
 
 
-def test_e1(imgsrc_path, goldendir_path, tmp_path):
-    """[E1] Splitting 2-page layout into separate output pages (with input and output wildcard)."""
+@pytest.mark.parametrize(
+    "extra_args",
+    [
+        pytest.param([], id="serial"),
+        pytest.param(["--jobs", "3"], id="jobs"),
+        pytest.param(["--read-ahead", "2"], id="read-ahead"),
+        pytest.param(["--write-behind", "2"], id="write-behind"),
+    ],
+)
+def test_e1(imgsrc_path, goldendir_path, tmp_path, extra_args):
+    """[E1] Splitting 2-page layout into separate output pages (with input and output wildcard).
+
+    Running sheets through the pipeline in any other way than one at a time
+    has to write the very same files as doing so.
+    """
 
     source_path = imgsrc_path / "imgsrcE%03d.png"
-    result_path = tmp_path / "results-%02d.pbm"
+    results_dir = tmp_path / "results"
+    results_dir.mkdir()
+    layout_args = ["--layout", "double", "--output-pages", "2"]
 
     run_unpaper(
-        "--layout", "double", "--output-pages", "2", str(source_path), str(result_path)
+        *extra_args,
+        *layout_args,
+        str(source_path),
+        str(results_dir / "results-%02d.pbm"),
     )
 
-    all_results = sorted(tmp_path.iterdir())
+    all_results = sorted(results_dir.iterdir())
     assert len(all_results) == 6
 
     for result in all_results:
@@ -282,6 +333,18 @@ def test_e1(imgsrc_path, goldendir_path, tmp_path):
 
         assert compare_images(golden=golden_path, result=result) < 0.05
 
+    if not extra_args:
+        return
+
+    serial_dir = tmp_path / "serial"
+    serial_dir.mkdir()
+    run_unpaper(
+        *layout_args, str(source_path), str(serial_dir / "results-%02d.pbm")
+    )
+
+    for result in all_results:
+        assert result.read_bytes() == (serial_dir / result.name).read_bytes()
+
 
 def test_e2(imgsrc_path, goldendir_path, tmp_path):
     """[E2] Splitting 2-page layout into separate output pages (with output wildcard only)."""
@@ -454,6 +517,77 @@ def test_no_overwrite_existing_file(imgsrc_path, tmp_path):
     assert result_path.stat().st_size == 0
 
 
+def test_write_behind_failure(imgsrc_path, tmp_path):
+    source_path = imgsrc_path / "imgsrc001.png"
+    result_path = tmp_path / "missing" / "result.pbm"
+
+    unpaper_result = run_unpaper(
+        "--write-behind",
+        "1",
+        "--no-processing",
+        "1",
+        str(source_path),
+        str(result_path),
+        check=False,
+    )
+    assert unpaper_result.returncode != 0
+    assert not result_path.exists()
+
+
+def test_timings(imgsrc_path, tmp_path):
+    source_path = imgsrc_path / "imgsrcE%03d.png"
+    result_path = tmp_path / "results-%02d.pbm"
+    timings_path = tmp_path / "timings.jsonl"
+
+    run_unpaper(
+        "--timings",
+        str(timings_path),
+        "--jobs",
+        "2",
+        "--layout",
+        "double",
+        "--output-pages",
+        "2",
+        str(source_path),
+        str(result_path),
+    )
+
+    records = [json.loads(line) for line in timings_path.read_text().splitlines()]
+    assert len(records) == 4
+
+    sheets = sorted(record["sheet"] for record in records[:-1])
+    assert sheets == [1, 2, 3]
+    for record in records[:-1]:
+        assert record["stages"]["load"]["runs"] == 1
+        assert record["stages"]["save"]["pages"] == 2
+        assert "flood_fills" in record["stages"]["blackfilter"]
+        assert "clusters" in record["stages"]["noisefilter"]
+
+    summary = records[-1]
+    assert summary["summary"]
+    assert summary["sheets"] == 3
+    assert summary["stages"]["save"]["pages"] == 6
+
+
+def test_input_format(imgsrc_path, goldendir_path, tmp_path):
+    """[A1] Single-Page Template Layout, Black+White, declared input format."""
+    source_path = imgsrc_path / "imgsrc001.png"
+    result_path = tmp_path / "result.pbm"
+    golden_path = goldendir_path / "goldenA1.pbm"
+
+    run_unpaper("--input-format", "png", str(source_path), str(result_path))
+    assert compare_images(golden=golden_path, result=result_path) < 0.05
+
+    unpaper_result = run_unpaper(
+        "--input-format",
+        "no-such-format",
+        str(source_path),
+        str(tmp_path / "unknown.pbm"),
+        check=False,
+    )
+    assert unpaper_result.returncode != 0
+
+
 def test_invalid_multi_index(imgsrc_path, tmp_path):
     source_path = imgsrc_path / "imgsrc001.png"
     result_path = tmp_path / "result.pbm"
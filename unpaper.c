@@ -8,6 +8,7 @@
 
 #include <assert.h>
 #include <getopt.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -21,12 +22,16 @@
 #include "imageprocess/blit.h"
 #include "imageprocess/deskew.h"
 #include "imageprocess/filters.h"
+#include "imageprocess/framepool.h"
 #include "imageprocess/image.h"
 #include "imageprocess/interpolate.h"
 #include "imageprocess/masks.h"
 #include "imageprocess/pixel.h"
 #include "lib/options.h"
 #include "lib/physical.h"
+#include "lib/tiles.h"
+#include "lib/timings.h"
+#include "lib/workers.h"
 #include "parse.h"
 #include "unpaper.h"
 #include "version.h"
@@ -115,6 +120,7 @@ enum LONG_OPTION_VALUES {
   OPT_DESKEW_SCAN_RANGE,
   OPT_DESKEW_SCAN_STEP,
   OPT_DESKEW_SCAN_DEVIATION,
+  OPT_DESKEW_METHOD,
   OPT_NO_BORDER_SCAN,
   OPT_BORDER_SCAN_DIRECTION,
   OPT_BORDER_SCAN_SIZE,
@@ -138,8 +144,1167 @@ enum LONG_OPTION_VALUES {
   OPT_DEBUG,
   OPT_DEBUG_SAVE,
   OPT_INTERPOLATE,
+  OPT_JOBS,
+  OPT_THREADS,
+  OPT_READ_AHEAD,
+  OPT_WRITE_BEHIND,
+  OPT_TIMINGS,
+  OPT_INPUT_FORMAT,
 };
 
+static uint64_t image_pixels(Image image) {
+  return (uint64_t)image.frame->width * image.frame->height;
+}
+
+static uint64_t masks_pixels(const Rectangle masks[], size_t count) {
+  uint64_t pixels = 0;
+  for (size_t i = 0; i < count; i++) {
+    pixels += count_pixels(masks[i]);
+  }
+  return pixels;
+}
+
+// The pixels apply_border() clears, outside of the border's mask.
+static uint64_t border_pixels(Image image, Border border) {
+  if (memcmp(&border, &BORDER_NULL, sizeof(BORDER_NULL)) == 0) {
+    return 0;
+  }
+  return image_pixels(image) - count_pixels(clip_rectangle(
+                                   image, border_to_mask(image, border)));
+}
+
+static bool pixel_is_gray(Pixel pixel) {
+  return pixel.r == pixel.g && pixel.g == pixel.b;
+}
+
+static bool pixel_is_bilevel(Pixel pixel) {
+  return pixel_is_gray(pixel) && (pixel.r == 0 || pixel.r == UINT8_MAX);
+}
+
+/**
+ * Chooses the pixel format to process a sheet in, based on the formats of the
+ * input pages placed on it. Grayscale inputs are kept in GRAY8, and bilevel
+ * inputs in MONOWHITE, unless the configured colors, or an explicitly
+ * requested output format, need a wider format to be represented.
+ *
+ * Stretching and deskewing interpolate intermediate gray levels that the
+ * following detection stages take into account, so if any of them runs
+ * (`interpolated`), bilevel inputs are processed as GRAY8 instead.
+ */
+static int sheet_pixel_format(const Image pages[], int pages_count,
+                              const Options *options, int output_pixel_format,
+                              bool interpolated) {
+  bool color = false, gray = false, mono = false;
+
+  for (int i = 0; i < pages_count; i++) {
+    if (pages[i].frame == NULL) {
+      continue;
+    }
+
+    switch (pages[i].frame->format) {
+    case AV_PIX_FMT_MONOWHITE:
+    case AV_PIX_FMT_MONOBLACK:
+      mono = true;
+      break;
+    case AV_PIX_FMT_GRAY8:
+    case AV_PIX_FMT_Y400A:
+      gray = true;
+      break;
+    default:
+      color = true;
+      break;
+    }
+  }
+
+  // Blank sheets: go by the output format instead.
+  if (!color && !gray && !mono) {
+    switch (output_pixel_format) {
+    case AV_PIX_FMT_MONOWHITE:
+    case AV_PIX_FMT_MONOBLACK:
+      mono = true;
+      break;
+    case AV_PIX_FMT_GRAY8:
+    case AV_PIX_FMT_Y400A:
+      gray = true;
+      break;
+    default:
+      color = true;
+      break;
+    }
+  }
+
+  if (color || !pixel_is_gray(options->sheet_background) ||
+      !pixel_is_gray(options->mask_color)) {
+    return AV_PIX_FMT_RGB24;
+  }
+
+  // Interpolated gray levels are only discarded without loss if the output is
+  // bilevel as well.
+  if (gray || interpolated || !pixel_is_bilevel(options->sheet_background) ||
+      !pixel_is_bilevel(options->mask_color) ||
+      (output_pixel_format != AV_PIX_FMT_MONOWHITE &&
+       output_pixel_format != AV_PIX_FMT_MONOBLACK)) {
+    return AV_PIX_FMT_GRAY8;
+  }
+
+  return AV_PIX_FMT_MONOWHITE;
+}
+
+/**
+ * A sheet to process, as planned by the main loop. Sheets are processed
+ * independently of each other, only handing over what a sheet inherits from
+ * the one before it (see InheritedSettings).
+ */
+typedef struct {
+  const Options *options;
+  Relay *relay;
+  WorkerPool *writer;
+  // NULL unless the timings are recorded (--timings).
+  SheetTimings *timings;
+  size_t sequence;
+
+  int nr;
+  // Number of the first input file of the sheet, used to name debug files.
+  int first_input;
+  // Left empty for blank pages (--insert-blank, --replace-blank).
+  char input_files[MAX_PAGES][PATH_MAX];
+  char output_files[MAX_PAGES][PATH_MAX];
+
+  // Set when the pages are loaded ahead (--read-ahead), until they are.
+  PendingTask *loading;
+  Image pages[MAX_PAGES];
+  RectangleSize input_size;
+  int input_pixel_format;
+} SheetJob;
+
+typedef struct {
+  // Size of the previous sheet before any stretching, for sheets made of
+  // blank pages only.
+  RectangleSize size;
+  // The output format, unless set explicitly, is the one of the first input
+  // file.
+  int output_pixel_format;
+} InheritedSettings;
+
+/**
+ * An output page ready to be saved, taken over by the writer.
+ */
+typedef struct {
+  char filename[PATH_MAX];
+  Image page;
+  int pixel_format;
+  SheetTimings *timings;
+} PageWrite;
+
+// Set once any output page failed to be saved, to exit with an error.
+static atomic_bool write_failed;
+
+/**
+ * Saves an output page, freeing it when done.
+ */
+static void write_page(void *arg) {
+  PageWrite *write = arg;
+
+  verboseLog(VERBOSE_MORE, "saving file %s.\n", write->filename);
+
+  StageClock started = stage_start();
+  if (!saveImage(write->filename, write->page, write->pixel_format)) {
+    atomic_store(&write_failed, true);
+  }
+  stage_record(write->timings, STAGE_SAVE, started, image_pixels(write->page),
+               1);
+
+  sheet_timings_release(&write->timings);
+  free_image(&write->page);
+  free(write);
+}
+
+/**
+ * Loads the input pages of a sheet, pre-rotated, into the job.
+ */
+static void load_sheet(void *arg) {
+  SheetJob *job = arg;
+  const Options *options = job->options;
+  Image *pages = job->pages;
+  RectangleSize inputSize = {-1, -1};
+  int inputPixelFormat = AV_PIX_FMT_NONE;
+
+  for (int j = 0; j < options->input_count; j++) {
+    const char *inputFileName = job->input_files[j];
+    pages[j] = EMPTY_IMAGE;
+
+    // may be empty if --insert-blank or --replace-blank
+    if (inputFileName[0] != '\0') {
+      verboseLog(VERBOSE_MORE, "loading file %s.\n", inputFileName);
+
+      StageClock started = stage_start();
+      loadImage(inputFileName, &pages[j], options->sheet_background,
+                options->abs_black_threshold);
+      saveDebug("_loaded_%d.pnm", job->first_input + j, pages[j]);
+
+      if (inputPixelFormat == AV_PIX_FMT_NONE && pages[j].frame != NULL) {
+        inputPixelFormat = pages[j].frame->format;
+      }
+
+      // pre-rotate
+      if (options->pre_rotate != 0) {
+        verboseLog(VERBOSE_NORMAL, "pre-rotating %hd degrees.\n",
+                   options->pre_rotate);
+
+        flip_rotate_90(&pages[j], options->pre_rotate / 90);
+      }
+      stage_record(job->timings, STAGE_LOAD, started, image_pixels(pages[j]),
+                   0);
+
+      // if sheet-size is not known yet (and not forced by --sheet-size),
+      // set now based on size of (first) input image
+      RectangleSize inputSheetSize = {
+          .width = pages[j].frame->width * options->input_count,
+          .height = pages[j].frame->height,
+      };
+      inputSize = coerce_size(
+          inputSize, coerce_size(options->sheet_size, inputSheetSize));
+    }
+  }
+
+  job->input_size = inputSize;
+  job->input_pixel_format = inputPixelFormat;
+}
+
+/**
+ * Loads, processes and saves a single sheet, freeing the job when done.
+ */
+static void process_sheet(void *arg) {
+  SheetJob *job = arg;
+  const Options *options = job->options;
+  const int nr = job->nr;
+  char *inputFileNames[MAX_PAGES];
+  char *outputFileNames[MAX_PAGES];
+
+  for (int i = 0; i < options->input_count; i++) {
+    inputFileNames[i] =
+        job->input_files[i][0] != '\0' ? job->input_files[i] : NULL;
+  }
+  for (int i = 0; i < options->output_count; i++) {
+    outputFileNames[i] = job->output_files[i];
+  }
+
+  char s1[1023]; // buffers for result of implode()
+  char s2[1023];
+
+  verboseLog(VERBOSE_NORMAL,
+             "\n-------------------------------------------------------------"
+             "------------------\n");
+
+  if (options->multiple_sheets) {
+    verboseLog(
+        VERBOSE_NORMAL, "Processing sheet #%d: %s -> %s\n", nr,
+        implode(s1, (const char **)inputFileNames, options->input_count),
+        implode(s2, (const char **)outputFileNames, options->output_count));
+  } else {
+    verboseLog(
+        VERBOSE_NORMAL, "Processing sheet: %s -> %s\n",
+        implode(s1, (const char **)inputFileNames, options->input_count),
+        implode(s2, (const char **)outputFileNames, options->output_count));
+  }
+
+  // load input image(s)
+  if (job->loading != NULL) {
+    pending_task_wait(&job->loading);
+  } else {
+    load_sheet(job);
+  }
+  Image *pages = job->pages;
+  RectangleSize inputSize = job->input_size;
+  const int inputPixelFormat = job->input_pixel_format;
+
+  // Wait for the previous sheet to be loaded, and take over what this one
+  // inherits from it.
+  InheritedSettings inherited;
+  relay_take(job->relay, job->sequence, &inherited);
+
+  // Unless set explicitly, the output format is the one of the first input
+  // file of the run.
+  int outputPixelFormat = inherited.output_pixel_format;
+  if (outputPixelFormat == AV_PIX_FMT_NONE) {
+    outputPixelFormat = inputPixelFormat;
+  }
+
+  // The sheet is kept in the narrowest pixel format that can represent
+  // all the input pages, rather than always expanding to RGB24.
+  bool sheetInterpolated =
+      options->stretch_size.width != -1 || options->stretch_size.height != -1 ||
+      options->page_size.width != -1 || options->page_size.height != -1 ||
+      options->pre_zoom_factor != 1.0 ||
+      !isExcluded(nr, options->no_deskew_multi_index,
+                  options->ignore_multi_index);
+  int sheetFormat = sheet_pixel_format(pages, options->input_count, options,
+                                       outputPixelFormat, sheetInterpolated);
+
+  // the only case that the size is not known yet is if all blank pages
+  // have been inserted
+  if ((inputSize.width == -1) || (inputSize.height == -1)) {
+    // last chance: try to get previous (unstretched/not zoomed) sheet size
+    inputSize = inherited.size;
+    verboseLog(VERBOSE_NORMAL,
+               "need to guess sheet size from previous sheet: %dx%d\n",
+               inputSize.width, inputSize.height);
+
+    if ((inputSize.width == -1) || (inputSize.height == -1)) {
+      errOutput("sheet size unknown, use at least one input file per "
+                "sheet, or force using --sheet-size.");
+    }
+  }
+
+  if (outputPixelFormat == AV_PIX_FMT_NONE) {
+    outputPixelFormat = sheetFormat;
+  }
+
+  relay_pass(job->relay, &(InheritedSettings){
+                             .size = inputSize,
+                             .output_pixel_format = outputPixelFormat,
+                         });
+
+  // place images into sheet buffer
+  StageClock started = stage_start();
+  Image sheet = create_image(inputSize, sheetFormat, true,
+                             options->sheet_background,
+                             options->abs_black_threshold);
+
+  for (int j = 0; j < options->input_count; j++) {
+    if (pages[j].frame != NULL) {
+      saveDebug("_page%d.pnm", job->first_input + j, pages[j]);
+      saveDebug("_before_center_page%d.pnm", job->first_input + j, sheet);
+
+      center_image(pages[j], sheet,
+                   (Point){(inputSize.width * j / options->input_count), 0},
+                   (RectangleSize){(inputSize.width / options->input_count),
+                                   inputSize.height});
+
+      saveDebug("_after_center_page%d.pnm", job->first_input + j, sheet);
+
+      free_image(&pages[j]);
+    }
+  }
+
+  // pre-mirroring
+  if (options->pre_mirror.horizontal || options->pre_mirror.vertical) {
+    verboseLog(VERBOSE_NORMAL, "pre-mirroring %s\n",
+               direction_to_string(options->pre_mirror));
+
+    mirror(sheet, options->pre_mirror);
+  }
+
+  // pre-shifting
+  if (options->pre_shift.horizontal != 0 ||
+      options->pre_shift.vertical != 0) {
+    verboseLog(VERBOSE_NORMAL, "pre-shifting [%" PRId32 ",%" PRId32 "]\n",
+               options->pre_shift.horizontal, options->pre_shift.vertical);
+
+    shift_image(&sheet, options->pre_shift);
+  }
+
+  // pre-masking
+  if (options->pre_masks_count > 0) {
+    verboseLog(VERBOSE_NORMAL, "pre-masking\n ");
+
+    apply_masks(sheet, options->pre_masks, options->pre_masks_count,
+                options->mask_color);
+  }
+  stage_record(job->timings, STAGE_PRE, started, image_pixels(sheet), 0);
+
+  // --------------------------------------------------------------
+  // --- verbose parameter output,                              ---
+  // --------------------------------------------------------------
+
+  // parameters and size are known now
+
+  if (verbose >= VERBOSE_MORE) {
+    // The settings are printed over many calls, some of them writing only
+    // part of a line, so stdout is held for the whole of them not to mix with
+    // those of sheets processed concurrently with --jobs.
+    flockfile(stdout);
+
+    switch (options->layout) {
+    case LAYOUT_NONE:
+      printf("layout: none\n");
+      break;
+    case LAYOUT_SINGLE:
+      printf("layout: single\n");
+      break;
+    case LAYOUT_DOUBLE:
+      printf("layout: double\n");
+      break;
+    default:
+      assert(false); // unreachable
+    }
+
+    if (options->pre_rotate != 0) {
+      printf("pre-rotate: %d\n", options->pre_rotate);
+    }
+    printf("pre-mirror: %s\n", direction_to_string(options->pre_mirror));
+    if (options->pre_shift.horizontal != 0 ||
+        options->pre_shift.vertical != 0) {
+      printf("pre-shift: [%" PRId32 ",%" PRId32 "]\n",
+             options->pre_shift.horizontal, options->pre_shift.vertical);
+    }
+    if (options->pre_wipes.count > 0) {
+      printf("pre-wipe: ");
+      for (size_t i = 0; i < options->pre_wipes.count; i++) {
+        print_rectangle(options->pre_wipes.areas[i]);
+      }
+      printf("\n");
+    }
+    if (memcmp(&options->pre_border, &BORDER_NULL, sizeof(BORDER_NULL)) != 0) {
+      printf("pre-border: ");
+      print_border(options->pre_border);
+      printf("\n");
+    }
+    if (options->pre_masks_count > 0) {
+      printf("pre-masking: ");
+      for (int i = 0; i < options->pre_masks_count; i++) {
+        print_rectangle(options->pre_masks[i]);
+      }
+      printf("\n");
+    }
+    if (options->stretch_size.width != -1 ||
+        options->stretch_size.height != -1) {
+      printf("stretch to: %" PRId32 "x%" PRId32 "\n",
+             options->stretch_size.width, options->stretch_size.height);
+    }
+    if (options->post_stretch_size.width != -1 ||
+        options->post_stretch_size.height != -1) {
+      printf("post-stretch to: %" PRId32 "x%" PRId32 "d\n",
+             options->post_stretch_size.width,
+             options->post_stretch_size.height);
+    }
+    if (options->pre_zoom_factor != 1.0) {
+      printf("zoom: %f\n", options->pre_zoom_factor);
+    }
+    if (options->post_zoom_factor != 1.0) {
+      printf("post-zoom: %f\n", options->post_zoom_factor);
+    }
+    if (options->no_blackfilter_multi_index.count != -1) {
+      printf("blackfilter-scan-direction: %s\n",
+             direction_to_string(
+                 options->blackfilter_parameters.scan_direction));
+      printf("blackfilter-scan-size: ");
+      print_rectangle_size(options->blackfilter_parameters.scan_size);
+      printf("\nblackfilter-scan-depth: [%d,%d]\n",
+             options->blackfilter_parameters.scan_depth.horizontal,
+             options->blackfilter_parameters.scan_depth.vertical);
+      printf("blackfilter-scan-step: ");
+      print_delta(options->blackfilter_parameters.scan_step);
+      printf("\nblackfilter-scan-threshold: %d\n",
+             options->blackfilter_parameters.abs_threshold);
+      if (options->blackfilter_parameters.exclusions_count > 0) {
+        printf("blackfilter-scan-exclude: ");
+        for (size_t i = 0;
+             i < options->blackfilter_parameters.exclusions_count; i++) {
+          print_rectangle(options->blackfilter_parameters.exclusions[i]);
+        }
+        printf("\n");
+      }
+      printf("blackfilter-intensity: %d\n",
+             options->blackfilter_parameters.intensity);
+      if (options->no_blackfilter_multi_index.count > 0) {
+        printf("blackfilter DISABLED for sheets: ");
+        printMultiIndex(options->no_blackfilter_multi_index);
+      }
+    } else {
+      printf("blackfilter DISABLED for all sheets.\n");
+    }
+    if (options->no_noisefilter_multi_index.count != -1) {
+      printf("noisefilter-intensity: %" PRIu64 "\n",
+             options->noisefilter_intensity);
+      if (options->no_noisefilter_multi_index.count > 0) {
+        printf("noisefilter DISABLED for sheets: ");
+        printMultiIndex(options->no_noisefilter_multi_index);
+      }
+    } else {
+      printf("noisefilter DISABLED for all sheets.\n");
+    }
+    if (options->no_blurfilter_multi_index.count != -1) {
+      printf("blurfilter-size: ");
+      print_rectangle_size(options->blurfilter_parameters.scan_size);
+      printf("\nblurfilter-step: ");
+      print_delta(options->blurfilter_parameters.scan_step);
+      printf("\nblurfilter-intensity: %f\n",
+             options->blurfilter_parameters.intensity);
+      if (options->no_blurfilter_multi_index.count > 0) {
+        printf("blurfilter DISABLED for sheets: ");
+        printMultiIndex(options->no_blurfilter_multi_index);
+      }
+    } else {
+      printf("blurfilter DISABLED for all sheets.\n");
+    }
+    if (options->no_grayfilter_multi_index.count != -1) {
+      printf("grayfilter-size: ");
+      print_rectangle_size(options->grayfilter_parameters.scan_size);
+      printf("\ngrayfilter-step: ");
+      print_delta(options->grayfilter_parameters.scan_step);
+      printf("\ngrayfilter-threshold: %d\n",
+             options->grayfilter_parameters.abs_threshold);
+      if (options->no_grayfilter_multi_index.count > 0) {
+        printf("grayfilter DISABLED for sheets: ");
+        printMultiIndex(options->no_grayfilter_multi_index);
+      }
+    } else {
+      printf("grayfilter DISABLED for all sheets.\n");
+    }
+    if (options->no_mask_scan_multi_index.count != -1) {
+      printf("mask points: ");
+      for (size_t i = 0; i < options->points_count; i++) {
+        printf("(%d,%d) ", options->points[i].x, options->points[i].y);
+      }
+      printf("\n");
+      printf("mask-scan-direction: %s\n",
+             direction_to_string(
+                 options->mask_detection_parameters.scan_direction));
+      printf("mask-scan-size: ");
+      print_rectangle_size(options->mask_detection_parameters.scan_size);
+      printf("\nmask-scan-depth: [%d,%d]\n",
+             options->mask_detection_parameters.scan_depth.horizontal,
+             options->mask_detection_parameters.scan_depth.vertical);
+      printf("mask-scan-step: ");
+      print_delta(options->mask_detection_parameters.scan_step);
+      printf("\nmask-scan-threshold: [%f,%f]\n",
+             options->mask_detection_parameters.scan_threshold.horizontal,
+             options->mask_detection_parameters.scan_threshold.vertical);
+      printf("mask-scan-minimum: [%d,%d]\n",
+             options->mask_detection_parameters.minimum_width,
+             options->mask_detection_parameters.minimum_height);
+      printf("mask-scan-maximum: [%d,%d]\n",
+             options->mask_detection_parameters.maximum_width,
+             options->mask_detection_parameters.maximum_height);
+      printf("mask-color: ");
+      print_color(options->mask_color);
+      printf("\n");
+      if (options->no_mask_scan_multi_index.count > 0) {
+        printf("mask-scan DISABLED for sheets: ");
+        printMultiIndex(options->no_mask_scan_multi_index);
+      }
+    } else {
+      printf("mask-scan DISABLED for all sheets.\n");
+    }
+    if (options->no_deskew_multi_index.count != -1) {
+      printf("deskew-method: %s\n",
+             deskew_method_to_string(options->deskew_parameters.method));
+      printf("deskew-scan-direction: ");
+      print_edges(options->deskew_parameters.scan_edges);
+      printf("deskew-scan-size: %d\n",
+             options->deskew_parameters.deskewScanSize);
+      printf("deskew-scan-depth: %f\n",
+             options->deskew_parameters.deskewScanDepth);
+      printf("deskew-scan-range: %f\n",
+             options->deskew_parameters.deskewScanRangeRad);
+      printf("deskew-scan-step: %f\n",
+             options->deskew_parameters.deskewScanStepRad);
+      printf("deskew-scan-deviation: %f\n",
+             options->deskew_parameters.deskewScanDeviationRad);
+      if (options->no_deskew_multi_index.count > 0) {
+        printf("deskew-scan DISABLED for sheets: ");
+        printMultiIndex(options->no_deskew_multi_index);
+      }
+    } else {
+      printf("deskew-scan DISABLED for all sheets.\n");
+    }
+    if (options->no_wipe_multi_index.count != -1) {
+      if (options->wipes.count > 0) {
+        printf("wipe areas: ");
+        for (size_t i = 0; i < options->wipes.count; i++) {
+          print_rectangle(options->wipes.areas[i]);
+        }
+        printf("\n");
+      }
+    } else {
+      printf("wipe DISABLED for all sheets.\n");
+    }
+    if (options->middle_wipe[0] > 0 || options->middle_wipe[1] > 0) {
+      printf("middle-wipe (l,r): %d,%d\n", options->middle_wipe[0],
+             options->middle_wipe[1]);
+    }
+    if (options->no_border_multi_index.count != -1) {
+      if (memcmp(&options->border, &BORDER_NULL, sizeof(BORDER_NULL)) != 0) {
+        printf("explicit border: ");
+        print_border(options->border);
+        printf("\n");
+      }
+    } else {
+      printf("border DISABLED for all sheets.\n");
+    }
+    if (options->no_border_scan_multi_index.count != -1) {
+      printf("border-scan-direction: %s\n",
+             direction_to_string(
+                 options->border_scan_parameters.scan_direction));
+      printf("border-scan-size: ");
+      print_rectangle_size(options->border_scan_parameters.scan_size);
+      printf("\nborder-scan-step: ");
+      print_delta(options->border_scan_parameters.scan_step);
+      printf("\nborder-scan-threshold: [%d,%d]\n",
+             options->border_scan_parameters.scan_threshold.horizontal,
+             options->border_scan_parameters.scan_threshold.vertical);
+      if (options->no_border_scan_multi_index.count > 0) {
+        printf("border-scan DISABLED for sheets: ");
+        printMultiIndex(options->no_border_scan_multi_index);
+      }
+      printf("border-align: ");
+      print_edges(options->mask_alignment_parameters.alignment);
+      printf("border-margin: [%d,%d]\n",
+             options->mask_alignment_parameters.margin.horizontal,
+             options->mask_alignment_parameters.margin.vertical);
+    } else {
+      printf("border-scan DISABLED for all sheets.\n");
+    }
+    if (options->post_wipes.count > 0) {
+      printf("post-wipe: ");
+      for (size_t i = 0; i < options->post_wipes.count; i++) {
+        print_rectangle(options->post_wipes.areas[i]);
+      }
+      printf("\n");
+    }
+    if (memcmp(&options->post_border, &BORDER_NULL, sizeof(BORDER_NULL)) != 0) {
+      printf("post-border: ");
+      print_border(options->post_border);
+      printf("\n");
+    }
+    printf("post-mirror: %s\n", direction_to_string(options->post_mirror));
+    if (options->post_shift.horizontal != 0 ||
+        options->post_shift.vertical != 0) {
+      printf("post-shift: [%" PRId32 ",%" PRId32 "]\n",
+             options->post_shift.horizontal, options->post_shift.vertical);
+    }
+    if (options->post_rotate != 0) {
+      printf("post-rotate: %d\n", options->post_rotate);
+    }
+    // if (options->ignoreMultiIndex.count > 0) {
+    //    printf("EXCLUDE sheets: ");
+    //    printMultiIndex(options->ignoreMultiIndex);
+    //}
+    printf("white-threshold: %d\n", options->abs_white_threshold);
+    printf("black-threshold: %d\n", options->abs_black_threshold);
+    printf("sheet-background: ");
+    print_color(options->sheet_background);
+    printf("\n");
+    printf("input-files per sheet: %d\n", options->input_count);
+    printf("output-files per sheet: %d\n", options->output_count);
+    if (options->sheet_size.width != -1 || options->sheet_size.height != -1) {
+      printf("sheet size forced to: %" PRId32 " x %" PRId32 " pixels\n",
+             options->sheet_size.width, options->sheet_size.height);
+    }
+    printf("input-file-sequence:  %s\n",
+           implode(s1, (const char **)inputFileNames, options->input_count));
+    printf(
+        "output-file-sequence: %s\n",
+        implode(s1, (const char **)outputFileNames, options->output_count));
+    if (options->overwrite_output) {
+      printf("OVERWRITING EXISTING FILES\n");
+    }
+    printf("\n");
+
+    fflush(stdout);
+    funlockfile(stdout);
+  }
+  verboseLog(VERBOSE_NORMAL, "input-file%s for sheet %d: %s\n",
+             pluralS(options->input_count), nr,
+             implode(s1, (const char **)inputFileNames, options->input_count));
+  verboseLog(
+      VERBOSE_NORMAL, "output-file%s for sheet %d: %s\n",
+      pluralS(options->output_count), nr,
+      implode(s1, (const char **)outputFileNames, options->output_count));
+  verboseLog(VERBOSE_NORMAL, "sheet size: %dx%d\n", sheet.frame->width,
+             sheet.frame->height);
+  verboseLog(VERBOSE_NORMAL, "...\n");
+
+  // -------------------------------------------------------
+  // --- process image data                              ---
+  // -------------------------------------------------------
+
+  // stretch
+  started = stage_start();
+  inputSize = coerce_size(options->stretch_size, size_of_image(sheet));
+
+  inputSize.width *= options->pre_zoom_factor;
+  inputSize.height *= options->pre_zoom_factor;
+
+  // only count the pixels of the sheets actually stretched or resized
+  uint64_t stretchedPixels = 0;
+  saveDebug("_before-stretch%d.pnm", nr, sheet);
+  if (compare_sizes(size_of_image(sheet), inputSize) != 0) {
+    stretch_and_replace(&sheet, inputSize, options->interpolate_type);
+    stretchedPixels += image_pixels(sheet);
+  }
+  saveDebug("_after-stretch%d.pnm", nr, sheet);
+
+  // size
+  if (options->page_size.width != -1 || options->page_size.height != -1) {
+    inputSize = coerce_size(options->page_size, size_of_image(sheet));
+    saveDebug("_before-resize%d.pnm", nr, sheet);
+    if (compare_sizes(size_of_image(sheet), inputSize) != 0) {
+      resize_and_replace(&sheet, inputSize, options->interpolate_type);
+      stretchedPixels += image_pixels(sheet);
+    }
+    saveDebug("_after-resize%d.pnm", nr, sheet);
+  }
+  stage_record(job->timings, STAGE_STRETCH, started, stretchedPixels, 0);
+
+  // handle sheet layout
+
+  // Settings derived from the size of the sheet, unless set explicitly.
+  size_t pointCount = options->points_count;
+  Point points[MAX_POINTS];
+  memcpy(points, options->points, sizeof(points));
+  size_t maskCount = options->masks_count;
+  Rectangle masks[MAX_MASKS];
+  memcpy(masks, options->masks, sizeof(masks));
+  Rectangle outsideBorderscanMask[MAX_PAGES];
+  size_t outsideBorderscanMaskCount = 0;
+  Wipes wipes = options->wipes;
+  MaskDetectionParameters mask_detection_parameters =
+      options->mask_detection_parameters;
+  BlackfilterParameters blackfilter_parameters =
+      options->blackfilter_parameters;
+  Rectangle blackfilterExclude[MAX_MASKS];
+  memcpy(blackfilterExclude, blackfilter_parameters.exclusions,
+         blackfilter_parameters.exclusions_count * sizeof(Rectangle));
+  blackfilter_parameters.exclusions = blackfilterExclude;
+
+  // LAYOUT_SINGLE
+  if (options->layout == LAYOUT_SINGLE) {
+    // set middle of sheet as single starting point for mask detection
+    if (pointCount == 0) { // no manual settings, use auto-values
+      points[pointCount++] =
+          (Point){sheet.frame->width / 2, sheet.frame->height / 2};
+    }
+    if (mask_detection_parameters.maximum_width == -1) {
+      mask_detection_parameters.maximum_width = sheet.frame->width;
+    }
+    if (mask_detection_parameters.maximum_height == -1) {
+      mask_detection_parameters.maximum_height = sheet.frame->height;
+    }
+    // avoid inner half of the sheet to be blackfilter-detectable
+    if (blackfilter_parameters.exclusions_count == 0) {
+      // no manual settings, use auto-values
+      RectangleSize sheetSize = size_of_image(sheet);
+      blackfilter_parameters
+          .exclusions[blackfilter_parameters.exclusions_count++] =
+          rectangle_from_size(
+              (Point){sheetSize.width / 4, sheetSize.height / 4},
+              (RectangleSize){.width = sheetSize.width / 2,
+                              .height = sheetSize.height / 2});
+    }
+    // set single outside border to start scanning for final border-scan
+    if (outsideBorderscanMaskCount ==
+        0) { // no manual settings, use auto-values
+      outsideBorderscanMask[outsideBorderscanMaskCount++] = full_image(sheet);
+    }
+
+    // LAYOUT_DOUBLE
+  } else if (options->layout == LAYOUT_DOUBLE) {
+    // set two middle of left/right side of sheet as starting points for
+    // mask detection
+    if (pointCount == 0) { // no manual settings, use auto-values
+      points[pointCount++] =
+          (Point){sheet.frame->width / 4, sheet.frame->height / 2};
+      points[pointCount++] =
+          (Point){sheet.frame->width - sheet.frame->width / 4,
+                  sheet.frame->height / 2};
+    }
+    if (mask_detection_parameters.maximum_width == -1) {
+      mask_detection_parameters.maximum_width = sheet.frame->width / 2;
+    }
+    if (mask_detection_parameters.maximum_height == -1) {
+      mask_detection_parameters.maximum_height = sheet.frame->height;
+    }
+    if (options->middle_wipe[0] > 0 ||
+        options->middle_wipe[1] > 0) { // left, right
+      wipes.areas[wipes.count++] = (Rectangle){{
+          {sheet.frame->width / 2 - options->middle_wipe[0], 0},
+          {sheet.frame->width / 2 + options->middle_wipe[1],
+           sheet.frame->height - 1},
+      }};
+    }
+    // avoid inner half of each page to be blackfilter-detectable
+    if (blackfilter_parameters.exclusions_count == 0) {
+      // no manual settings, use auto-values
+      RectangleSize sheetSize = size_of_image(sheet);
+      RectangleSize filterSize = {
+          .width = sheetSize.width / 4,
+          .height = sheetSize.height / 2,
+      };
+      Point firstFilterOrigin = {sheetSize.width / 8, sheetSize.height / 4};
+      Point secondFilterOrigin =
+          shift_point(firstFilterOrigin, (Delta){sheet.frame->width / 2});
+
+      blackfilter_parameters
+          .exclusions[blackfilter_parameters.exclusions_count++] =
+          rectangle_from_size(firstFilterOrigin, filterSize);
+      blackfilter_parameters
+          .exclusions[blackfilter_parameters.exclusions_count++] =
+          rectangle_from_size(secondFilterOrigin, filterSize);
+    }
+    // set two outside borders to start scanning for final border-scan
+    if (outsideBorderscanMaskCount ==
+        0) { // no manual settings, use auto-values
+      outsideBorderscanMask[outsideBorderscanMaskCount++] =
+          (Rectangle){{POINT_ORIGIN,
+                       {sheet.frame->width / 2, sheet.frame->height - 1}}};
+      outsideBorderscanMask[outsideBorderscanMaskCount++] =
+          (Rectangle){{{sheet.frame->width / 2, 0},
+                       {sheet.frame->width - 1, sheet.frame->height - 1}}};
+    }
+  }
+  // if maskScanMaximum still unset (no --layout specified), set to full
+  // sheet size now
+  if (mask_detection_parameters.maximum_width == -1) {
+    mask_detection_parameters.maximum_width = sheet.frame->width;
+  }
+  if (mask_detection_parameters.maximum_height == -1) {
+    mask_detection_parameters.maximum_height = sheet.frame->height;
+  }
+
+  // pre-wipe
+  if (!isExcluded(nr, options->no_wipe_multi_index,
+                  options->ignore_multi_index)) {
+    apply_wipes(sheet, options->pre_wipes, options->mask_color);
+  }
+
+  // pre-border
+  if (!isExcluded(nr, options->no_border_multi_index,
+                  options->ignore_multi_index)) {
+    apply_border(sheet, options->pre_border, options->mask_color);
+  }
+
+  // black area filter
+  if (!isExcluded(nr, options->no_blackfilter_multi_index,
+                  options->ignore_multi_index)) {
+    saveDebug("_before-blackfilter%d.pnm", nr, sheet);
+    started = stage_start();
+    const uint64_t floodFills = blackfilter(sheet, blackfilter_parameters);
+    stage_record(job->timings, STAGE_BLACKFILTER, started, image_pixels(sheet),
+                 floodFills);
+    saveDebug("_after-blackfilter%d.pnm", nr, sheet);
+  } else {
+    verboseLog(VERBOSE_MORE, "+ blackfilter DISABLED for sheet %d\n", nr);
+  }
+
+  // noise filter
+  if (!isExcluded(nr, options->no_noisefilter_multi_index,
+                  options->ignore_multi_index)) {
+    saveDebug("_before-noisefilter%d.pnm", nr, sheet);
+    started = stage_start();
+    const uint64_t clusters = noisefilter(
+        sheet, options->noisefilter_intensity, options->abs_white_threshold);
+    stage_record(job->timings, STAGE_NOISEFILTER, started, image_pixels(sheet),
+                 clusters);
+    saveDebug("_after-noisefilter%d.pnm", nr, sheet);
+  } else {
+    verboseLog(VERBOSE_MORE, "+ noisefilter DISABLED for sheet %d\n", nr);
+  }
+
+  // blur filter
+  if (!isExcluded(nr, options->no_blurfilter_multi_index,
+                  options->ignore_multi_index)) {
+    saveDebug("_before-blurfilter%d.pnm", nr, sheet);
+    started = stage_start();
+    const uint64_t blurred = blurfilter(sheet, options->blurfilter_parameters,
+                                        options->abs_white_threshold);
+    stage_record(job->timings, STAGE_BLURFILTER, started, image_pixels(sheet),
+                 blurred);
+    saveDebug("_after-blurfilter%d.pnm", nr, sheet);
+  } else {
+    verboseLog(VERBOSE_MORE, "+ blurfilter DISABLED for sheet %d\n", nr);
+  }
+
+  // mask-detection
+  if (!isExcluded(nr, options->no_mask_scan_multi_index,
+                  options->ignore_multi_index)) {
+    started = stage_start();
+    const size_t detectedCount = detect_masks(sheet, mask_detection_parameters,
+                                              points, pointCount, masks);
+    stage_record(job->timings, STAGE_MASK_SCAN, started,
+                 masks_pixels(masks, detectedCount), detectedCount);
+  } else {
+    verboseLog(VERBOSE_MORE, "+ mask-scan DISABLED for sheet %d\n", nr);
+  }
+
+  // permanently apply masks
+  if (maskCount > 0) {
+    saveDebug("_before-masking%d.pnm", nr, sheet);
+    started = stage_start();
+    apply_masks(sheet, masks, maskCount, options->mask_color);
+    stage_record(job->timings, STAGE_MASKING, started, image_pixels(sheet),
+                 maskCount);
+    saveDebug("_after-masking%d.pnm", nr, sheet);
+  }
+
+  // gray filter
+  if (!isExcluded(nr, options->no_grayfilter_multi_index,
+                  options->ignore_multi_index)) {
+    saveDebug("_before-grayfilter%d.pnm", nr, sheet);
+    started = stage_start();
+    const uint64_t grayed = grayfilter(sheet, options->grayfilter_parameters);
+    stage_record(job->timings, STAGE_GRAYFILTER, started, image_pixels(sheet),
+                 grayed);
+    saveDebug("_after-grayfilter%d.pnm", nr, sheet);
+  } else {
+    verboseLog(VERBOSE_MORE, "+ grayfilter DISABLED for sheet %d\n", nr);
+  }
+
+  // rotation-detection
+  if ((!isExcluded(nr, options->no_deskew_multi_index,
+                   options->ignore_multi_index))) {
+    saveDebug("_before-deskew%d.pnm", nr, sheet);
+
+    // detect masks again, we may get more precise results now after first
+    // masking and grayfilter
+    if (!isExcluded(nr, options->no_mask_scan_multi_index,
+                    options->ignore_multi_index)) {
+      started = stage_start();
+      maskCount = detect_masks(sheet, mask_detection_parameters, points,
+                               pointCount, masks);
+      stage_record(job->timings, STAGE_MASK_SCAN, started,
+                   masks_pixels(masks, maskCount), maskCount);
+    } else {
+      verboseLog(VERBOSE_MORE, "(mask-scan before deskewing disabled)\n");
+    }
+
+    // auto-deskew each mask; the rotations of masks that do not intersect can
+    // all be detected before deskewing any of them
+    float rotations[MAX_MASKS];
+    bool detectTogether = maskCount > 1;
+    for (size_t i = 0; i < maskCount; i++) {
+      for (size_t j = 0; j < i; j++) {
+        if (rectangles_intersect(masks[i], masks[j])) {
+          detectTogether = false;
+        }
+      }
+    }
+    if (detectTogether) {
+      started = stage_start();
+      detect_rotations(sheet, masks, maskCount, options->deskew_parameters,
+                       rotations);
+      stage_record(job->timings, STAGE_DESKEW_DETECT, started,
+                   masks_pixels(masks, maskCount), 0);
+    }
+
+    for (size_t i = 0; i < maskCount; i++) {
+      const uint64_t maskPixels = count_pixels(masks[i]);
+
+      if (!detectTogether) {
+        started = stage_start();
+        rotations[i] =
+            detect_rotation(sheet, masks[i], options->deskew_parameters);
+        stage_record(job->timings, STAGE_DESKEW_DETECT, started, maskPixels,
+                     0);
+      }
+      const float rotation = rotations[i];
+
+      verboseLog(VERBOSE_NORMAL, "rotate (%d,%d): %f\n", points[i].x,
+                 points[i].y, rotation);
+
+      if (rotation != 0.0) {
+        saveDebug("_before-deskew-detect%d.pnm", nr * maskCount + i, sheet);
+        started = stage_start();
+        deskew(sheet, masks[i], rotation, options->interpolate_type);
+        stage_record(job->timings, STAGE_DESKEW_ROTATE, started, maskPixels, 1);
+        saveDebug("_after-deskew-detect%d.pnm", nr * maskCount + i, sheet);
+      }
+    }
+
+    saveDebug("_after-deskew%d.pnm", nr, sheet);
+  } else {
+    verboseLog(VERBOSE_MORE, "+ deskewing DISABLED for sheet %d\n", nr);
+  }
+
+  // auto-center masks on either single-page or double-page layout
+  if (!isExcluded(
+          nr, options->no_mask_center_multi_index,
+          options->ignore_multi_index)) { // (maskCount==pointCount to
+                                         // make sure all masks had
+                                         // correctly been detected)
+    // perform auto-masking again to get more precise masks after rotation
+    if (!isExcluded(nr, options->no_mask_scan_multi_index,
+                    options->ignore_multi_index)) {
+      started = stage_start();
+      maskCount = detect_masks(sheet, mask_detection_parameters, points,
+                               pointCount, masks);
+      stage_record(job->timings, STAGE_MASK_SCAN, started,
+                   masks_pixels(masks, maskCount), maskCount);
+    } else {
+      verboseLog(VERBOSE_MORE, "(mask-scan before centering disabled)\n");
+    }
+
+    saveDebug("_before-centering%d.pnm", nr, sheet);
+    started = stage_start();
+    // center masks on the sheet, according to their page position
+    for (int i = 0; i < maskCount; i++) {
+      center_mask(sheet, points[i], masks[i]);
+    }
+    stage_record(job->timings, STAGE_CENTERING, started,
+                 masks_pixels(masks, maskCount), 0);
+    saveDebug("_after-centering%d.pnm", nr, sheet);
+  } else {
+    verboseLog(VERBOSE_MORE, "+ auto-centering DISABLED for sheet %d\n", nr);
+  }
+
+  // explicit wipe
+  uint64_t postPixels = 0;
+  started = stage_start();
+  if (!isExcluded(nr, options->no_wipe_multi_index,
+                  options->ignore_multi_index)) {
+    apply_wipes(sheet, wipes, options->mask_color);
+    postPixels += masks_pixels(wipes.areas, wipes.count);
+  } else {
+    verboseLog(VERBOSE_MORE, "+ wipe DISABLED for sheet %d\n", nr);
+  }
+
+  // explicit border
+  if (!isExcluded(nr, options->no_border_multi_index,
+                  options->ignore_multi_index)) {
+    apply_border(sheet, options->border, options->mask_color);
+    postPixels += border_pixels(sheet, options->border);
+  } else {
+    verboseLog(VERBOSE_MORE, "+ border DISABLED for sheet %d\n", nr);
+  }
+  stage_record(job->timings, STAGE_POST, started, postPixels, 0);
+
+  // border-detection
+  if (!isExcluded(nr, options->no_border_scan_multi_index,
+                  options->ignore_multi_index)) {
+    Rectangle autoborderMask[outsideBorderscanMaskCount];
+    saveDebug("_before-border%d.pnm", nr, sheet);
+    started = stage_start();
+    for (int i = 0; i < outsideBorderscanMaskCount; i++) {
+      autoborderMask[i] = border_to_mask(
+          sheet, detect_border(sheet, options->border_scan_parameters,
+                               outsideBorderscanMask[i]));
+    }
+    apply_masks(sheet, autoborderMask, outsideBorderscanMaskCount,
+                options->mask_color);
+    for (int i = 0; i < outsideBorderscanMaskCount; i++) {
+      // border-centering
+      if (!isExcluded(nr, options->no_border_align_multi_index,
+                      options->ignore_multi_index)) {
+        align_mask(sheet, autoborderMask[i], outsideBorderscanMask[i],
+                   options->mask_alignment_parameters);
+      } else {
+        verboseLog(VERBOSE_MORE,
+                   "+ border-centering DISABLED for sheet %d\n", nr);
+      }
+    }
+    stage_record(job->timings, STAGE_BORDER_SCAN, started,
+                 masks_pixels(outsideBorderscanMask,
+                              outsideBorderscanMaskCount),
+                 0);
+    saveDebug("_after-border%d.pnm", nr, sheet);
+  } else {
+    verboseLog(VERBOSE_MORE, "+ border-scan DISABLED for sheet %d\n", nr);
+  }
+
+  // post-wipe
+  postPixels = 0;
+  started = stage_start();
+  if (!isExcluded(nr, options->no_wipe_multi_index,
+                  options->ignore_multi_index)) {
+    apply_wipes(sheet, options->post_wipes, options->mask_color);
+    postPixels +=
+        masks_pixels(options->post_wipes.areas, options->post_wipes.count);
+  }
+
+  // post-border
+  if (!isExcluded(nr, options->no_border_multi_index,
+                  options->ignore_multi_index)) {
+    apply_border(sheet, options->post_border, options->mask_color);
+    postPixels += border_pixels(sheet, options->post_border);
+  }
+
+  // post-mirroring
+  if (options->post_mirror.horizontal || options->post_mirror.vertical) {
+    verboseLog(VERBOSE_NORMAL, "post-mirroring %s\n",
+               direction_to_string(options->post_mirror));
+    mirror(sheet, options->post_mirror);
+    postPixels += image_pixels(sheet);
+  }
+
+  // post-shifting
+  if ((options->post_shift.horizontal != 0) ||
+      ((options->post_shift.vertical != 0))) {
+    verboseLog(VERBOSE_NORMAL, "post-shifting [%" PRId32 ",%" PRId32 "]\n",
+               options->post_shift.horizontal, options->post_shift.vertical);
+
+    shift_image(&sheet, options->post_shift);
+    postPixels += image_pixels(sheet);
+  }
+
+  // post-rotating
+  if (options->post_rotate != 0) {
+    verboseLog(VERBOSE_NORMAL, "post-rotating %d degrees.\n",
+               options->post_rotate);
+    flip_rotate_90(&sheet, options->post_rotate / 90);
+    postPixels += image_pixels(sheet);
+  }
+
+  // post-stretch
+  inputSize = coerce_size(options->post_stretch_size, size_of_image(sheet));
+
+  inputSize.width *= options->post_zoom_factor;
+  inputSize.height *= options->post_zoom_factor;
+
+  if (compare_sizes(size_of_image(sheet), inputSize) != 0) {
+    stretch_and_replace(&sheet, inputSize, options->interpolate_type);
+    postPixels += image_pixels(sheet);
+  }
+
+  // post-size
+  if (options->post_page_size.width != -1 ||
+      options->post_page_size.height != -1) {
+    inputSize = coerce_size(options->post_page_size, size_of_image(sheet));
+    if (compare_sizes(size_of_image(sheet), inputSize) != 0) {
+      resize_and_replace(&sheet, inputSize, options->interpolate_type);
+      postPixels += image_pixels(sheet);
+    }
+  }
+  stage_record(job->timings, STAGE_POST, started, postPixels, 0);
+
+  // --- write output file ---
+
+  // write split pages output
+
+  if (options->write_output) {
+    verboseLog(VERBOSE_NORMAL, "writing output.\n");
+    // write files
+    saveDebug("_before-save%d.pnm", nr, sheet);
+
+    for (int j = 0; j < options->output_count; j++) {
+      // The pages are views of the sheet, keeping its pixels around until
+      // saved.
+      const int32_t page_width = sheet.frame->width / options->output_count;
+      Image page = image_view(
+          sheet, rectangle_from_size(
+                     (Point){page_width * j, 0},
+                     (RectangleSize){page_width, sheet.frame->height}));
+
+      PageWrite *write = malloc(sizeof(PageWrite));
+      if (write == NULL) {
+        errOutput("unable to allocate output page.");
+      }
+      snprintf(write->filename, PATH_MAX, "%s", outputFileNames[j]);
+      write->page = page;
+      write->pixel_format = outputPixelFormat;
+      write->timings = job->timings;
+      sheet_timings_hold(job->timings);
+
+      worker_pool_submit(job->writer, write_page, write);
+    }
+  }
+
+  free_image(&sheet);
+
+  sheet_timings_release(&job->timings);
+  free(job);
+}
+
 /****************************************************************************
  * MAIN()                                                                   *
  ****************************************************************************/
@@ -152,15 +1317,6 @@ int main(int argc, char *argv[]) {
   Options options;
 
   // The variables in the following block need to stay allocated becuse the
-  size_t pointCount = 0;
-  Point points[MAX_POINTS];
-  size_t maskCount = 0;
-  Rectangle masks[MAX_MASKS];
-  size_t preMaskCount = 0;
-  Rectangle preMasks[MAX_MASKS];
-  int32_t middleWipe[2] = {0, 0};
-  Rectangle outsideBorderscanMask[MAX_PAGES]; // set by --layout
-  size_t outsideBorderscanMaskCount = 0;
   Rectangle blackfilterExclude[MAX_MASKS]; // Required to stay allocated!
 
   // -------------------------------------------------------------------
@@ -180,6 +1336,7 @@ int main(int argc, char *argv[]) {
     float deskewScanRange = 5.0;
     float deskewScanStep = 0.1;
     float deskewScanDeviation = 1.0;
+    DeskewMethod deskewMethod = DESKEW_METHOD_EDGES;
     Direction maskScanDirections = DIRECTION_HORIZONTAL;
     RectangleSize maskScanSize = {50, 50};
     int32_t maskScanDepth[DIRECTIONS_COUNT] = {-1, -1};
@@ -343,6 +1500,7 @@ int main(int argc, char *argv[]) {
           {"deskew-scan-deviation", required_argument, NULL,
            OPT_DESKEW_SCAN_DEVIATION},
           {"dv", required_argument, NULL, OPT_DESKEW_SCAN_DEVIATION},
+          {"deskew-method", required_argument, NULL, OPT_DESKEW_METHOD},
           {"no-border-scan", optional_argument, NULL, OPT_NO_BORDER_SCAN},
           {"border-scan-direction", required_argument, NULL,
            OPT_BORDER_SCAN_DIRECTION},
@@ -389,6 +1547,12 @@ int main(int argc, char *argv[]) {
           {"debug-save", no_argument, NULL, OPT_DEBUG_SAVE},
           {"vvvv", no_argument, NULL, OPT_DEBUG_SAVE},
           {"interpolate", required_argument, NULL, OPT_INTERPOLATE},
+          {"jobs", required_argument, NULL, OPT_JOBS},
+          {"threads", required_argument, NULL, OPT_THREADS},
+          {"read-ahead", required_argument, NULL, OPT_READ_AHEAD},
+          {"write-behind", required_argument, NULL, OPT_WRITE_BEHIND},
+          {"timings", required_argument, NULL, OPT_TIMINGS},
+          {"input-format", required_argument, NULL, OPT_INPUT_FORMAT},
           {NULL, no_argument, NULL, 0}};
 
       c = getopt_long_only(argc, argv, "hVl:S:x::n::M:s:z:p:m:W:B:w:b:Tt:qv",
@@ -495,9 +1659,10 @@ int main(int argc, char *argv[]) {
         break;
 
       case OPT_PRE_MASK:
-        if (preMaskCount < MAX_MASKS) {
-          if (parse_rectangle(optarg, &preMasks[preMaskCount])) {
-            preMaskCount++;
+        if (options.pre_masks_count < MAX_MASKS) {
+          if (parse_rectangle(optarg,
+                              &options.pre_masks[options.pre_masks_count])) {
+            options.pre_masks_count++;
           }
         } else {
           fprintf(stderr,
@@ -531,11 +1696,11 @@ int main(int argc, char *argv[]) {
         break;
 
       case 'p':
-        if (pointCount < MAX_POINTS) {
+        if (options.points_count < MAX_POINTS) {
           int x = -1;
           int y = -1;
           sscanf(optarg, "%d,%d", &x, &y);
-          points[pointCount++] = (Point){x, y};
+          options.points[options.points_count++] = (Point){x, y};
         } else {
           fprintf(stderr,
                   "maximum number of scan points (%d) exceeded, ignoring scan "
@@ -545,9 +1710,9 @@ int main(int argc, char *argv[]) {
         break;
 
       case 'm':
-        if (maskCount < MAX_MASKS) {
-          if (parse_rectangle(optarg, &masks[maskCount])) {
-            maskCount++;
+        if (options.masks_count < MAX_MASKS) {
+          if (parse_rectangle(optarg, &options.masks[options.masks_count])) {
+            options.masks_count++;
           }
         } else {
           fprintf(stderr,
@@ -569,7 +1734,8 @@ int main(int argc, char *argv[]) {
         break;
 
       case OPT_MIDDLE_WIPE:
-        if (!parse_symmetric_integers(optarg, &middleWipe[0], &middleWipe[1])) {
+        if (!parse_symmetric_integers(optarg, &options.middle_wipe[0],
+                                      &options.middle_wipe[1])) {
           errOutput("unable to parse middle-wipe: '%s'", optarg);
         }
         break;
@@ -780,6 +1946,12 @@ int main(int argc, char *argv[]) {
         sscanf(optarg, "%f", &deskewScanDeviation);
         break;
 
+      case OPT_DESKEW_METHOD:
+        if (!parse_deskew_method(optarg, &deskewMethod)) {
+          errOutput("unable to parse deskew-method: '%s'", optarg);
+        }
+        break;
+
       case OPT_NO_BORDER_SCAN:
         parseMultiIndex(optarg, &options.no_border_scan_multi_index);
         break;
@@ -931,6 +2103,41 @@ int main(int argc, char *argv[]) {
           errOutput("unable to parse interpolate: '%s'", optarg);
         }
         break;
+
+      case OPT_JOBS:
+        if (sscanf(optarg, "%d", &options.jobs) != 1 || options.jobs < 1) {
+          errOutput("unable to parse jobs: '%s'", optarg);
+        }
+        break;
+
+      case OPT_THREADS:
+        if (sscanf(optarg, "%d", &options.threads) != 1 ||
+            options.threads < 1) {
+          errOutput("unable to parse threads: '%s'", optarg);
+        }
+        break;
+
+      case OPT_READ_AHEAD:
+        if (sscanf(optarg, "%d", &options.read_ahead) != 1 ||
+            options.read_ahead < 0) {
+          errOutput("unable to parse read-ahead: '%s'", optarg);
+        }
+        break;
+
+      case OPT_WRITE_BEHIND:
+        if (sscanf(optarg, "%d", &options.write_behind) != 1 ||
+            options.write_behind < 0) {
+          errOutput("unable to parse write-behind: '%s'", optarg);
+        }
+        break;
+
+      case OPT_TIMINGS:
+        options.timings_file = optarg;
+        break;
+
+      case OPT_INPUT_FORMAT:
+        options.input_format = optarg;
+        break;
       }
     }
 
@@ -949,10 +2156,10 @@ int main(int argc, char *argv[]) {
     options.abs_black_threshold = WHITE * (1.0 - blackThreshold);
     options.abs_white_threshold = WHITE * (whiteThreshold);
 
-    if (!validate_deskew_parameters(&options.deskew_parameters, deskewScanRange,
-                                    deskewScanStep, deskewScanDeviation,
-                                    deskewScanSize, deskewScanDepth,
-                                    deskewScanEdges)) {
+    if (!validate_deskew_parameters(&options.deskew_parameters, deskewMethod,
+                                    deskewScanRange, deskewScanStep,
+                                    deskewScanDeviation, deskewScanSize,
+                                    deskewScanDepth, deskewScanEdges)) {
       errOutput("deskew parameters are not valid.");
     }
     if (!validate_mask_detection_parameters(
@@ -1013,10 +2220,36 @@ int main(int argc, char *argv[]) {
   int inputNr = options.start_input;
   int outputNr = options.start_output;
 
-  RectangleSize inputSize = {-1, -1};
-  RectangleSize previousSize = {-1, -1};
-  Image sheet = EMPTY_IMAGE;
-  Image page = EMPTY_IMAGE;
+  if (options.timings_file != NULL && !timings_open(options.timings_file)) {
+    errOutput("unable to open timings file: '%s'", options.timings_file);
+  }
+  if (options.input_format != NULL && !setInputFormat(options.input_format)) {
+    errOutput("unknown input format: '%s'", options.input_format);
+  }
+  tile_threads_start(options.threads);
+
+  // Sheets are loaded and processed by the workers, in the order they are
+  // planned in here. With --read-ahead, they are instead loaded by a reader
+  // thread of their own, and only handed to the workers once that many
+  // sheets after them have been planned, so that these are loaded meanwhile.
+  WorkerPool *pool =
+      worker_pool_create(options.jobs > 1 ? options.jobs : 0, options.jobs);
+  WorkerPool *reader =
+      worker_pool_create(options.read_ahead > 0 ? 1 : 0, options.read_ahead);
+  // With --write-behind, output pages are saved by a writer thread of their
+  // own, in the order they are finished in.
+  WorkerPool *writer = worker_pool_create(options.write_behind > 0 ? 1 : 0,
+                                          options.write_behind);
+  const size_t ahead_size = options.read_ahead + 1;
+  SheetJob *ahead[ahead_size];
+  size_t ahead_first = 0, ahead_count = 0;
+  Relay *relay = relay_create(
+      &(InheritedSettings){
+          .size = {-1, -1},
+          .output_pixel_format = options.output_pixel_format,
+      },
+      sizeof(InheritedSettings));
+  size_t sequence = 0;
 
   for (int nr = options.start_sheet;
        (options.end_sheet == -1) || (nr <= options.end_sheet); nr++) {
@@ -1025,6 +2258,11 @@ int main(int argc, char *argv[]) {
     char *inputFileNames[2];
     char *outputFileNames[2];
 
+    // Do not start any further sheet once an output page failed to save.
+    if (atomic_load(&write_failed)) {
+      break;
+    }
+
     // -------------------------------------------------------------------
     // --- begin processing                                            ---
     // -------------------------------------------------------------------
@@ -1109,804 +2347,35 @@ int main(int argc, char *argv[]) {
 
     if (isInMultiIndex(nr, options.sheet_multi_index) &&
         (!isInMultiIndex(nr, options.exclude_multi_index))) {
-      char s1[1023]; // buffers for result of implode()
-      char s2[1023];
-
-      verboseLog(
-          VERBOSE_NORMAL,
-          "\n-------------------------------------------------------------"
-          "------------------\n");
-
-      if (options.multiple_sheets) {
-        verboseLog(
-            VERBOSE_NORMAL, "Processing sheet #%d: %s -> %s\n", nr,
-            implode(s1, (const char **)inputFileNames, options.input_count),
-            implode(s2, (const char **)outputFileNames, options.output_count));
-      } else {
-        verboseLog(
-            VERBOSE_NORMAL, "Processing sheet: %s -> %s\n",
-            implode(s1, (const char **)inputFileNames, options.input_count),
-            implode(s2, (const char **)outputFileNames, options.output_count));
-      }
-
-      // load input image(s)
-      for (int j = 0; j < options.input_count; j++) {
-        if (inputFileNames[j] !=
-            NULL) { // may be null if --insert-blank or --replace-blank
-          verboseLog(VERBOSE_MORE, "loading file %s.\n", inputFileNames[j]);
-
-          loadImage(inputFileNames[j], &page, options.sheet_background,
-                    options.abs_black_threshold);
-          saveDebug("_loaded_%d.pnm", inputNr - options.input_count + j, page);
-
-          if (options.output_pixel_format == AV_PIX_FMT_NONE &&
-              page.frame != NULL) {
-            options.output_pixel_format = page.frame->format;
-          }
-
-          // pre-rotate
-          if (options.pre_rotate != 0) {
-            verboseLog(VERBOSE_NORMAL, "pre-rotating %hd degrees.\n",
-                       options.pre_rotate);
-
-            flip_rotate_90(&page, options.pre_rotate / 90);
-          }
-
-          // if sheet-size is not known yet (and not forced by --sheet-size),
-          // set now based on size of (first) input image
-          RectangleSize inputSheetSize = {
-              .width = page.frame->width * options.input_count,
-              .height = page.frame->height,
-          };
-          inputSize = coerce_size(
-              inputSize, coerce_size(options.sheet_size, inputSheetSize));
-        } else { // inputFiles[j] == NULL
-          page = EMPTY_IMAGE;
-        }
-
-        // place image into sheet buffer
-        // allocate sheet-buffer if not done yet
-        if ((sheet.frame == NULL) && (inputSize.width != -1) &&
-            (inputSize.height != -1)) {
-          sheet = create_image(inputSize, AV_PIX_FMT_RGB24, true,
-                               options.sheet_background,
-                               options.abs_black_threshold);
-        }
-        if (page.frame != NULL) {
-          saveDebug("_page%d.pnm", inputNr - options.input_count + j, page);
-          saveDebug("_before_center_page%d.pnm",
-                    inputNr - options.input_count + j, sheet);
-
-          center_image(page, sheet,
-                       (Point){(inputSize.width * j / options.input_count), 0},
-                       (RectangleSize){(inputSize.width / options.input_count),
-                                       inputSize.height});
-
-          saveDebug("_after_center_page%d.pnm",
-                    inputNr - options.input_count + j, sheet);
-        }
-      }
-
-      // the only case that buffer is not yet initialized is if all blank pages
-      // have been inserted
-      if (sheet.frame == NULL) {
-        // last chance: try to get previous (unstretched/not zoomed) sheet size
-        inputSize = previousSize;
-        verboseLog(VERBOSE_NORMAL,
-                   "need to guess sheet size from previous sheet: %dx%d\n",
-                   inputSize.width, inputSize.height);
-
-        if ((inputSize.width == -1) || (inputSize.height == -1)) {
-          errOutput("sheet size unknown, use at least one input file per "
-                    "sheet, or force using --sheet-size.");
-        } else {
-          sheet = create_image(inputSize, AV_PIX_FMT_RGB24, true,
-                               options.sheet_background,
-                               options.abs_black_threshold);
-        }
-      }
-
-      previousSize = inputSize;
-
-      // pre-mirroring
-      if (options.pre_mirror.horizontal || options.pre_mirror.vertical) {
-        verboseLog(VERBOSE_NORMAL, "pre-mirroring %s\n",
-                   direction_to_string(options.pre_mirror));
-
-        mirror(sheet, options.pre_mirror);
-      }
-
-      // pre-shifting
-      if (options.pre_shift.horizontal != 0 ||
-          options.pre_shift.vertical != 0) {
-        verboseLog(VERBOSE_NORMAL, "pre-shifting [%" PRId32 ",%" PRId32 "]\n",
-                   options.pre_shift.horizontal, options.pre_shift.vertical);
-
-        shift_image(&sheet, options.pre_shift);
-      }
-
-      // pre-masking
-      if (preMaskCount > 0) {
-        verboseLog(VERBOSE_NORMAL, "pre-masking\n ");
-
-        apply_masks(sheet, preMasks, preMaskCount, options.mask_color);
-      }
-
-      // --------------------------------------------------------------
-      // --- verbose parameter output,                              ---
-      // --------------------------------------------------------------
-
-      // parameters and size are known now
-
-      if (verbose >= VERBOSE_MORE) {
-        switch (options.layout) {
-        case LAYOUT_NONE:
-          printf("layout: none\n");
-          break;
-        case LAYOUT_SINGLE:
-          printf("layout: single\n");
-          break;
-        case LAYOUT_DOUBLE:
-          printf("layout: double\n");
-          break;
-        default:
-          assert(false); // unreachable
-        }
-
-        if (options.pre_rotate != 0) {
-          printf("pre-rotate: %d\n", options.pre_rotate);
-        }
-        printf("pre-mirror: %s\n", direction_to_string(options.pre_mirror));
-        if (options.pre_shift.horizontal != 0 ||
-            options.pre_shift.vertical != 0) {
-          printf("pre-shift: [%" PRId32 ",%" PRId32 "]\n",
-                 options.pre_shift.horizontal, options.pre_shift.vertical);
-        }
-        if (options.pre_wipes.count > 0) {
-          printf("pre-wipe: ");
-          for (size_t i = 0; i < options.pre_wipes.count; i++) {
-            print_rectangle(options.pre_wipes.areas[i]);
-          }
-          printf("\n");
-        }
-        if (memcmp(&options.pre_border, &BORDER_NULL, sizeof(BORDER_NULL)) !=
-            0) {
-          printf("pre-border: ");
-          print_border(options.pre_border);
-          printf("\n");
-        }
-        if (preMaskCount > 0) {
-          printf("pre-masking: ");
-          for (int i = 0; i < preMaskCount; i++) {
-            print_rectangle(preMasks[i]);
-          }
-          printf("\n");
-        }
-        if (options.stretch_size.width != -1 ||
-            options.stretch_size.height != -1) {
-          printf("stretch to: %" PRId32 "x%" PRId32 "\n",
-                 options.stretch_size.width, options.stretch_size.height);
-        }
-        if (options.post_stretch_size.width != -1 ||
-            options.post_stretch_size.height != -1) {
-          printf("post-stretch to: %" PRId32 "x%" PRId32 "d\n",
-                 options.post_stretch_size.width,
-                 options.post_stretch_size.height);
-        }
-        if (options.pre_zoom_factor != 1.0) {
-          printf("zoom: %f\n", options.pre_zoom_factor);
-        }
-        if (options.post_zoom_factor != 1.0) {
-          printf("post-zoom: %f\n", options.post_zoom_factor);
-        }
-        if (options.no_blackfilter_multi_index.count != -1) {
-          printf("blackfilter-scan-direction: %s\n",
-                 direction_to_string(
-                     options.blackfilter_parameters.scan_direction));
-          printf("blackfilter-scan-size: ");
-          print_rectangle_size(options.blackfilter_parameters.scan_size);
-          printf("\nblackfilter-scan-depth: [%d,%d]\n",
-                 options.blackfilter_parameters.scan_depth.horizontal,
-                 options.blackfilter_parameters.scan_depth.vertical);
-          printf("blackfilter-scan-step: ");
-          print_delta(options.blackfilter_parameters.scan_step);
-          printf("\nblackfilter-scan-threshold: %d\n",
-                 options.blackfilter_parameters.abs_threshold);
-          if (options.blackfilter_parameters.exclusions_count > 0) {
-            printf("blackfilter-scan-exclude: ");
-            for (size_t i = 0;
-                 i < options.blackfilter_parameters.exclusions_count; i++) {
-              print_rectangle(options.blackfilter_parameters.exclusions[i]);
-            }
-            printf("\n");
-          }
-          printf("blackfilter-intensity: %d\n",
-                 options.blackfilter_parameters.intensity);
-          if (options.no_blackfilter_multi_index.count > 0) {
-            printf("blackfilter DISABLED for sheets: ");
-            printMultiIndex(options.no_blackfilter_multi_index);
-          }
-        } else {
-          printf("blackfilter DISABLED for all sheets.\n");
-        }
-        if (options.no_noisefilter_multi_index.count != -1) {
-          printf("noisefilter-intensity: %" PRIu64 "\n",
-                 options.noisefilter_intensity);
-          if (options.no_noisefilter_multi_index.count > 0) {
-            printf("noisefilter DISABLED for sheets: ");
-            printMultiIndex(options.no_noisefilter_multi_index);
-          }
-        } else {
-          printf("noisefilter DISABLED for all sheets.\n");
-        }
-        if (options.no_blurfilter_multi_index.count != -1) {
-          printf("blurfilter-size: ");
-          print_rectangle_size(options.blurfilter_parameters.scan_size);
-          printf("\nblurfilter-step: ");
-          print_delta(options.blurfilter_parameters.scan_step);
-          printf("\nblurfilter-intensity: %f\n",
-                 options.blurfilter_parameters.intensity);
-          if (options.no_blurfilter_multi_index.count > 0) {
-            printf("blurfilter DISABLED for sheets: ");
-            printMultiIndex(options.no_blurfilter_multi_index);
-          }
-        } else {
-          printf("blurfilter DISABLED for all sheets.\n");
-        }
-        if (options.no_grayfilter_multi_index.count != -1) {
-          printf("grayfilter-size: ");
-          print_rectangle_size(options.grayfilter_parameters.scan_size);
-          printf("\ngrayfilter-step: ");
-          print_delta(options.grayfilter_parameters.scan_step);
-          printf("\ngrayfilter-threshold: %d\n",
-                 options.grayfilter_parameters.abs_threshold);
-          if (options.no_grayfilter_multi_index.count > 0) {
-            printf("grayfilter DISABLED for sheets: ");
-            printMultiIndex(options.no_grayfilter_multi_index);
-          }
-        } else {
-          printf("grayfilter DISABLED for all sheets.\n");
-        }
-        if (options.no_mask_scan_multi_index.count != -1) {
-          printf("mask points: ");
-          for (int i = 0; i < pointCount; i++) {
-            printf("(%d,%d) ", points[i].x, points[i].y);
-          }
-          printf("\n");
-          printf("mask-scan-direction: %s\n",
-                 direction_to_string(
-                     options.mask_detection_parameters.scan_direction));
-          printf("mask-scan-size: ");
-          print_rectangle_size(options.mask_detection_parameters.scan_size);
-          printf("\nmask-scan-depth: [%d,%d]\n",
-                 options.mask_detection_parameters.scan_depth.horizontal,
-                 options.mask_detection_parameters.scan_depth.vertical);
-          printf("mask-scan-step: ");
-          print_delta(options.mask_detection_parameters.scan_step);
-          printf("\nmask-scan-threshold: [%f,%f]\n",
-                 options.mask_detection_parameters.scan_threshold.horizontal,
-                 options.mask_detection_parameters.scan_threshold.vertical);
-          printf("mask-scan-minimum: [%d,%d]\n",
-                 options.mask_detection_parameters.minimum_width,
-                 options.mask_detection_parameters.minimum_height);
-          printf("mask-scan-maximum: [%d,%d]\n",
-                 options.mask_detection_parameters.maximum_width,
-                 options.mask_detection_parameters.maximum_height);
-          printf("mask-color: ");
-          print_color(options.mask_color);
-          printf("\n");
-          if (options.no_mask_scan_multi_index.count > 0) {
-            printf("mask-scan DISABLED for sheets: ");
-            printMultiIndex(options.no_mask_scan_multi_index);
-          }
-        } else {
-          printf("mask-scan DISABLED for all sheets.\n");
-        }
-        if (options.no_deskew_multi_index.count != -1) {
-          printf("deskew-scan-direction: ");
-          print_edges(options.deskew_parameters.scan_edges);
-          printf("deskew-scan-size: %d\n",
-                 options.deskew_parameters.deskewScanSize);
-          printf("deskew-scan-depth: %f\n",
-                 options.deskew_parameters.deskewScanDepth);
-          printf("deskew-scan-range: %f\n",
-                 options.deskew_parameters.deskewScanRangeRad);
-          printf("deskew-scan-step: %f\n",
-                 options.deskew_parameters.deskewScanStepRad);
-          printf("deskew-scan-deviation: %f\n",
-                 options.deskew_parameters.deskewScanDeviationRad);
-          if (options.no_deskew_multi_index.count > 0) {
-            printf("deskew-scan DISABLED for sheets: ");
-            printMultiIndex(options.no_deskew_multi_index);
-          }
-        } else {
-          printf("deskew-scan DISABLED for all sheets.\n");
-        }
-        if (options.no_wipe_multi_index.count != -1) {
-          if (options.wipes.count > 0) {
-            printf("wipe areas: ");
-            for (size_t i = 0; i < options.wipes.count; i++) {
-              print_rectangle(options.wipes.areas[i]);
-            }
-            printf("\n");
-          }
-        } else {
-          printf("wipe DISABLED for all sheets.\n");
-        }
-        if (middleWipe[0] > 0 || middleWipe[1] > 0) {
-          printf("middle-wipe (l,r): %d,%d\n", middleWipe[0], middleWipe[1]);
-        }
-        if (options.no_border_multi_index.count != -1) {
-          if (memcmp(&options.border, &BORDER_NULL, sizeof(BORDER_NULL)) != 0) {
-            printf("explicit border: ");
-            print_border(options.border);
-            printf("\n");
-          }
-        } else {
-          printf("border DISABLED for all sheets.\n");
-        }
-        if (options.no_border_scan_multi_index.count != -1) {
-          printf("border-scan-direction: %s\n",
-                 direction_to_string(
-                     options.border_scan_parameters.scan_direction));
-          printf("border-scan-size: ");
-          print_rectangle_size(options.border_scan_parameters.scan_size);
-          printf("\nborder-scan-step: ");
-          print_delta(options.border_scan_parameters.scan_step);
-          printf("\nborder-scan-threshold: [%d,%d]\n",
-                 options.border_scan_parameters.scan_threshold.horizontal,
-                 options.border_scan_parameters.scan_threshold.vertical);
-          if (options.no_border_scan_multi_index.count > 0) {
-            printf("border-scan DISABLED for sheets: ");
-            printMultiIndex(options.no_border_scan_multi_index);
-          }
-          printf("border-align: ");
-          print_edges(options.mask_alignment_parameters.alignment);
-          printf("border-margin: [%d,%d]\n",
-                 options.mask_alignment_parameters.margin.horizontal,
-                 options.mask_alignment_parameters.margin.vertical);
-        } else {
-          printf("border-scan DISABLED for all sheets.\n");
-        }
-        if (options.post_wipes.count > 0) {
-          printf("post-wipe: ");
-          for (size_t i = 0; i < options.post_wipes.count; i++) {
-            print_rectangle(options.post_wipes.areas[i]);
-          }
-          printf("\n");
-        }
-        if (memcmp(&options.post_border, &BORDER_NULL, sizeof(BORDER_NULL)) !=
-            0) {
-          printf("post-border: ");
-          print_border(options.post_border);
-          printf("\n");
-        }
-        printf("post-mirror: %s\n", direction_to_string(options.post_mirror));
-        if (options.post_shift.horizontal != 0 ||
-            options.post_shift.vertical != 0) {
-          printf("post-shift: [%" PRId32 ",%" PRId32 "]\n",
-                 options.post_shift.horizontal, options.post_shift.vertical);
-        }
-        if (options.post_rotate != 0) {
-          printf("post-rotate: %d\n", options.post_rotate);
-        }
-        // if (options.ignoreMultiIndex.count > 0) {
-        //    printf("EXCLUDE sheets: ");
-        //    printMultiIndex(options.ignoreMultiIndex);
-        //}
-        printf("white-threshold: %d\n", options.abs_white_threshold);
-        printf("black-threshold: %d\n", options.abs_black_threshold);
-        printf("sheet-background: ");
-        print_color(options.sheet_background);
-        printf("\n");
-        printf("input-files per sheet: %d\n", options.input_count);
-        printf("output-files per sheet: %d\n", options.output_count);
-        if (options.sheet_size.width != -1 || options.sheet_size.height != -1) {
-          printf("sheet size forced to: %" PRId32 " x %" PRId32 " pixels\n",
-                 options.sheet_size.width, options.sheet_size.height);
-        }
-        printf("input-file-sequence:  %s\n",
-               implode(s1, (const char **)inputFileNames, options.input_count));
-        printf(
-            "output-file-sequence: %s\n",
-            implode(s1, (const char **)outputFileNames, options.output_count));
-        if (options.overwrite_output) {
-          printf("OVERWRITING EXISTING FILES\n");
-        }
-        printf("\n");
+      SheetJob *job = calloc(1, sizeof(SheetJob));
+      if (job == NULL) {
+        errOutput("unable to allocate sheet.");
       }
-      verboseLog(
-          VERBOSE_NORMAL, "input-file%s for sheet %d: %s\n",
-          pluralS(options.input_count), nr,
-          implode(s1, (const char **)inputFileNames, options.input_count));
-      verboseLog(
-          VERBOSE_NORMAL, "output-file%s for sheet %d: %s\n",
-          pluralS(options.output_count), nr,
-          implode(s1, (const char **)outputFileNames, options.output_count));
-      verboseLog(VERBOSE_NORMAL, "sheet size: %dx%d\n", sheet.frame->width,
-                 sheet.frame->height);
-      verboseLog(VERBOSE_NORMAL, "...\n");
-
-      // -------------------------------------------------------
-      // --- process image data                              ---
-      // -------------------------------------------------------
-
-      // stretch
-      inputSize = coerce_size(options.stretch_size, size_of_image(sheet));
-
-      inputSize.width *= options.pre_zoom_factor;
-      inputSize.height *= options.pre_zoom_factor;
-
-      saveDebug("_before-stretch%d.pnm", nr, sheet);
-      stretch_and_replace(&sheet, inputSize, options.interpolate_type);
-      saveDebug("_after-stretch%d.pnm", nr, sheet);
-
-      // size
-      if (options.page_size.width != -1 || options.page_size.height != -1) {
-        inputSize = coerce_size(options.page_size, size_of_image(sheet));
-        saveDebug("_before-resize%d.pnm", nr, sheet);
-        resize_and_replace(&sheet, inputSize, options.interpolate_type);
-        saveDebug("_after-resize%d.pnm", nr, sheet);
-      }
-
-      // handle sheet layout
 
-      // LAYOUT_SINGLE
-      if (options.layout == LAYOUT_SINGLE) {
-        // set middle of sheet as single starting point for mask detection
-        if (pointCount == 0) { // no manual settings, use auto-values
-          points[pointCount++] =
-              (Point){sheet.frame->width / 2, sheet.frame->height / 2};
-        }
-        if (options.mask_detection_parameters.maximum_width == -1) {
-          options.mask_detection_parameters.maximum_width = sheet.frame->width;
-        }
-        if (options.mask_detection_parameters.maximum_height == -1) {
-          options.mask_detection_parameters.maximum_height =
-              sheet.frame->height;
+      job->options = &options;
+      job->relay = relay;
+      job->writer = writer;
+      job->timings = sheet_timings_create(nr);
+      job->sequence = sequence++;
+      job->nr = nr;
+      job->first_input = inputNr - options.input_count;
+      for (int i = 0; i < options.input_count; i++) {
+        if (inputFileNames[i] != NULL) {
+          snprintf(job->input_files[i], PATH_MAX, "%s", inputFileNames[i]);
         }
-        // avoid inner half of the sheet to be blackfilter-detectable
-        if (options.blackfilter_parameters.exclusions_count == 0) {
-          // no manual settings, use auto-values
-          RectangleSize sheetSize = size_of_image(sheet);
-          options.blackfilter_parameters
-              .exclusions[options.blackfilter_parameters.exclusions_count++] =
-              rectangle_from_size(
-                  (Point){sheetSize.width / 4, sheetSize.height / 4},
-                  (RectangleSize){.width = sheetSize.width / 2,
-                                  .height = sheetSize.height / 2});
-        }
-        // set single outside border to start scanning for final border-scan
-        if (outsideBorderscanMaskCount ==
-            0) { // no manual settings, use auto-values
-          outsideBorderscanMask[outsideBorderscanMaskCount++] =
-              full_image(sheet);
-        }
-
-        // LAYOUT_DOUBLE
-      } else if (options.layout == LAYOUT_DOUBLE) {
-        // set two middle of left/right side of sheet as starting points for
-        // mask detection
-        if (pointCount == 0) { // no manual settings, use auto-values
-          points[pointCount++] =
-              (Point){sheet.frame->width / 4, sheet.frame->height / 2};
-          points[pointCount++] =
-              (Point){sheet.frame->width - sheet.frame->width / 4,
-                      sheet.frame->height / 2};
-        }
-        if (options.mask_detection_parameters.maximum_width == -1) {
-          options.mask_detection_parameters.maximum_width =
-              sheet.frame->width / 2;
-        }
-        if (options.mask_detection_parameters.maximum_height == -1) {
-          options.mask_detection_parameters.maximum_height =
-              sheet.frame->height;
-        }
-        if (middleWipe[0] > 0 || middleWipe[1] > 0) { // left, right
-          options.wipes.areas[options.wipes.count++] = (Rectangle){{
-              {sheet.frame->width / 2 - middleWipe[0], 0},
-              {sheet.frame->width / 2 + middleWipe[1], sheet.frame->height - 1},
-          }};
-        }
-        // avoid inner half of each page to be blackfilter-detectable
-        if (options.blackfilter_parameters.exclusions_count == 0) {
-          // no manual settings, use auto-values
-          RectangleSize sheetSize = size_of_image(sheet);
-          RectangleSize filterSize = {
-              .width = sheetSize.width / 4,
-              .height = sheetSize.height / 2,
-          };
-          Point firstFilterOrigin = {sheetSize.width / 8, sheetSize.height / 4};
-          Point secondFilterOrigin =
-              shift_point(firstFilterOrigin, (Delta){sheet.frame->width / 2});
-
-          options.blackfilter_parameters
-              .exclusions[options.blackfilter_parameters.exclusions_count++] =
-              rectangle_from_size(firstFilterOrigin, filterSize);
-          options.blackfilter_parameters
-              .exclusions[options.blackfilter_parameters.exclusions_count++] =
-              rectangle_from_size(secondFilterOrigin, filterSize);
-        }
-        // set two outside borders to start scanning for final border-scan
-        if (outsideBorderscanMaskCount ==
-            0) { // no manual settings, use auto-values
-          outsideBorderscanMask[outsideBorderscanMaskCount++] =
-              (Rectangle){{POINT_ORIGIN,
-                           {sheet.frame->width / 2, sheet.frame->height - 1}}};
-          outsideBorderscanMask[outsideBorderscanMaskCount++] =
-              (Rectangle){{{sheet.frame->width / 2, 0},
-                           {sheet.frame->width - 1, sheet.frame->height - 1}}};
-        }
-      }
-      // if maskScanMaximum still unset (no --layout specified), set to full
-      // sheet size now
-      if (options.mask_detection_parameters.maximum_width == -1) {
-        options.mask_detection_parameters.maximum_width = sheet.frame->width;
-      }
-      if (options.mask_detection_parameters.maximum_height == -1) {
-        options.mask_detection_parameters.maximum_height = sheet.frame->height;
-      }
-
-      // pre-wipe
-      if (!isExcluded(nr, options.no_wipe_multi_index,
-                      options.ignore_multi_index)) {
-        apply_wipes(sheet, options.pre_wipes, options.mask_color);
-      }
-
-      // pre-border
-      if (!isExcluded(nr, options.no_border_multi_index,
-                      options.ignore_multi_index)) {
-        apply_border(sheet, options.pre_border, options.mask_color);
-      }
-
-      // black area filter
-      if (!isExcluded(nr, options.no_blackfilter_multi_index,
-                      options.ignore_multi_index)) {
-        saveDebug("_before-blackfilter%d.pnm", nr, sheet);
-        blackfilter(sheet, options.blackfilter_parameters);
-        saveDebug("_after-blackfilter%d.pnm", nr, sheet);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ blackfilter DISABLED for sheet %d\n", nr);
-      }
-
-      // noise filter
-      if (!isExcluded(nr, options.no_noisefilter_multi_index,
-                      options.ignore_multi_index)) {
-        saveDebug("_before-noisefilter%d.pnm", nr, sheet);
-        noisefilter(sheet, options.noisefilter_intensity,
-                    options.abs_white_threshold);
-        saveDebug("_after-noisefilter%d.pnm", nr, sheet);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ noisefilter DISABLED for sheet %d\n", nr);
-      }
-
-      // blur filter
-      if (!isExcluded(nr, options.no_blurfilter_multi_index,
-                      options.ignore_multi_index)) {
-        saveDebug("_before-blurfilter%d.pnm", nr, sheet);
-        blurfilter(sheet, options.blurfilter_parameters,
-                   options.abs_white_threshold);
-        saveDebug("_after-blurfilter%d.pnm", nr, sheet);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ blurfilter DISABLED for sheet %d\n", nr);
       }
-
-      // mask-detection
-      if (!isExcluded(nr, options.no_mask_scan_multi_index,
-                      options.ignore_multi_index)) {
-        detect_masks(sheet, options.mask_detection_parameters, points,
-                     pointCount, masks);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ mask-scan DISABLED for sheet %d\n", nr);
+      for (int i = 0; i < options.output_count; i++) {
+        snprintf(job->output_files[i], PATH_MAX, "%s", outputFileNames[i]);
       }
 
-      // permanently apply masks
-      if (maskCount > 0) {
-        saveDebug("_before-masking%d.pnm", nr, sheet);
-        apply_masks(sheet, masks, maskCount, options.mask_color);
-        saveDebug("_after-masking%d.pnm", nr, sheet);
+      if (options.read_ahead > 0) {
+        job->loading = worker_pool_start(reader, load_sheet, job);
       }
-
-      // gray filter
-      if (!isExcluded(nr, options.no_grayfilter_multi_index,
-                      options.ignore_multi_index)) {
-        saveDebug("_before-grayfilter%d.pnm", nr, sheet);
-        grayfilter(sheet, options.grayfilter_parameters);
-        saveDebug("_after-grayfilter%d.pnm", nr, sheet);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ grayfilter DISABLED for sheet %d\n", nr);
-      }
-
-      // rotation-detection
-      if ((!isExcluded(nr, options.no_deskew_multi_index,
-                       options.ignore_multi_index))) {
-        saveDebug("_before-deskew%d.pnm", nr, sheet);
-
-        // detect masks again, we may get more precise results now after first
-        // masking and grayfilter
-        if (!isExcluded(nr, options.no_mask_scan_multi_index,
-                        options.ignore_multi_index)) {
-          maskCount = detect_masks(sheet, options.mask_detection_parameters,
-                                   points, pointCount, masks);
-        } else {
-          verboseLog(VERBOSE_MORE, "(mask-scan before deskewing disabled)\n");
-        }
-
-        // auto-deskew each mask
-        for (size_t i = 0; i < maskCount; i++) {
-          float rotation =
-              detect_rotation(sheet, masks[i], options.deskew_parameters);
-
-          verboseLog(VERBOSE_NORMAL, "rotate (%d,%d): %f\n", points[i].x,
-                     points[i].y, rotation);
-
-          if (rotation != 0.0) {
-            saveDebug("_before-deskew-detect%d.pnm", nr * maskCount + i, sheet);
-            deskew(sheet, masks[i], rotation, options.interpolate_type);
-            saveDebug("_after-deskew-detect%d.pnm", nr * maskCount + i, sheet);
-          }
-        }
-
-        saveDebug("_after-deskew%d.pnm", nr, sheet);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ deskewing DISABLED for sheet %d\n", nr);
-      }
-
-      // auto-center masks on either single-page or double-page layout
-      if (!isExcluded(
-              nr, options.no_mask_center_multi_index,
-              options.ignore_multi_index)) { // (maskCount==pointCount to
-                                             // make sure all masks had
-                                             // correctly been detected)
-        // perform auto-masking again to get more precise masks after rotation
-        if (!isExcluded(nr, options.no_mask_scan_multi_index,
-                        options.ignore_multi_index)) {
-          maskCount = detect_masks(sheet, options.mask_detection_parameters,
-                                   points, pointCount, masks);
-        } else {
-          verboseLog(VERBOSE_MORE, "(mask-scan before centering disabled)\n");
-        }
-
-        saveDebug("_before-centering%d.pnm", nr, sheet);
-        // center masks on the sheet, according to their page position
-        for (int i = 0; i < maskCount; i++) {
-          center_mask(sheet, points[i], masks[i]);
-        }
-        saveDebug("_after-centering%d.pnm", nr, sheet);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ auto-centering DISABLED for sheet %d\n",
-                   nr);
-      }
-
-      // explicit wipe
-      if (!isExcluded(nr, options.no_wipe_multi_index,
-                      options.ignore_multi_index)) {
-        apply_wipes(sheet, options.wipes, options.mask_color);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ wipe DISABLED for sheet %d\n", nr);
-      }
-
-      // explicit border
-      if (!isExcluded(nr, options.no_border_multi_index,
-                      options.ignore_multi_index)) {
-        apply_border(sheet, options.border, options.mask_color);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ border DISABLED for sheet %d\n", nr);
-      }
-
-      // border-detection
-      if (!isExcluded(nr, options.no_border_scan_multi_index,
-                      options.ignore_multi_index)) {
-        Rectangle autoborderMask[outsideBorderscanMaskCount];
-        saveDebug("_before-border%d.pnm", nr, sheet);
-        for (int i = 0; i < outsideBorderscanMaskCount; i++) {
-          autoborderMask[i] = border_to_mask(
-              sheet, detect_border(sheet, options.border_scan_parameters,
-                                   outsideBorderscanMask[i]));
-        }
-        apply_masks(sheet, autoborderMask, outsideBorderscanMaskCount,
-                    options.mask_color);
-        for (int i = 0; i < outsideBorderscanMaskCount; i++) {
-          // border-centering
-          if (!isExcluded(nr, options.no_border_align_multi_index,
-                          options.ignore_multi_index)) {
-            align_mask(sheet, autoborderMask[i], outsideBorderscanMask[i],
-                       options.mask_alignment_parameters);
-          } else {
-            verboseLog(VERBOSE_MORE,
-                       "+ border-centering DISABLED for sheet %d\n", nr);
-          }
-        }
-        saveDebug("_after-border%d.pnm", nr, sheet);
-      } else {
-        verboseLog(VERBOSE_MORE, "+ border-scan DISABLED for sheet %d\n", nr);
-      }
-
-      // post-wipe
-      if (!isExcluded(nr, options.no_wipe_multi_index,
-                      options.ignore_multi_index)) {
-        apply_wipes(sheet, options.post_wipes, options.mask_color);
-      }
-
-      // post-border
-      if (!isExcluded(nr, options.no_border_multi_index,
-                      options.ignore_multi_index)) {
-        apply_border(sheet, options.post_border, options.mask_color);
-      }
-
-      // post-mirroring
-      if (options.post_mirror.horizontal || options.post_mirror.vertical) {
-        verboseLog(VERBOSE_NORMAL, "post-mirroring %s\n",
-                   direction_to_string(options.post_mirror));
-        mirror(sheet, options.post_mirror);
-      }
-
-      // post-shifting
-      if ((options.post_shift.horizontal != 0) ||
-          ((options.post_shift.vertical != 0))) {
-        verboseLog(VERBOSE_NORMAL, "post-shifting [%" PRId32 ",%" PRId32 "]\n",
-                   options.post_shift.horizontal, options.post_shift.vertical);
-
-        shift_image(&sheet, options.post_shift);
-      }
-
-      // post-rotating
-      if (options.post_rotate != 0) {
-        verboseLog(VERBOSE_NORMAL, "post-rotating %d degrees.\n",
-                   options.post_rotate);
-        flip_rotate_90(&sheet, options.post_rotate / 90);
-      }
-
-      // post-stretch
-      inputSize = coerce_size(options.post_stretch_size, size_of_image(sheet));
-
-      inputSize.width *= options.post_zoom_factor;
-      inputSize.height *= options.post_zoom_factor;
-
-      stretch_and_replace(&sheet, inputSize, options.interpolate_type);
-
-      // post-size
-      if (options.post_page_size.width != -1 ||
-          options.post_page_size.height != -1) {
-        inputSize = coerce_size(options.post_page_size, size_of_image(sheet));
-        resize_and_replace(&sheet, inputSize, options.interpolate_type);
-      }
-
-      // --- write output file ---
-
-      // write split pages output
-
-      if (options.write_output) {
-        verboseLog(VERBOSE_NORMAL, "writing output.\n");
-        // write files
-        saveDebug("_before-save%d.pnm", nr, sheet);
-
-        if (options.output_pixel_format == AV_PIX_FMT_NONE) {
-          options.output_pixel_format = sheet.frame->format;
-        }
-
-        for (int j = 0; j < options.output_count; j++) {
-          // get pagebuffer
-          page = create_compatible_image(
-              sheet,
-              (RectangleSize){sheet.frame->width / options.output_count,
-                              sheet.frame->height},
-              false);
-          copy_rectangle(
-              sheet, page,
-              (Rectangle){{{page.frame->width * j, 0},
-                           {page.frame->width * j + page.frame->width,
-                            page.frame->height}}},
-              POINT_ORIGIN);
-
-          verboseLog(VERBOSE_MORE, "saving file %s.\n", outputFileNames[j]);
-
-          saveImage(outputFileNames[j], page, options.output_pixel_format);
-
-          free_image(&page);
-        }
-
-        free_image(&sheet);
+      ahead[(ahead_first + ahead_count++) % ahead_size] = job;
+      if (ahead_count == ahead_size) {
+        worker_pool_submit(pool, process_sheet, ahead[ahead_first]);
+        ahead_first = (ahead_first + 1) % ahead_size;
+        ahead_count--;
       }
     }
 
@@ -1920,5 +2389,19 @@ int main(int argc, char *argv[]) {
       optind -= 2;
   }
 
-  return 0;
+  for (; ahead_count > 0; ahead_count--) {
+    worker_pool_submit(pool, process_sheet, ahead[ahead_first]);
+    ahead_first = (ahead_first + 1) % ahead_size;
+  }
+
+  worker_pool_free(&pool);
+  worker_pool_free(&reader);
+  worker_pool_free(&writer);
+  timings_close();
+  relay_free(&relay);
+  tile_threads_stop();
+  freeCodecContexts();
+  frame_pool_drain();
+
+  return atomic_load(&write_failed) ? 1 : 0;
 }
@@ -25,14 +25,21 @@
 
 /* --- tool function for file handling ------------------------------------ */
 
+// Declares the format of all the input files, so that loading does not probe
+// them. Returns false if libavformat has no demuxer of that name.
+bool setInputFormat(const char *name);
+
 void loadImage(const char *filename, Image *image, Pixel sheet_background,
                uint8_t abs_black_threshold);
 
-void saveImage(char *filename, Image image, int outputPixFmt);
+bool saveImage(const char *filename, Image image, int outputPixFmt);
 
 void saveDebug(char *filenameTemplate, int index, Image image)
     __attribute__((format(printf, 1, 0)));
 
+// Frees the codec contexts kept for reuse by loadImage() and saveImage().
+void freeCodecContexts(void);
+
 /* --- arithmetic tool functions ------------------------------------------ */
 
 static inline void limit(int *i, int max) {